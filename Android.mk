@@ -46,6 +46,8 @@ LOCAL_SRC_FILES := \
 	common/compositor/compositor.cpp \
 	common/compositor/factory.cpp \
 	common/compositor/nativesurface.cpp \
+	common/compositor/programbinarycache.cpp \
+	common/compositor/rendererservice.cpp \
 	common/compositor/renderstate.cpp \
 	common/core/hwclayer.cpp \
 	common/core/gpudevice.cpp \
@@ -53,10 +55,14 @@ LOCAL_SRC_FILES := \
 	common/core/overlaybuffer.cpp \
 	common/core/overlaybuffermanager.cpp \
 	common/core/overlaylayer.cpp \
+	common/display/commitscheduler.cpp \
 	common/display/display.cpp \
+	common/display/displaycommitthread.cpp \
 	common/display/displayplane.cpp \
 	common/display/displayplanemanager.cpp \
 	common/display/displayqueue.cpp \
+	common/display/drmkmsbackend.cpp \
+	common/display/fakekmsbackend.cpp \
 	common/display/headless.cpp \
 	common/display/vblankeventhandler.cpp \
         common/display/kmsfencehandler.cpp \
@@ -84,7 +90,21 @@ ifeq ($(strip $(BOARD_DISABLE_NATIVE_COLOR_MODES)),true)
 LOCAL_CPPFLAGS += -DDISABLE_NATIVE_COLOR_MODES
 endif
 
-ifeq ($(strip $(BOARD_USES_VULKAN)),)
+ifeq ($(strip $(BOARD_USES_SOFTWARE_COMPOSITOR)),true)
+LOCAL_CPPFLAGS += \
+	-DUSE_SW
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)/common/compositor/sw
+
+LOCAL_SRC_FILES += \
+	common/compositor/sw/nativeswresource.cpp \
+	common/compositor/sw/swimage.cpp \
+	common/compositor/sw/swkernels.cpp \
+	common/compositor/sw/swrenderer.cpp \
+	common/compositor/sw/swsurface.cpp \
+	common/compositor/scopedrendererstate.cpp
+else ifeq ($(strip $(BOARD_USES_VULKAN)),)
 LOCAL_CPPFLAGS += \
 	-DUSE_GL
 
@@ -16,6 +16,7 @@
 
 #include "compositor.h"
 
+#include <unistd.h>
 #include <xf86drmMode.h>
 
 #include <algorithm>
@@ -23,13 +24,14 @@
 #include "disjoint_layers.h"
 #include "displayplanestate.h"
 #include "hwctrace.h"
+#include "hwcutils.h"
 #include "nativegpuresource.h"
 #include "nativesurface.h"
 #include "nativesync.h"
 #include "overlaylayer.h"
 #include "renderer.h"
+#include "rendererservice.h"
 #include "renderstate.h"
-#include "scopedrendererstate.h"
 
 namespace hwcomposer {
 
@@ -39,27 +41,15 @@ Compositor::Compositor() {
 Compositor::~Compositor() {
 }
 
-void Compositor::Init() {
-  gpu_resource_handler_.reset(CreateNativeGpuResourceHandler());
+void Compositor::Init(RendererService *service) {
+  service_ = service;
+  service_->Init();
 }
 
 bool Compositor::BeginFrame(bool disable_explicit_sync) {
-  if (!renderer_) {
-    renderer_.reset(CreateRenderer());
-    if (!renderer_->Init()) {
-      ETRACE("Failed to initialize OpenGL compositor %s", PRINTERROR());
-      renderer_.reset(nullptr);
-      return false;
-    }
-  }
-
-  renderer_->SetExplicitSyncSupport(disable_explicit_sync);
-
-  return true;
-}
-
-void Compositor::Reset() {
-  renderer_.reset(nullptr);
+  // Renderer is shared, the setting is applied with every job.
+  disable_explicit_sync_ = disable_explicit_sync;
+  return service_->Init();
 }
 
 bool Compositor::Draw(DisplayPlaneStateList &comp_planes,
@@ -68,20 +58,6 @@ bool Compositor::Draw(DisplayPlaneStateList &comp_planes,
   CTRACE();
   const DisplayPlaneState *comp = NULL;
   std::vector<size_t> dedicated_layers;
-  ScopedRendererState state(renderer_.get());
-  if (!state.IsValid()) {
-    ETRACE("Failed to draw as Renderer doesnt have a valid context.");
-    return false;
-  }
-
-  if (!gpu_resource_handler_->PrepareResources(layers)) {
-    ETRACE(
-        "Failed to prepare GPU resources for compositing the frame, "
-        "error: %s",
-        PRINTERROR());
-    return false;
-  }
-
   for (DisplayPlaneState &plane : comp_planes) {
     if (plane.GetCompositionState() == DisplayPlaneState::State::kScanout) {
       dedicated_layers.insert(dedicated_layers.end(),
@@ -93,18 +69,52 @@ bool Compositor::Draw(DisplayPlaneStateList &comp_planes,
       std::vector<CompositionRegion> &comp_regions =
           plane.GetCompositionRegion();
       if (comp_regions.empty()) {
-        SeparateLayers(dedicated_layers, comp->source_layers(), display_frame,
-                       comp_regions);
+        SeparateLayers(layers, dedicated_layers, comp->source_layers(),
+                       display_frame, comp_regions);
       }
 
       std::vector<size_t>().swap(dedicated_layers);
-      if (comp_regions.empty())
-        continue;
+    }
+  }
 
-      if (!Render(layers, plane.GetOffScreenTarget(), comp_regions)) {
-        ETRACE("Failed to Render layer.");
-        return false;
-      }
+  // Import only the layers which are actually sampled by the renderer.
+  std::vector<size_t> render_layers;
+  for (DisplayPlaneState &plane : comp_planes) {
+    if (plane.GetCompositionState() == DisplayPlaneState::State::kRender)
+      GetRenderLayers(plane.GetCompositionRegion(), render_layers);
+  }
+
+  if (render_layers.empty())
+    return true;
+
+  ScopedRenderJob job(service_);
+  if (!job.IsValid()) {
+    ETRACE("Failed to draw as Renderer doesnt have a valid context.");
+    return false;
+  }
+
+  job.renderer()->SetExplicitSyncSupport(disable_explicit_sync_);
+  if (!job.resources()->PrepareResources(layers, render_layers)) {
+    ETRACE(
+        "Failed to prepare GPU resources for compositing the frame, "
+        "error: %s",
+        PRINTERROR());
+    return false;
+  }
+
+  for (DisplayPlaneState &plane : comp_planes) {
+    if (plane.GetCompositionState() != DisplayPlaneState::State::kRender)
+      continue;
+
+    std::vector<CompositionRegion> &comp_regions =
+        plane.GetCompositionRegion();
+    if (comp_regions.empty())
+      continue;
+
+    if (!Render(job.renderer(), job.resources(), layers,
+                plane.GetOffScreenTarget(), comp_regions)) {
+      ETRACE("Failed to Render layer.");
+      return false;
     }
   }
 
@@ -118,13 +128,27 @@ bool Compositor::DrawOffscreen(std::vector<OverlayLayer> &layers,
                                uint32_t width, uint32_t height,
                                HWCNativeHandle output_handle,
                                int32_t *retire_fence) {
-  ScopedRendererState state(renderer_.get());
-  if (!state.IsValid()) {
+  std::vector<CompositionRegion> comp_regions;
+  SeparateLayers(layers, std::vector<size_t>(), source_layers, display_frame,
+                 comp_regions);
+  if (comp_regions.empty()) {
+    ETRACE(
+        "Failed to prepare offscreen buffer. "
+        "error: %s",
+        PRINTERROR());
+    return false;
+  }
+
+  std::vector<size_t> render_layers;
+  GetRenderLayers(comp_regions, render_layers);
+  ScopedRenderJob job(service_);
+  if (!job.IsValid()) {
     ETRACE("Failed to draw as Renderer doesnt have a valid context.");
     return false;
   }
 
-  if (!gpu_resource_handler_->PrepareResources(layers)) {
+  job.renderer()->SetExplicitSyncSupport(disable_explicit_sync_);
+  if (!job.resources()->PrepareResources(layers, render_layers)) {
     ETRACE(
         "Failed to prepare GPU resources for compositing the frame, "
         "error: %s",
@@ -132,44 +156,104 @@ bool Compositor::DrawOffscreen(std::vector<OverlayLayer> &layers,
     return false;
   }
 
+  std::unique_ptr<NativeSurface> surface(CreateBackBuffer(width, height));
+  surface->InitializeForOffScreenRendering(buffer_manager, output_handle);
+
+  if (!Render(job.renderer(), job.resources(), layers, surface.get(),
+              comp_regions))
+    return false;
+
+  *retire_fence = surface->ReleaseNativeFence();
+
+  return true;
+}
+
+bool Compositor::Squash(std::vector<OverlayLayer> &layers,
+                        const std::vector<HwcRect<int>> &display_frame,
+                        const std::vector<size_t> &source_layers,
+                        NativeSurface *surface) {
+  CTRACE();
   std::vector<CompositionRegion> comp_regions;
-  SeparateLayers(std::vector<size_t>(), source_layers, display_frame,
+  SeparateLayers(layers, std::vector<size_t>(), source_layers, display_frame,
                  comp_regions);
-  if (comp_regions.empty()) {
+  // Nothing would clear the surface in this case.
+  if (comp_regions.empty())
+    return false;
+
+  std::vector<size_t> render_layers;
+  GetRenderLayers(comp_regions, render_layers);
+  ScopedRenderJob job(service_);
+  if (!job.IsValid()) {
+    ETRACE("Failed to squash as Renderer doesnt have a valid context.");
+    return false;
+  }
+
+  job.renderer()->SetExplicitSyncSupport(disable_explicit_sync_);
+  if (!job.resources()->PrepareResources(layers, render_layers)) {
     ETRACE(
-        "Failed to prepare offscreen buffer. "
+        "Failed to prepare GPU resources for squashing layers, "
         "error: %s",
         PRINTERROR());
     return false;
   }
 
-  std::unique_ptr<NativeSurface> surface(CreateBackBuffer(width, height));
-  surface->InitializeForOffScreenRendering(buffer_manager, output_handle);
+  return Render(job.renderer(), job.resources(), layers, surface,
+                comp_regions);
+}
 
-  if (!Render(layers, surface.get(), comp_regions))
-    return false;
+void Compositor::InsertFence(uint64_t fence) {
+  ScopedRenderJob job(service_);
+  if (!job.IsValid()) {
+    if (fence > 0)
+      close(fence);
 
-  *retire_fence = surface->ReleaseNativeFence();
+    return;
+  }
 
-  return true;
+  job.renderer()->InsertFence(fence);
 }
 
-void Compositor::InsertFence(uint64_t fence) {
-  renderer_->InsertFence(fence);
+void Compositor::DestroySurfaces(
+    std::vector<std::unique_ptr<NativeSurface>> &surfaces) {
+  ScopedRenderJob job(service_);
+  surfaces.clear();
 }
 
-bool Compositor::Render(std::vector<OverlayLayer> &layers,
+bool Compositor::Render(Renderer *renderer, NativeGpuResource *resources,
+                        std::vector<OverlayLayer> &layers,
                         NativeSurface *surface,
                         const std::vector<CompositionRegion> &comp_regions) {
   CTRACE();
   std::vector<RenderState> states;
   size_t num_regions = comp_regions.size();
   states.reserve(num_regions);
+  // Only the part of surface which is stale needs to be drawn,
+  // rest of it still has valid content from earlier frames.
+  const HwcRect<int> &surface_damage = surface->GetSurfaceDamage();
+  // Regions are in display coordinates, surface content starts
+  // at the top left corner of its display frame.
+  const HwcRect<int> &display_rect = surface->GetLayer()->GetDisplayFrame();
+  int left = display_rect.left;
+  int top = display_rect.top;
 
   for (size_t region_index = 0; region_index < num_regions; region_index++) {
     const CompositionRegion &region = comp_regions.at(region_index);
+    HwcRect<int> frame = IntersectRect(
+        HwcRect<int>(region.frame.left - left, region.frame.top - top,
+                     region.frame.right - left, region.frame.bottom - top),
+        surface_damage);
+    if (IsEmptyRect(frame))
+      continue;
+
     RenderState state;
-    state.ConstructState(layers, region, gpu_resource_handler_.get());
+    state.ConstructState(
+        layers,
+        CompositionRegion{HwcRect<int>(frame.left + left, frame.top + top,
+                                       frame.right + left, frame.bottom + top),
+                          region.source_layers},
+        resources);
+    state.x_ -= left;
+    state.y_ -= top;
     auto it = states.begin();
     for (; it != states.end(); ++it) {
       if (state.layer_state_.size() > it->layer_state_.size())
@@ -179,93 +263,125 @@ bool Compositor::Render(std::vector<OverlayLayer> &layers,
     states.emplace(it, state);
   }
 
-  if (!renderer_->Draw(states, surface))
+  if (states.empty())
+    return true;
+
+  if (!renderer->Draw(states, surface))
     return false;
 
+  surface->ResetSurfaceDamage();
   surface->GetLayer()->SetAcquireFence(surface->ReleaseNativeFence());
   return true;
 }
 
+void Compositor::GetRenderLayers(
+    const std::vector<CompositionRegion> &comp_regions,
+    std::vector<size_t> &render_layers) const {
+  for (const CompositionRegion &region : comp_regions) {
+    for (size_t layer_index : region.source_layers) {
+      if (std::find(render_layers.begin(), render_layers.end(), layer_index) ==
+          render_layers.end())
+        render_layers.emplace_back(layer_index);
+    }
+  }
+}
+
 // Below code is taken from drm_hwcomposer adopted to our needs.
-static std::vector<size_t> SetBitsToVector(
-    uint64_t in, const std::vector<size_t> &index_map) {
+// Returns layers of source_layers whose id is in ids, top most first.
+static std::vector<size_t> SetBitsToVector(const RegionIDs &ids,
+                                           size_t layer_offset,
+                                           const std::vector<size_t> &index_map) {
   std::vector<size_t> out;
-  size_t msb = sizeof(in) * 8 - 1;
-  uint64_t mask = (uint64_t)1 << msb;
-  for (size_t i = msb; mask != (uint64_t)0; i--, mask >>= 1)
-    if (in & mask)
+  for (size_t i = index_map.size(); i-- > 0;) {
+    if (ids.test(i + layer_offset))
       out.emplace_back(index_map[i]);
+  }
+
   return out;
 }
 
-void Compositor::SeparateLayers(const std::vector<size_t> &dedicated_layers,
+void Compositor::SeparateLayers(const std::vector<OverlayLayer> &layers,
+                                const std::vector<size_t> &dedicated_layers,
                                 const std::vector<size_t> &source_layers,
                                 const std::vector<HwcRect<int>> &display_frame,
                                 std::vector<CompositionRegion> &comp_regions) {
   CTRACE();
-  if (source_layers.size() > 64) {
-    ETRACE("Failed to separate layers because there are more than 64");
+  // Index at which the actual layers begin
+  size_t layer_offset = dedicated_layers.size();
+  if (source_layers.size() + layer_offset > RegionIDs::max_elements) {
+    ETRACE("Failed to separate layers because there are more than %zu",
+           RegionIDs::max_elements);
     return;
   }
 
-  size_t num_exclude_rects = 0;
-  // Index at which the actual layers begin
-  size_t layer_offset = dedicated_layers.size();
-  if (source_layers.size() + layer_offset > 64) {
-    WTRACE(
-        "Exclusion rectangles are being truncated to make the rectangle count "
-        "fit into 64");
-    num_exclude_rects = 64 - source_layers.size() - dedicated_layers.size();
+  // We add the dedicated layers first, followed by the layers to be
+  // composited. The rects that intersect with dedicated layers will be
+  // inspected and only those which are to be composited above the layer
+  // will be included in the composition regions.
+  layer_rects_.clear();
+  for (size_t layer_index : dedicated_layers)
+    layer_rects_.emplace_back(display_frame[layer_index]);
+
+  // Transparent layers are left out by giving them an empty rect.
+  for (size_t layer_index : source_layers) {
+    if (layers.at(layer_index).IsTransparent())
+      layer_rects_.emplace_back(0, 0, 0, 0);
+    else
+      layer_rects_.emplace_back(display_frame[layer_index]);
   }
 
-  // We inject all the exclude rects into the rects list. Any resulting rect
-  // that includes ANY of the first num_exclude_rects is rejected. After the
-  // exclude rects, we add the lower layers. The rects that intersect with
-  // these layers will be inspected and only those which are to be composited
-  // above the layer will be included in the composition regions.
-  std::vector<HwcRect<int>> layer_rects(source_layers.size() + layer_offset);
-  std::transform(
-      dedicated_layers.begin(), dedicated_layers.end(),
-      layer_rects.begin() + num_exclude_rects,
-      [=](size_t layer_index) { return display_frame[layer_index]; });
-  std::transform(source_layers.begin(), source_layers.end(),
-                 layer_rects.begin() + layer_offset, [=](size_t layer_index) {
-    return display_frame[layer_index];
-  });
-
-  std::vector<RectSet<int>> separate_regions;
-  get_draw_regions(layer_rects, &separate_regions);
-  uint64_t exclude_mask = ((uint64_t)1 << num_exclude_rects) - 1;
-  uint64_t dedicated_mask = (((uint64_t)1 << dedicated_layers.size()) - 1)
-                            << num_exclude_rects;
-
-  for (RectSet<int> &region : separate_regions) {
-    if (region.id_set.getBits() & exclude_mask)
-      continue;
+  get_draw_regions(layer_rects_, &separate_regions_, &draw_regions_scratch_);
 
+  draw_regions_.clear();
+  for (RectSet<int, kMaxRegionLayers> &region : separate_regions_) {
     // If a rect intersects one of the dedicated layers, we need to remove the
     // layers from the composition region which appear *below* the dedicated
     // layer. This effectively punches a hole through the composition layer such
     // that the dedicated layer can be placed below the composition and not
     // be occluded.
-    uint64_t dedicated_intersect = region.id_set.getBits() & dedicated_mask;
-    for (size_t i = 0; dedicated_intersect && i < dedicated_layers.size();
-         ++i) {
+    for (size_t i = 0; i < dedicated_layers.size(); ++i) {
       // Only exclude layers if they intersect this particular dedicated layer
-      if (!(dedicated_intersect & (1 << (i + num_exclude_rects))))
+      if (!region.id_set.test(i))
         continue;
 
       for (size_t j = 0; j < source_layers.size(); ++j) {
         if (source_layers[j] < dedicated_layers[i])
           region.id_set.subtract(j + layer_offset);
       }
+
+      // Only composited layers are left, so that regions can be merged.
+      region.id_set.subtract(i);
     }
-    if (!(region.id_set.getBits() >> layer_offset))
+
+    // Layers below the top most opaque layer of the region are hidden,
+    // don't sample them.
+    bool occluded = false;
+    for (size_t j = source_layers.size(); j-- > 0;) {
+      if (!region.id_set.test(j + layer_offset))
+        continue;
+
+      if (occluded)
+        region.id_set.subtract(j + layer_offset);
+      else if (layers.at(source_layers[j]).IsOpaque())
+        occluded = true;
+    }
+
+    if (region.id_set.isEmpty())
       continue;
 
+    draw_regions_.emplace_back(region);
+  }
+
+  // Every x event splits a region, join them back so that number of
+  // regions depends on the number of layers rather than their edges.
+  separated_regions_ += draw_regions_.size();
+  merge_draw_regions(&draw_regions_);
+  merged_regions_ += draw_regions_.size();
+
+  for (const RectSet<int, kMaxRegionLayers> &region : draw_regions_) {
     comp_regions.emplace_back(CompositionRegion{
-        region.rect, SetBitsToVector(region.id_set.getBits() >> layer_offset,
-                                     source_layers)});
+        region.rect,
+        SetBitsToVector(region.id_set, layer_offset, source_layers)});
   }
 }
 
@@ -23,21 +23,31 @@
 #include <vector>
 
 #include "compositionregion.h"
+#include "disjoint_layers.h"
 #include "displayplanestate.h"
 #include "factory.h"
 
 namespace hwcomposer {
 
+class NativeGpuResource;
 class OverlayBufferManager;
+class Renderer;
+class RendererService;
 struct OverlayLayer;
 
+// Maximum number of layers, dedicated and composited, which can be
+// separated into composition regions.
+static const size_t kMaxRegionLayers = 256;
+typedef RectIDs<kMaxRegionLayers> RegionIDs;
+
 class Compositor {
  public:
   Compositor();
   ~Compositor();
 
-  void Init();
-  void Reset();
+  // Renderer and GPU resource caches are shared with other displays
+  // through service, which needs to outlive the compositor.
+  void Init(RendererService *service);
 
   Compositor(const Compositor &) = delete;
 
@@ -50,18 +60,52 @@ class Compositor {
                      OverlayBufferManager *buffer_manager, uint32_t width,
                      uint32_t height, HWCNativeHandle output_handle,
                      int32_t *retire_fence);
+  // Composites source_layers into surface, which keeps the result for
+  // later frames. Surface needs to be set up as target of a layer
+  // covering all of them.
+  bool Squash(std::vector<OverlayLayer> &layers,
+              const std::vector<HwcRect<int>> &display_frame,
+              const std::vector<size_t> &source_layers,
+              NativeSurface *surface);
   void InsertFence(uint64_t fence);
 
+  // Destroys offscreen targets which are no longer needed. Resources
+  // of the renderer are released while its context is current.
+  void DestroySurfaces(std::vector<std::unique_ptr<NativeSurface>> &surfaces);
+
+  // Total number of composition regions generated before and
+  // after merging neighbouring regions with the same layers.
+  uint32_t GetSeparatedRegionCount() const {
+    return separated_regions_;
+  }
+
+  uint32_t GetMergedRegionCount() const {
+    return merged_regions_;
+  }
+
  private:
-  bool Render(std::vector<OverlayLayer> &layers, NativeSurface *surface,
+  bool Render(Renderer *renderer, NativeGpuResource *resources,
+              std::vector<OverlayLayer> &layers, NativeSurface *surface,
               const std::vector<CompositionRegion> &comp_regions);
-  void SeparateLayers(const std::vector<size_t> &dedicated_layers,
+  void SeparateLayers(const std::vector<OverlayLayer> &layers,
+                      const std::vector<size_t> &dedicated_layers,
                       const std::vector<size_t> &source_layers,
                       const std::vector<HwcRect<int>> &display_frame,
                       std::vector<CompositionRegion> &comp_regions);
+  // Appends indices of all layers referenced by comp_regions to
+  // render_layers, skipping the ones already present.
+  void GetRenderLayers(const std::vector<CompositionRegion> &comp_regions,
+                       std::vector<size_t> &render_layers) const;
 
-  std::unique_ptr<Renderer> renderer_;
-  std::unique_ptr<NativeGpuResource> gpu_resource_handler_;
+  RendererService *service_ = NULL;
+  bool disable_explicit_sync_ = false;
+  // Scratch storage of SeparateLayers, kept to avoid allocations.
+  std::vector<HwcRect<int>> layer_rects_;
+  std::vector<RectSet<int, kMaxRegionLayers>> separate_regions_;
+  std::vector<RectSet<int, kMaxRegionLayers>> draw_regions_;
+  DrawRegionsScratch draw_regions_scratch_;
+  uint32_t separated_regions_ = 0;
+  uint32_t merged_regions_ = 0;
 };
 
 }  // namespace hwcomposer
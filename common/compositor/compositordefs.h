@@ -46,6 +46,8 @@ typedef EGLDisplay GpuDisplay;
 typedef struct vk_resource {
   VkImage image;
   VkImageView image_view;
+  // DRM format of the buffer image was imported from.
+  uint32_t format;
 } GpuResourceHandle;
 typedef struct vk_import {
   VkImage image;
@@ -54,6 +56,11 @@ typedef struct vk_import {
 } GpuImage;
 
 typedef VkDevice GpuDisplay;
+#elif USE_SW
+class SWImage;
+typedef const SWImage* GpuResourceHandle;
+typedef void* GpuImage;
+typedef void* GpuDisplay;
 #else
 typedef unsigned GpuResourceHandle;
 typedef void* GpuImage;
@@ -25,6 +25,10 @@
 #include "nativevkresource.h"
 #include "vkrenderer.h"
 #include "vksurface.h"
+#elif USE_SW
+#include "nativeswresource.h"
+#include "swrenderer.h"
+#include "swsurface.h"
 #endif
 
 namespace hwcomposer {
@@ -34,6 +38,8 @@ NativeSurface* CreateBackBuffer(uint32_t width, uint32_t height) {
   return new GLSurface(width, height);
 #elif USE_VK
   return new VKSurface(width, height);
+#elif USE_SW
+  return new SWSurface(width, height);
 #else
   return NULL;
 #endif
@@ -44,6 +50,8 @@ Renderer* CreateRenderer() {
   return new GLRenderer();
 #elif USE_VK
   return new VKRenderer();
+#elif USE_SW
+  return new SWRenderer();
 #else
   return NULL;
 #endif
@@ -54,6 +62,8 @@ NativeGpuResource* CreateNativeGpuResourceHandler() {
   return new NativeGLResource();
 #elif USE_VK
   return new NativeVKResource();
+#elif USE_SW
+  return new NativeSWResource();
 #else
   return NULL;
 #endif
@@ -26,7 +26,9 @@ class EGLOffScreenContext {
   EGLOffScreenContext();
   ~EGLOffScreenContext();
 
-  bool Init();
+  // Objects like programs and buffers are shared with
+  // share_context, unless it is EGL_NO_CONTEXT.
+  bool Init(EGLContext share_context = EGL_NO_CONTEXT);
 
   EGLint GetSyncFD();
 
@@ -34,6 +36,10 @@ class EGLOffScreenContext {
     return egl_display_;
   }
 
+  EGLContext GetContext() const {
+    return egl_ctx_;
+  }
+
   bool MakeCurrent();
 
   void RestoreState();
@@ -16,10 +16,14 @@
 
 #include "glprogram.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <string>
 #include <sstream>
 
 #include "hwctrace.h"
+#include "programbinarycache.h"
 #include "renderstate.h"
 
 namespace hwcomposer {
@@ -58,66 +62,138 @@ static GLint CompileAndCheckShader(GLenum type, unsigned source_count,
   return shader;
 }
 
-static std::string GenerateVertexShader(int layer_count) {
+// Size of uniform block which every implementation has to support.
+static const unsigned kMinUniformBlockSize = 16384;
+static const unsigned kMaxInstances = 64;
+// Per region vec4s in uniform block: viewport, followed by crop,
+// texture matrix and alpha/premult for each layer.
+static const unsigned kVec4sPerLayer = 3;
+
+static unsigned GetInstanceLimit(unsigned layer_count) {
+  unsigned region_size =
+      sizeof(GLfloat) * 4 * (1 + kVec4sPerLayer * layer_count);
+  unsigned instances = kMinUniformBlockSize / region_size;
+  if (instances == 0)
+    return 1;
+
+  return instances < kMaxInstances ? instances : kMaxInstances;
+}
+
+static bool NeedsAlpha(const GLProgramSignature &signature) {
+  for (uint8_t flags : signature) {
+    if (!(flags & kProgramLayerAlphaOne))
+      return true;
+  }
+
+  return false;
+}
+
+// Every instance draws one region, its parameters are taken from
+// the uniform block at gl_InstanceID.
+static std::string GenerateVertexShader(const GLProgramSignature &signature) {
+  int layer_count = signature.size();
+  bool needs_alpha = NeedsAlpha(signature);
   std::ostringstream vertex_shader_stream;
   vertex_shader_stream
       << "#version 300 es\n"
       << "#define LAYER_COUNT " << layer_count << "\n"
+      << "#define MAX_INSTANCES " << GetInstanceLimit(layer_count) << "\n"
       << "precision mediump int;\n"
-      << "uniform vec4 uViewport;\n"
-      << "uniform vec4 uLayerCrop[LAYER_COUNT];\n"
-      << "uniform mat2 uTexMatrix[LAYER_COUNT];\n"
+      << "layout(std140) uniform Regions {\n"
+      << "  vec4 uViewport[MAX_INSTANCES];\n"
+      << "  vec4 uLayerCrop[MAX_INSTANCES * LAYER_COUNT];\n"
+      << "  vec4 uTexMatrix[MAX_INSTANCES * LAYER_COUNT];\n"
+      << "  vec4 uLayerBlend[MAX_INSTANCES * LAYER_COUNT];\n"
+      << "};\n"
       << "in vec2 vPosition;\n"
       << "in vec2 vTexCoords;\n"
-      << "out vec2 fTexCoords[LAYER_COUNT];\n"
-      << "void main() {\n"
-      << "  for (int i = 0; i < LAYER_COUNT; i++) {\n"
-      << "    vec2 tempCoords = vTexCoords * uTexMatrix[i];\n"
-      << "    fTexCoords[i] =\n"
-      << "        uLayerCrop[i].xy + tempCoords * uLayerCrop[i].zw;\n"
-      << "  }\n"
-      << "  vec2 scaledPosition = uViewport.xy + vPosition * uViewport.zw;\n"
+      << "out vec2 fTexCoords[LAYER_COUNT];\n";
+  if (needs_alpha)
+    vertex_shader_stream << "flat out float fLayerAlpha[LAYER_COUNT];\n";
+
+  vertex_shader_stream << "void main() {\n"
+                       << "  int layer = gl_InstanceID * LAYER_COUNT;\n"
+                       << "  vec2 tempCoords;\n"
+                       << "  vec4 texMatrix;\n";
+  for (int i = 0; i < layer_count; ++i) {
+    if (signature[i] & kProgramLayerIdentityMatrix) {
+      vertex_shader_stream << "  tempCoords = vTexCoords;\n";
+    } else {
+      vertex_shader_stream
+          << "  texMatrix = uTexMatrix[layer + " << i << "];\n"
+          << "  tempCoords = vTexCoords * mat2(texMatrix.xy, texMatrix.zw);\n";
+    }
+
+    vertex_shader_stream << "  fTexCoords[" << i << "] = uLayerCrop[layer + "
+                         << i << "].xy +\n"
+                         << "      tempCoords * uLayerCrop[layer + " << i
+                         << "].zw;\n";
+    if (!(signature[i] & kProgramLayerAlphaOne))
+      vertex_shader_stream << "  fLayerAlpha[" << i
+                           << "] = uLayerBlend[layer + " << i << "].x;\n";
+  }
+
+  vertex_shader_stream
+      << "  vec4 viewport = uViewport[gl_InstanceID];\n"
+      << "  vec2 scaledPosition = viewport.xy + vPosition * viewport.zw;\n"
       << "  gl_Position =\n"
       << "      vec4(scaledPosition * vec2(2.0) - vec2(1.0), 0.0, 1.0);\n"
       << "}\n";
   return vertex_shader_stream.str();
 }
 
-static std::string GenerateFragmentShader(int layer_count) {
+static std::string GenerateFragmentShader(const GLProgramSignature &signature) {
+  int layer_count = signature.size();
   std::ostringstream fragment_shader_stream;
-  fragment_shader_stream << "#version 300 es\n"
-                         << "#define LAYER_COUNT " << layer_count << "\n"
-                         << "#extension GL_OES_EGL_image_external : require\n"
-                         << "precision mediump float;\n";
+  fragment_shader_stream
+      << "#version 300 es\n"
+      << "#define LAYER_COUNT " << layer_count << "\n"
+      << "#extension GL_OES_EGL_image_external_essl3 : require\n"
+      << "precision mediump float;\n";
   for (int i = 0; i < layer_count; ++i) {
     fragment_shader_stream << "uniform samplerExternalOES uLayerTexture" << i
                            << ";\n";
   }
-  fragment_shader_stream << "uniform float uLayerAlpha[LAYER_COUNT];\n"
-                         << "uniform float uLayerPremult[LAYER_COUNT];\n"
-                         << "in vec2 fTexCoords[LAYER_COUNT];\n"
-                         << "out vec4 oFragColor;\n"
+  fragment_shader_stream << "in vec2 fTexCoords[LAYER_COUNT];\n";
+  if (NeedsAlpha(signature))
+    fragment_shader_stream << "flat in float fLayerAlpha[LAYER_COUNT];\n";
+
+  fragment_shader_stream << "out vec4 oFragColor;\n"
                          << "void main() {\n"
                          << "  vec3 color = vec3(0.0, 0.0, 0.0);\n"
                          << "  float alphaCover = 1.0;\n"
                          << "  vec4 texSample;\n"
-                         << "  vec3 multRgb;\n";
+                         << "  float alpha;\n";
   for (int i = 0; i < layer_count; ++i) {
+    uint8_t flags = signature[i];
     if (i > 0)
       fragment_shader_stream << "  if (alphaCover > 0.5/255.0) {\n";
-    // clang-format off
-    fragment_shader_stream << "  texSample = texture2D(uLayerTexture" << i
-                           << ",\n"
-                           << "                        fTexCoords[" << i
-                           << "]);\n"
-                           << "  multRgb = texSample.rgb *\n"
-                           << "            max(texSample.a, uLayerPremult[" << i
-                           << "]);\n"
-                           << "  color += multRgb * uLayerAlpha[" << i
-                           << "] * alphaCover;\n"
-                           << "  alphaCover *= 1.0 - texSample.a * uLayerAlpha["
-                           << i << "];\n";
-    // clang-format on
+    fragment_shader_stream << "  texSample = texture(uLayerTexture" << i
+                           << ", fTexCoords[" << i << "]);\n";
+    // Opaque layer hides everything below it, alpha isn't applied.
+    if (flags & kProgramLayerOpaque) {
+      fragment_shader_stream << "  color += texSample.rgb * alphaCover;\n"
+                             << "  alphaCover = 0.0;\n";
+      continue;
+    }
+
+    if (flags & kProgramLayerAlphaOne)
+      fragment_shader_stream << "  alpha = texSample.a;\n";
+    else
+      fragment_shader_stream << "  alpha = texSample.a * fLayerAlpha[" << i
+                             << "];\n";
+
+    if (flags & kProgramLayerCoverage) {
+      fragment_shader_stream
+          << "  color += texSample.rgb * alpha * alphaCover;\n";
+    } else if (flags & kProgramLayerAlphaOne) {
+      fragment_shader_stream << "  color += texSample.rgb * alphaCover;\n";
+    } else {
+      fragment_shader_stream << "  color += texSample.rgb * fLayerAlpha[" << i
+                             << "] * alphaCover;\n";
+    }
+
+    fragment_shader_stream << "  alphaCover *= 1.0 - alpha;\n";
   }
   for (int i = 0; i < layer_count - 1; ++i)
     fragment_shader_stream << "  }\n";
@@ -126,16 +202,15 @@ static std::string GenerateFragmentShader(int layer_count) {
   return fragment_shader_stream.str();
 }
 
-static GLint GenerateProgram(unsigned num_textures,
+static GLint GenerateProgram(const std::string &vertex_shader_string,
+                             const std::string &fragment_shader_string,
                              std::ostringstream *shader_log) {
-  std::string vertex_shader_string = GenerateVertexShader(num_textures);
   const GLchar *vertex_shader_source = vertex_shader_string.c_str();
   GLint vertex_shader = CompileAndCheckShader(
       GL_VERTEX_SHADER, 1, &vertex_shader_source, shader_log);
   if (!vertex_shader)
     return 0;
 
-  std::string fragment_shader_string = GenerateFragmentShader(num_textures);
   const GLchar *fragment_shader_source = fragment_shader_string.c_str();
   GLint fragment_shader = CompileAndCheckShader(
       GL_FRAGMENT_SHADER, 1, &fragment_shader_source, shader_log);
@@ -156,6 +231,7 @@ static GLint GenerateProgram(unsigned num_textures,
   glAttachShader(program, fragment_shader);
   glBindAttribLocation(program, 0, "vPosition");
   glBindAttribLocation(program, 1, "vTexCoords");
+  glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(program);
   glDetachShader(program, vertex_shader);
   glDetachShader(program, fragment_shader);
@@ -179,70 +255,195 @@ static GLint GenerateProgram(unsigned num_textures,
   return program;
 }
 
-GLProgram::GLProgram()
-    : program_(0),
-      viewport_loc_(0),
-      crop_loc_(0),
-      alpha_loc_(0),
-      premult_loc_(0),
-      tex_matrix_loc_(0),
-      initialized_(false) {
+// Binaries are only valid for the driver which produced them.
+static std::string GetCacheKey(const std::string &vertex_shader_string,
+                               const std::string &fragment_shader_string) {
+  std::ostringstream key;
+  key << glGetString(GL_VENDOR) << "\n"
+      << glGetString(GL_RENDERER) << "\n"
+      << glGetString(GL_VERSION) << "\n"
+      << vertex_shader_string << fragment_shader_string;
+  return key.str();
+}
+
+// Cached binaries start with the binary format.
+static GLint LoadProgram(const ProgramBinaryCache &cache,
+                         const std::string &key) {
+  std::vector<uint8_t> binary;
+  if (!cache.Load(key, &binary) || binary.size() <= sizeof(GLenum))
+    return 0;
+
+  GLint program = glCreateProgram();
+  if (!program)
+    return 0;
+
+  GLenum format;
+  memcpy(&format, binary.data(), sizeof(format));
+  glProgramBinary(program, format, binary.data() + sizeof(format),
+                  binary.size() - sizeof(format));
+
+  // Fails when the driver has been updated, program is
+  // compiled again in that case.
+  GLint status;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (!status) {
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  return program;
+}
+
+static void StoreProgram(const ProgramBinaryCache &cache,
+                         const std::string &key, GLint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  std::vector<uint8_t> binary(sizeof(GLenum) + length);
+  GLenum format;
+  glGetProgramBinary(program, length, &length, &format,
+                     binary.data() + sizeof(format));
+  if (length <= 0)
+    return;
+
+  memcpy(binary.data(), &format, sizeof(format));
+  binary.resize(sizeof(format) + length);
+  cache.Store(key, binary);
+}
+
+GLProgram::GLProgram() : program_(0), uniform_buffer_(0) {
 }
 
 GLProgram::~GLProgram() {
+  if (uniform_buffer_ != 0)
+    glDeleteBuffers(1, &uniform_buffer_);
+
   if (program_ != 0)
     glDeleteProgram(program_);
 }
 
-bool GLProgram::Init(unsigned texture_count) {
-  std::ostringstream shader_log;
-  program_ = GenerateProgram(texture_count, &shader_log);
+uint8_t GLProgram::GetLayerFlags(const RenderState::LayerState &layer) {
+  uint8_t flags = 0;
+  if (layer.blending_ == HWCBlending::kBlendingNone)
+    flags |= kProgramLayerOpaque;
+  else if (layer.blending_ == HWCBlending::kBlendingCoverage)
+    flags |= kProgramLayerCoverage;
+
+  if (layer.alpha_ == 1.0f)
+    flags |= kProgramLayerAlphaOne;
+
+  if (std::equal(layer.texture_matrix_, layer.texture_matrix_ + 4,
+                 TransformMatrices))
+    flags |= kProgramLayerIdentityMatrix;
+
+  return flags;
+}
+
+void GLProgram::GetSignature(const RenderState &state,
+                             GLProgramSignature *signature) {
+  signature->clear();
+  for (const RenderState::LayerState &src : state.layer_state_)
+    signature->emplace_back(GetLayerFlags(src));
+}
+
+bool GLProgram::Init(const GLProgramSignature &signature,
+                     const ProgramBinaryCache *cache) {
+  std::string vertex_shader_string = GenerateVertexShader(signature);
+  std::string fragment_shader_string = GenerateFragmentShader(signature);
+  std::string key;
+  if (cache) {
+    key = GetCacheKey(vertex_shader_string, fragment_shader_string);
+    program_ = LoadProgram(*cache, key);
+  }
+
   if (!program_) {
-    ETRACE("%s", shader_log.str().c_str());
+    std::ostringstream shader_log;
+    program_ = GenerateProgram(vertex_shader_string, fragment_shader_string,
+                               &shader_log);
+    if (!program_) {
+      ETRACE("%s", shader_log.str().c_str());
+      return false;
+    }
+
+    if (cache)
+      StoreProgram(*cache, key, program_);
+  }
+
+  return InitUniforms(signature.size());
+}
+
+bool GLProgram::InitUniforms(unsigned texture_count) {
+  GLuint block_index = glGetUniformBlockIndex(program_, "Regions");
+  if (block_index == GL_INVALID_INDEX) {
+    ETRACE("Failed to find Regions uniform block.");
     return false;
   }
 
+  glUniformBlockBinding(program_, block_index, 0);
+  glGenBuffers(1, &uniform_buffer_);
+
+  // Texture units don't change, set them once.
+  glUseProgram(program_);
+  for (unsigned src_index = 0; src_index < texture_count; src_index++) {
+    std::ostringstream texture_name_formatter;
+    texture_name_formatter << "uLayerTexture" << src_index;
+    GLint tex_loc =
+        glGetUniformLocation(program_, texture_name_formatter.str().c_str());
+    glUniform1i(tex_loc, src_index);
+  }
+
+  texture_count_ = texture_count;
+  max_instances_ = GetInstanceLimit(texture_count);
+  uniform_data_.resize(4 * max_instances_ *
+                       (1 + kVec4sPerLayer * texture_count));
   return true;
 }
 
-void GLProgram::UseProgram(const RenderState &state, GLuint viewport_width,
-                           GLuint viewport_height) {
+void GLProgram::Draw(const std::vector<const RenderState *> &states,
+                     GLuint viewport_width, GLuint viewport_height) {
   glUseProgram(program_);
-  unsigned size = state.layer_state_.size();
-  if (!initialized_) {
-    viewport_loc_ = glGetUniformLocation(program_, "uViewport");
-    crop_loc_ = glGetUniformLocation(program_, "uLayerCrop");
-    alpha_loc_ = glGetUniformLocation(program_, "uLayerAlpha");
-    premult_loc_ = glGetUniformLocation(program_, "uLayerPremult");
-    tex_matrix_loc_ = glGetUniformLocation(program_, "uTexMatrix");
-    for (unsigned src_index = 0; src_index < size; src_index++) {
-      std::ostringstream texture_name_formatter;
-      texture_name_formatter << "uLayerTexture" << src_index;
-      GLuint tex_loc =
-          glGetUniformLocation(program_, texture_name_formatter.str().c_str());
-      glUniform1i(tex_loc, src_index);
-    }
+  size_t layer_vec4s = max_instances_ * texture_count_;
+  GLfloat *viewport = uniform_data_.data();
+  GLfloat *crop = viewport + 4 * max_instances_;
+  GLfloat *tex_matrix = crop + 4 * layer_vec4s;
+  GLfloat *blend = tex_matrix + 4 * layer_vec4s;
+  size_t count = states.size();
+  for (size_t instance = 0; instance < count; instance++) {
+    const RenderState &state = *states[instance];
+    GLfloat *region_viewport = viewport + 4 * instance;
+    region_viewport[0] = state.x_ / (float)viewport_width;
+    region_viewport[1] = state.y_ / (float)viewport_height;
+    region_viewport[2] = state.width_ / (float)viewport_width;
+    region_viewport[3] = state.height_ / (float)viewport_height;
 
-    initialized_ = true;
+    for (unsigned src_index = 0; src_index < texture_count_; src_index++) {
+      const RenderState::LayerState &src = state.layer_state_[src_index];
+      size_t offset = 4 * (instance * texture_count_ + src_index);
+      crop[offset] = src.crop_bounds_[0];
+      crop[offset + 1] = src.crop_bounds_[1];
+      crop[offset + 2] = src.crop_bounds_[2] - src.crop_bounds_[0];
+      crop[offset + 3] = src.crop_bounds_[3] - src.crop_bounds_[1];
+      std::copy_n(src.texture_matrix_, 4, tex_matrix + offset);
+      blend[offset] = src.alpha_;
+      blend[offset + 1] = src.premult_;
+    }
   }
 
-  glUniform4f(viewport_loc_, state.x_ / (float)viewport_width,
-              state.y_ / (float)viewport_height,
-              (state.width_) / (float)viewport_width,
-              (state.height_) / (float)viewport_height);
-
-  for (unsigned src_index = 0; src_index < size; src_index++) {
-    const RenderState::LayerState &src = state.layer_state_[src_index];
-    glUniform1f(alpha_loc_ + src_index, src.alpha_);
-    glUniform1f(premult_loc_ + src_index, src.premult_);
-    glUniform4f(crop_loc_ + src_index, src.crop_bounds_[0], src.crop_bounds_[1],
-                src.crop_bounds_[2] - src.crop_bounds_[0],
-                src.crop_bounds_[3] - src.crop_bounds_[1]);
-    glUniformMatrix2fv(tex_matrix_loc_ + src_index, 1, GL_FALSE,
-                       src.texture_matrix_);
+  // All states sample the same layers.
+  const RenderState &first = *states.front();
+  for (unsigned src_index = 0; src_index < texture_count_; src_index++) {
     glActiveTexture(GL_TEXTURE0 + src_index);
-    glBindTexture(GL_TEXTURE_EXTERNAL_OES, src.handle_);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES,
+                  first.layer_state_[src_index].handle_);
   }
+
+  glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer_);
+  glBufferData(GL_UNIFORM_BUFFER, uniform_data_.size() * sizeof(GLfloat),
+               uniform_data_.data(), GL_STREAM_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniform_buffer_);
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
 }
 
 }  // namespace hwcomposer
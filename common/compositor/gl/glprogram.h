@@ -17,13 +17,33 @@
 #ifndef COMMON_COMPOSITOR_GL_GLPROGRAM_H_
 #define COMMON_COMPOSITOR_GL_GLPROGRAM_H_
 
+#include <stdint.h>
+
 #include <vector>
 
+#include "renderstate.h"
 #include "shim.h"
 
 namespace hwcomposer {
 
-struct RenderState;
+class ProgramBinaryCache;
+
+// Per layer flags of GLProgramSignature.
+enum GLProgramLayerFlags {
+  // Blending is kBlendingNone, else kBlendingPremult
+  // unless kProgramLayerCoverage is set.
+  kProgramLayerOpaque = 1 << 0,
+  kProgramLayerCoverage = 1 << 1,
+  // Plane alpha of the layer is 1.0.
+  kProgramLayerAlphaOne = 1 << 2,
+  // Texture co-ordinates are not rotated.
+  kProgramLayerIdentityMatrix = 1 << 3,
+};
+
+// Flags of every layer sampled by a program, top most first.
+// Programs are generated per signature, code for blending and
+// transforms not used by it is left out.
+typedef std::vector<uint8_t> GLProgramSignature;
 
 class GLProgram {
  public:
@@ -33,18 +53,37 @@ class GLProgram {
 
   ~GLProgram();
 
-  bool Init(unsigned texture_count);
-  void UseProgram(const RenderState& cmd, GLuint viewport_width,
-                  GLuint viewport_height);
+  // Program binary is loaded from cache when available, newly
+  // compiled programs are added to it. cache may be NULL.
+  bool Init(const GLProgramSignature& signature,
+            const ProgramBinaryCache* cache);
+
+  // GLProgramLayerFlags of layer, its entry in the signature.
+  static uint8_t GetLayerFlags(const RenderState::LayerState& layer);
+
+  // Signature of the program needed to draw state.
+  static void GetSignature(const RenderState& state,
+                           GLProgramSignature* signature);
+
+  // Maximum number of RenderStates a single Draw can take.
+  unsigned GetMaxInstances() const {
+    return max_instances_;
+  }
+
+  // Draws all states with one instanced draw call. States
+  // need to sample the same textures, in the same order.
+  void Draw(const std::vector<const RenderState*>& states,
+            GLuint viewport_width, GLuint viewport_height);
 
  private:
+  bool InitUniforms(unsigned texture_count);
+
   GLint program_;
-  GLint viewport_loc_;
-  GLint crop_loc_;
-  GLint alpha_loc_;
-  GLint premult_loc_;
-  GLint tex_matrix_loc_;
-  bool initialized_;
+  GLuint uniform_buffer_;
+  unsigned texture_count_ = 0;
+  unsigned max_instances_ = 0;
+  // Contents of the Regions uniform block.
+  std::vector<GLfloat> uniform_data_;
 };
 
 }  // namespace hwcomposer
@@ -18,6 +18,7 @@
 
 #include "glprogram.h"
 #include "hwctrace.h"
+#include "hwcutils.h"
 #include "nativesurface.h"
 #include "renderstate.h"
 #include "scopedrendererstate.h"
@@ -25,15 +26,38 @@
 
 namespace hwcomposer {
 
+// Programs compiled ahead of the first frame: a single opaque or
+// translucent layer, and translucent layers on top of an opaque one.
+static const uint8_t kOpaqueLayer = kProgramLayerOpaque |
+                                    kProgramLayerAlphaOne |
+                                    kProgramLayerIdentityMatrix;
+static const uint8_t kPremultLayer =
+    kProgramLayerAlphaOne | kProgramLayerIdentityMatrix;
+static const GLProgramSignature kCommonSignatures[] = {
+    {kOpaqueLayer},
+    {kPremultLayer},
+    {kPremultLayer, kOpaqueLayer},
+    {kPremultLayer, kPremultLayer},
+    {kPremultLayer, kPremultLayer, kOpaqueLayer},
+    {kPremultLayer, kPremultLayer, kPremultLayer, kOpaqueLayer},
+};
+
 GLRenderer::~GLRenderer() {
+  precompile_exit_ = true;
+  if (precompile_thread_.joinable())
+    precompile_thread_.join();
+
   if (vertex_array_)
     glDeleteVertexArraysOES(1, &vertex_array_);
 }
 
 bool GLRenderer::Init() {
+  // Quad covering the region, drawn as triangle strip.
   // clang-format off
-  const GLfloat verts[] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 2.0f,
-                           0.0f, 2.0f, 2.0f, 0.0f, 2.0f, 0.0f};
+  const GLfloat verts[] = {0.0f, 0.0f, 0.0f, 0.0f,
+                           0.0f, 1.0f, 0.0f, 1.0f,
+                           1.0f, 0.0f, 1.0f, 0.0f,
+                           1.0f, 1.0f, 1.0f, 1.0f};
   // clang-format on
   if (!context_.Init()) {
     ETRACE("Failed to initialize EGLContext.");
@@ -59,11 +83,6 @@ bool GLRenderer::Init() {
   glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
   glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
 
-  std::unique_ptr<GLProgram> program(new GLProgram());
-  if (program->Init(1)) {
-    programs_.emplace_back(std::move(program));
-  }
-
   glEnableVertexAttribArray(0);
   glEnableVertexAttribArray(1);
 
@@ -78,6 +97,47 @@ bool GLRenderer::Init() {
   return true;
 }
 
+void GLRenderer::PrecompilePrograms() {
+  if (precompile_thread_.joinable())
+    return;
+
+  precompile_thread_ = std::thread(&GLRenderer::PrecompileRoutine, this);
+}
+
+void GLRenderer::PrecompileRoutine() {
+  EGLOffScreenContext context;
+  if (!context.Init(context_.GetContext())) {
+    ETRACE("Failed to initialize EGLContext for precompiling programs.");
+    return;
+  }
+
+  for (const GLProgramSignature &signature : kCommonSignatures) {
+    if (precompile_exit_)
+      break;
+
+    std::unique_ptr<GLProgram> program(new GLProgram());
+    if (!program->Init(signature, &program_cache_))
+      continue;
+
+    // Program has to be complete before context_ can use it.
+    glFinish();
+    ScopedSpinLock lock(precompile_lock_);
+    precompiled_.emplace_back(signature, std::move(program));
+  }
+
+  eglMakeCurrent(context.GetDisplay(), EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 EGL_NO_CONTEXT);
+}
+
+void GLRenderer::AdoptPrecompiledPrograms() {
+  ScopedSpinLock lock(precompile_lock_);
+  for (auto &precompiled : precompiled_)
+    programs_.emplace(std::move(precompiled.first),
+                      std::move(precompiled.second));
+
+  precompiled_.clear();
+}
+
 bool GLRenderer::Draw(const std::vector<RenderState> &render_states,
                       NativeSurface *surface) {
   GLuint frame_width = surface->GetWidth();
@@ -85,31 +145,84 @@ bool GLRenderer::Draw(const std::vector<RenderState> &render_states,
   if (!surface->MakeCurrent())
     return false;
 
+  // Waits only for the display which showed this surface, the
+  // fence is tied to the target rather than to the renderer.
+  int kms_fence = surface->ReleaseKMSFence();
+  if (kms_fence > 0)
+    InsertFence(kms_fence);
+
   glViewport(0, 0, frame_width, frame_height);
-  glClear(GL_COLOR_BUFFER_BIT);
   glEnable(GL_SCISSOR_TEST);
-
+  // Content outside of the damaged area is still valid and
+  // regions drawn below overwrite what they cover, so only
+  // the remaining part of damaged area needs to be cleared.
+  clear_rects_.assign(1, surface->GetSurfaceDamage());
   for (const RenderState &state : render_states) {
-    unsigned size = state.layer_state_.size();
-    if (size == 0)
+    if (state.layer_state_.empty() || clear_rects_.empty())
       break;
 
-    GLProgram *program = GetProgram(size);
-    if (!program)
-      continue;
+    HwcRect<int> region(state.x_, state.y_, state.x_ + state.width_,
+                        state.y_ + state.height_);
+    SubtractRect(region, clear_rects_);
+  }
 
-    program->UseProgram(state, frame_width, frame_height);
+  for (const HwcRect<int> &rect : clear_rects_) {
+    glScissor(rect.left, rect.top, rect.right - rect.left,
+              rect.bottom - rect.top);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
 
-    glScissor(state.x_, state.y_, state.width_, state.height_);
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+  glDisable(GL_SCISSOR_TEST);
 
-    for (unsigned src_index = 0; src_index < size; src_index++) {
-      glActiveTexture(GL_TEXTURE0 + src_index);
-      glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+  AdoptPrecompiledPrograms();
+  // Regions which sample the same layers with the same per-layer
+  // program flags are drawn together with one instanced draw call,
+  // so they share the program signature. Copies get the variant for
+  // a single opaque layer which doesn't blend. Regions don't overlap,
+  // so all copies are drawn first, one after the other with that
+  // variant, and the blended regions after them.
+  size_t num_states = render_states.size();
+  batched_.assign(num_states, false);
+  unsigned max_size = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    bool copies = pass == 0;
+    for (size_t i = 0; i < num_states; i++) {
+      const RenderState &state = render_states[i];
+      unsigned size = state.layer_state_.size();
+      if (size == 0)
+        break;
+
+      if (batched_[i] || state.copy_ != copies)
+        continue;
+
+      GLProgram *program = GetProgram(state);
+      if (!program)
+        continue;
+
+      batch_.clear();
+      for (size_t j = i; j < num_states; j++) {
+        const RenderState &other = render_states[j];
+        if (batched_[j] || other.copy_ != copies ||
+            !SampleSameLayers(state, other))
+          continue;
+
+        batch_.emplace_back(&other);
+        batched_[j] = true;
+        if (batch_.size() == program->GetMaxInstances())
+          break;
+      }
+
+      program->Draw(batch_, frame_width, frame_height);
+      if (size > max_size)
+        max_size = size;
     }
   }
 
-  glDisable(GL_SCISSOR_TEST);
+  for (unsigned src_index = 0; src_index < max_size; src_index++) {
+    glActiveTexture(GL_TEXTURE0 + src_index);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+  }
+
   if (!disable_explicit_sync_)
     surface->SetNativeFence(context_.GetSyncFD());
 
@@ -143,23 +256,41 @@ void GLRenderer::SetExplicitSyncSupport(bool disable_explicit_sync) {
   disable_explicit_sync_ = disable_explicit_sync;
 }
 
-GLProgram *GLRenderer::GetProgram(unsigned texture_count) {
-  if (programs_.size() >= texture_count) {
-    GLProgram *program = programs_[texture_count - 1].get();
-    if (program != 0)
-      return program;
+bool GLRenderer::SampleSameLayers(const RenderState &lhs,
+                                  const RenderState &rhs) const {
+  size_t size = lhs.layer_state_.size();
+  if (size != rhs.layer_state_.size())
+    return false;
+
+  for (size_t i = 0; i < size; i++) {
+    const RenderState::LayerState &lhs_layer = lhs.layer_state_[i];
+    const RenderState::LayerState &rhs_layer = rhs.layer_state_[i];
+    if (lhs_layer.handle_ != rhs_layer.handle_)
+      return false;
+
+    // The same buffer can be shown by layers with different alpha,
+    // blending or transform, which need another program variant.
+    if (GLProgram::GetLayerFlags(lhs_layer) !=
+        GLProgram::GetLayerFlags(rhs_layer))
+      return false;
   }
 
-  std::unique_ptr<GLProgram> program(new GLProgram());
-  if (program->Init(texture_count)) {
-    if (programs_.size() < texture_count)
-      programs_.resize(texture_count);
+  return true;
+}
 
-    programs_[texture_count - 1] = std::move(program);
-    return programs_[texture_count - 1].get();
-  }
+GLProgram *GLRenderer::GetProgram(const RenderState &state) {
+  GLProgram::GetSignature(state, &signature_);
+  auto it = programs_.find(signature_);
+  if (it != programs_.end())
+    return it->second.get();
+
+  std::unique_ptr<GLProgram> program(new GLProgram());
+  if (!program->Init(signature_, &program_cache_))
+    return 0;
 
-  return 0;
+  GLProgram *result = program.get();
+  programs_.emplace(signature_, std::move(program));
+  return result;
 }
 
 }  // namespace hwcomposer
@@ -17,13 +17,21 @@
 #ifndef COMMON_COMPOSITOR_GL_GLRENDERER_H_
 #define COMMON_COMPOSITOR_GL_GLRENDERER_H_
 
+#include <atomic>
+#include <map>
 #include <memory>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include <hwcdefs.h>
+#include <spinlock.h>
+
 #include "renderer.h"
 
 #include "egloffscreencontext.h"
 #include "glprogram.h"
+#include "programbinarycache.h"
 
 namespace hwcomposer {
 
@@ -33,6 +41,9 @@ class GLRenderer : public Renderer {
   ~GLRenderer();
 
   bool Init() override;
+  // Compiles the programs on a separate thread, with a context
+  // sharing objects with the one used by Draw.
+  void PrecompilePrograms() override;
   bool Draw(const std::vector<RenderState> &commands,
             NativeSurface *surface) override;
 
@@ -45,11 +56,30 @@ class GLRenderer : public Renderer {
   void SetExplicitSyncSupport(bool disable_explicit_sync) override;
 
  private:
-  GLProgram *GetProgram(unsigned texture_count);
+  void PrecompileRoutine();
+  // Moves the programs compiled so far by PrecompileRoutine
+  // to programs_.
+  void AdoptPrecompiledPrograms();
+  GLProgram *GetProgram(const RenderState &state);
+  bool SampleSameLayers(const RenderState &lhs, const RenderState &rhs) const;
 
   EGLOffScreenContext context_;
 
-  std::vector<std::unique_ptr<GLProgram>> programs_;
+  std::map<GLProgramSignature, std::unique_ptr<GLProgram>> programs_;
+  // Signature looked up by GetProgram, kept to avoid reallocation.
+  GLProgramSignature signature_;
+  ProgramBinaryCache program_cache_;
+  std::thread precompile_thread_;
+  std::atomic<bool> precompile_exit_{false};
+  SpinLock precompile_lock_;
+  std::vector<std::pair<GLProgramSignature, std::unique_ptr<GLProgram>>>
+      precompiled_;
+  // Parts of the surface which need to be cleared in Draw.
+  std::vector<HwcRect<int>> clear_rects_;
+  // States drawn by the current instanced draw call and
+  // states which were already drawn in Draw.
+  std::vector<const RenderState *> batch_;
+  std::vector<bool> batched_;
   GLuint vertex_array_ = 0;
   bool disable_explicit_sync_ = false;
 };
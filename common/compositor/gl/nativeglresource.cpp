@@ -17,22 +17,43 @@
 #include "nativeglresource.h"
 
 #include "hwctrace.h"
+#include "hwcutils.h"
 #include "overlaylayer.h"
 #include "shim.h"
 
 namespace hwcomposer {
 
+// Time a texture can stay unused before we release it. The cache is
+// shared by all displays and PrepareResources is called for every
+// composition, including squashing, so entries are aged by time rather
+// than by number of calls.
+static const int64_t kMaxUnusedTimeNs = 500000000;
+// Upper bound on number of textures we keep around.
+static const size_t kMaxCachedTextures = 32;
+
 bool NativeGLResource::PrepareResources(
-    const std::vector<OverlayLayer>& layers) {
+    const std::vector<OverlayLayer>& layers,
+    const std::vector<size_t>& source_layers) {
   Reset();
-  std::vector<GLuint>().swap(layer_textures_);
+  int64_t now = GetMonotonicTimeNs();
+  layer_textures_.resize(layers.size(), 0);
   EGLDisplay egl_display = eglGetCurrentDisplay();
-  for (auto& layer : layers) {
+  for (size_t layer_index : source_layers) {
+    OverlayBuffer* buffer = layers.at(layer_index).GetBuffer();
+    uint64_t key = buffer->GetId();
+    CachedTexture& cached = texture_cache_[key];
+    cached.last_used_ns_ = now;
+    if (cached.texture_) {
+      layer_textures_.at(layer_index) = cached.texture_;
+      continue;
+    }
+
     // Create EGLImage.
-    EGLImageKHR egl_image = layer.GetBuffer()->ImportImage(egl_display);
+    EGLImageKHR egl_image = buffer->ImportImage(egl_display);
 
     if (egl_image == EGL_NO_IMAGE_KHR) {
       ETRACE("Failed to make import image.");
+      texture_cache_.erase(key);
       return false;
     }
 
@@ -44,29 +65,77 @@ bool NativeGLResource::PrepareResources(
     glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
-    layer_textures_.emplace_back(texture);
+    cached.texture_ = texture;
+    layer_textures_.at(layer_index) = texture;
     eglDestroyImageKHR(egl_display, egl_image);
   }
 
+  EvictUnusedTextures(now);
+
   return true;
 }
 
 NativeGLResource::~NativeGLResource() {
-  Reset();
+  ReleaseGPUResources();
 }
 
 void NativeGLResource::Reset() {
-  GLuint texture_id = 0;
-  size_t size = layer_textures_.size();
-  for (size_t i = 0; i < size; i++) {
-    texture_id = layer_textures_.at(i);
-    glDeleteTextures(1, &texture_id);
+  std::vector<GLuint>().swap(layer_textures_);
+}
+
+void NativeGLResource::EvictUnusedTextures(int64_t now) {
+  // Drop textures of buffers which have not been composited for a while,
+  // e.g. buffers now scanned out by a plane. Textures of destroyed
+  // buffers are released by ReleaseBufferResources.
+  for (auto it = texture_cache_.begin(); it != texture_cache_.end();) {
+    if (now - it->second.last_used_ns_ > kMaxUnusedTimeNs) {
+      glDeleteTextures(1, &it->second.texture_);
+      it = texture_cache_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Evict least recently used textures in case we are still over budget.
+  while (texture_cache_.size() > kMaxCachedTextures) {
+    auto lru = texture_cache_.begin();
+    for (auto it = texture_cache_.begin(); it != texture_cache_.end(); ++it) {
+      if (it->second.last_used_ns_ < lru->second.last_used_ns_)
+        lru = it;
+    }
+
+    if (lru->second.last_used_ns_ == now)
+      break;
+
+    glDeleteTextures(1, &lru->second.texture_);
+    texture_cache_.erase(lru);
+  }
+}
+
+void NativeGLResource::ReleaseBufferResources(
+    const std::vector<uint64_t>& buffer_ids) {
+  for (uint64_t buffer_id : buffer_ids) {
+    auto it = texture_cache_.find(buffer_id);
+    if (it == texture_cache_.end())
+      continue;
+
+    glDeleteTextures(1, &it->second.texture_);
+    texture_cache_.erase(it);
+  }
+}
+
+void NativeGLResource::ReleaseGPUResources() {
+  Reset();
+  for (auto& cached : texture_cache_) {
+    glDeleteTextures(1, &cached.second.texture_);
   }
+
+  texture_cache_.clear();
 }
 
 GpuResourceHandle NativeGLResource::GetResourceHandle(
     uint32_t layer_index) const {
-  if (layer_textures_.size() < layer_index)
+  if (layer_textures_.size() <= layer_index)
     return 0;
 
   return layer_textures_.at(layer_index);
@@ -17,6 +17,9 @@
 #ifndef COMMON_COMPOSITOR_GL_NATIVEGLRESOURCE_H_
 #define COMMON_COMPOSITOR_GL_NATIVEGLRESOURCE_H_
 
+#include <stdint.h>
+
+#include <map>
 #include <vector>
 
 #include "nativegpuresource.h"
@@ -31,12 +34,24 @@ class NativeGLResource : public NativeGpuResource {
   NativeGLResource() = default;
   ~NativeGLResource() override;
 
-  bool PrepareResources(const std::vector<OverlayLayer>& layers) override;
+  bool PrepareResources(const std::vector<OverlayLayer>& layers,
+                        const std::vector<size_t>& source_layers) override;
   GpuResourceHandle GetResourceHandle(uint32_t layer_index) const override;
+  void ReleaseGPUResources() override;
+  void ReleaseBufferResources(const std::vector<uint64_t>& buffer_ids) override;
 
  private:
+  struct CachedTexture {
+    GLuint texture_ = 0;
+    int64_t last_used_ns_ = 0;
+  };
+
   void Reset();
+  void EvictUnusedTextures(int64_t now);
+
   std::vector<GLuint> layer_textures_;
+  // Indexed by OverlayBuffer id.
+  std::map<uint64_t, CachedTexture> texture_cache_;
 };
 
 }  // namespace hwcomposer
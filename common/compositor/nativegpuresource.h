@@ -17,6 +17,9 @@
 #ifndef COMMON_COMPOSITOR_NATIVEGPURESOURCE_H_
 #define COMMON_COMPOSITOR_NATIVEGPURESOURCE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <vector>
 
 #include "compositordefs.h"
@@ -38,8 +41,22 @@ class NativeGpuResource {
 
   NativeGpuResource& operator=(NativeGpuResource&& rhs) = delete;
 
-  virtual bool PrepareResources(const std::vector<OverlayLayer>& layers) = 0;
+  // Ensures GPU resources are available for all layers in
+  // source_layers. source_layers are indices into layers.
+  virtual bool PrepareResources(const std::vector<OverlayLayer>& layers,
+                                const std::vector<size_t>& source_layers) = 0;
   virtual GpuResourceHandle GetResourceHandle(uint32_t layer_index) const = 0;
+
+  // Releases all cached resources. Needs to be called with the
+  // context used for PrepareResources being current.
+  virtual void ReleaseGPUResources() = 0;
+
+  // Releases resources cached for buffers which have been destroyed,
+  // buffer_ids are ids of OverlayBuffer. Needs to be called with the
+  // context used for PrepareResources being current.
+  virtual void ReleaseBufferResources(
+      const std::vector<uint64_t>& /*buffer_ids*/) {
+  }
 };
 
 }  // namespace hwcomposer
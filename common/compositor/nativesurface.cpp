@@ -18,6 +18,7 @@
 
 #include "displayplane.h"
 #include "hwctrace.h"
+#include "hwcutils.h"
 #include "nativebufferhandler.h"
 #include "overlaybuffermanager.h"
 
@@ -29,13 +30,14 @@ NativeSurface::NativeSurface(uint32_t width, uint32_t height)
       width_(width),
       height_(height),
       in_use_(false),
-      framebuffer_format_(0) {
+      framebuffer_format_(0),
+      surface_damage_(0, 0, width, height) {
 }
 
 NativeSurface::~NativeSurface() {
   // Ensure we close any framebuffers before
-  // releasing buffer.
-  buffer_.release();
+  // destroying the native buffer.
+  buffer_.reset();
 
   if (buffer_handler_ && native_handle_) {
     buffer_handler_->DestroyBuffer(native_handle_);
@@ -68,19 +70,28 @@ void NativeSurface::SetNativeFence(int fd) {
   fd_.Reset(fd);
 }
 
+void NativeSurface::SetKMSFence(int fd) {
+  kms_fence_.Reset(fd);
+}
+
 void NativeSurface::SetInUse(bool inuse) {
   in_use_ = inuse;
 }
 
-void NativeSurface::SetPlaneTarget(DisplayPlaneState &plane, uint32_t gpu_fd) {
+void NativeSurface::SetPlaneTarget(DisplayPlaneState &plane, KMSBackend *kms) {
   uint32_t format =
       plane.plane()->GetFormatForFrameBuffer(layer_.GetBuffer()->GetFormat());
 
   const HwcRect<int> &display_rect = plane.GetDisplayFrame();
-  layer_.SetSourceCrop(HwcRect<float>(display_rect));
-  layer_.SetDisplayFrame(HwcRect<int>(display_rect));
   width_ = display_rect.right - display_rect.left;
   height_ = display_rect.bottom - display_rect.top;
+  // Content of the surface is for a different part of the
+  // display, redraw everything.
+  if (!(layer_.GetDisplayFrame() == display_rect))
+    surface_damage_ = HwcRect<int>(0, 0, width_, height_);
+
+  layer_.SetSourceCrop(HwcRect<float>(0, 0, width_, height_));
+  layer_.SetDisplayFrame(HwcRect<int>(display_rect));
   plane.SetOverlayLayer(&layer_);
   SetInUse(true);
 
@@ -89,7 +100,31 @@ void NativeSurface::SetPlaneTarget(DisplayPlaneState &plane, uint32_t gpu_fd) {
 
   framebuffer_format_ = format;
   layer_.GetBuffer()->SetRecommendedFormat(framebuffer_format_);
-  layer_.GetBuffer()->CreateFrameBuffer(gpu_fd);
+  layer_.GetBuffer()->CreateFrameBuffer(kms);
+}
+
+void NativeSurface::SetLayerTarget(const HwcRect<int> &display_rect) {
+  width_ = display_rect.right - display_rect.left;
+  height_ = display_rect.bottom - display_rect.top;
+  surface_damage_ = HwcRect<int>(0, 0, width_, height_);
+  layer_.SetSourceCrop(HwcRect<float>(0, 0, width_, height_));
+  layer_.SetDisplayFrame(display_rect);
+}
+
+void NativeSurface::UpdateSurfaceDamage(const HwcRect<int> &surface_damage) {
+  const HwcRect<int> &display_rect = layer_.GetDisplayFrame();
+  HwcRect<int> damage = IntersectRect(surface_damage, display_rect);
+  if (IsEmptyRect(damage))
+    return;
+
+  damage = HwcRect<int>(
+      damage.left - display_rect.left, damage.top - display_rect.top,
+      damage.right - display_rect.left, damage.bottom - display_rect.top);
+  surface_damage_ = UnionRect(surface_damage_, damage);
+}
+
+void NativeSurface::ResetSurfaceDamage() {
+  surface_damage_ = HwcRect<int>(0, 0, 0, 0);
 }
 
 void NativeSurface::InitializeLayer(OverlayBufferManager *buffer_manager,
@@ -97,10 +132,12 @@ void NativeSurface::InitializeLayer(OverlayBufferManager *buffer_manager,
   buffer_.reset(new OverlayBuffer());
   buffer_->InitializeFromNativeHandle(native_handle,
                                       buffer_manager->GetNativeBufferHandler());
-  ImportedBuffer* imported_buffer_ = new ImportedBuffer(buffer_.get(), buffer_manager, -1);
+  ImportedBuffer* imported_buffer_ =
+      new ImportedBuffer(buffer_.get(), buffer_manager);
   imported_buffer_->owned_buffer_ = false;
   width_ = buffer_->GetWidth();
   height_ = buffer_->GetHeight();
+  surface_damage_ = HwcRect<int>(0, 0, width_, height_);
   layer_.SetBlending(HWCBlending::kBlendingPremult);
   layer_.SetTransform(0);
   layer_.SetBuffer(imported_buffer_);
@@ -62,13 +62,49 @@ class NativeSurface {
     return fd_.Release();
   }
 
+  // Out fence of the commit which took this surface off screen.
+  // Renderers wait for it before writing to the surface again.
+  void SetKMSFence(int fd);
+  int ReleaseKMSFence() {
+    return kms_fence_.Release();
+  }
+
   void SetInUse(bool inuse);
 
   bool InUse() const {
     return in_use_;
   }
 
-  void SetPlaneTarget(DisplayPlaneState& plane, uint32_t gpu_fd);
+  // Surface content starts at the top left corner of its buffer, which
+  // is shown at the display frame of plane. Buffer needs to be at least
+  // as big as the display frame.
+  void SetPlaneTarget(DisplayPlaneState& plane, KMSBackend* kms);
+
+  // Surface content is shown by its layer at display_rect, together
+  // with other layers, instead of being the target of a plane. All of
+  // it needs to be drawn again.
+  void SetLayerTarget(const HwcRect<int>& display_rect);
+
+  // Format of the framebuffer created for this surface, 0 if
+  // it has not been shown on a plane yet.
+  uint32_t GetFramebufferFormat() const {
+    return framebuffer_format_;
+  }
+
+  // Adds surface_damage, in display coordinates, to the area which is
+  // stale in this surface. As surfaces are used in round robin, this
+  // accumulates damage of all frames since the surface was
+  // last rendered to, i.e. over its buffer age.
+  void UpdateSurfaceDamage(const HwcRect<int>& surface_damage);
+
+  // Area which needs to be composited again before this surface can
+  // be scanned out. Unlike display frame, it's in surface coordinates.
+  const HwcRect<int>& GetSurfaceDamage() const {
+    return surface_damage_;
+  }
+
+  // Called once surface is fully up to date.
+  void ResetSurfaceDamage();
 
  protected:
   OverlayLayer layer_;
@@ -83,6 +119,8 @@ class NativeSurface {
   bool in_use_;
   uint32_t framebuffer_format_;
   NativeFence fd_;
+  NativeFence kms_fence_;
+  HwcRect<int> surface_damage_;
   std::unique_ptr<OverlayBuffer> buffer_;
 };
 
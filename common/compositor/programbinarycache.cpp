@@ -0,0 +1,149 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "programbinarycache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hwctrace.h"
+
+namespace hwcomposer {
+
+// 64 bit FNV-1a.
+static uint64_t HashKey(const std::string &key) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+static bool ReadAll(int fd, void *data, size_t size) {
+  uint8_t *ptr = static_cast<uint8_t *>(data);
+  while (size) {
+    ssize_t ret = read(fd, ptr, size);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+
+    ptr += ret;
+    size -= ret;
+  }
+
+  return true;
+}
+
+static bool WriteAll(int fd, const void *data, size_t size) {
+  const uint8_t *ptr = static_cast<const uint8_t *>(data);
+  while (size) {
+    ssize_t ret = write(fd, ptr, size);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+
+    ptr += ret;
+    size -= ret;
+  }
+
+  return true;
+}
+
+ProgramBinaryCache::ProgramBinaryCache()
+    : directory_("shadercache", "/data/hwc/shadercache", false) {
+}
+
+ProgramBinaryCache::~ProgramBinaryCache() {
+}
+
+std::string ProgramBinaryCache::GetPath(const std::string &key) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.bin",
+           static_cast<unsigned long long>(HashKey(key)));
+  return std::string(directory_.getString()) + name;
+}
+
+// Every file starts with the size of the key and the key itself,
+// so that a hash collision can't hand out the wrong binary.
+bool ProgramBinaryCache::Load(const std::string &key,
+                              std::vector<uint8_t> *binary) const {
+  if (!*directory_.getString())
+    return false;
+
+  int fd = open(GetPath(key).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  uint32_t key_size = 0;
+  std::string stored_key;
+  bool ret = !fstat(fd, &st) && ReadAll(fd, &key_size, sizeof(key_size)) &&
+             key_size == key.size() &&
+             st.st_size > static_cast<off_t>(sizeof(key_size) + key_size);
+  if (ret) {
+    stored_key.resize(key_size);
+    ret = ReadAll(fd, &stored_key[0], key_size) && stored_key == key;
+  }
+
+  if (ret) {
+    binary->resize(st.st_size - sizeof(key_size) - key_size);
+    ret = ReadAll(fd, binary->data(), binary->size());
+  }
+
+  close(fd);
+  return ret;
+}
+
+bool ProgramBinaryCache::Store(const std::string &key,
+                               const std::vector<uint8_t> &binary) const {
+  if (!*directory_.getString() || binary.empty())
+    return false;
+
+  // Written to a temporary file first, readers either see the
+  // complete binary or none at all. Its name is unique, so that
+  // threads or processes storing the same program don't write
+  // into each other's file.
+  std::string path = GetPath(key);
+  std::string temp_path = path + ".XXXXXX";
+  int fd = mkostemp(&temp_path[0], O_CLOEXEC);
+  if (fd < 0) {
+    ITRACE("Failed to create %s %s", temp_path.c_str(), PRINTERROR());
+    return false;
+  }
+
+  uint32_t key_size = key.size();
+  bool ret = WriteAll(fd, &key_size, sizeof(key_size)) &&
+             WriteAll(fd, key.data(), key.size()) &&
+             WriteAll(fd, binary.data(), binary.size());
+  close(fd);
+  if (!ret || rename(temp_path.c_str(), path.c_str())) {
+    ETRACE("Failed to store program binary %s", PRINTERROR());
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,56 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_COMPOSITOR_PROGRAMBINARYCACHE_H_
+#define COMMON_COMPOSITOR_PROGRAMBINARYCACHE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "option.h"
+
+namespace hwcomposer {
+
+// Keeps program binaries produced by the GPU driver on disk, so
+// shaders don't need to be compiled again after a restart. Every
+// binary is stored in its own file, named after the hash of its key.
+// The key has to identify the driver as well as the shader sources,
+// binaries of another driver version are not usable.
+class ProgramBinaryCache {
+ public:
+  // Directory is taken from the intel.hwc.shadercache property,
+  // caching is disabled if it is empty.
+  ProgramBinaryCache();
+  ~ProgramBinaryCache();
+
+  ProgramBinaryCache(const ProgramBinaryCache&) = delete;
+  ProgramBinaryCache& operator=(const ProgramBinaryCache&) = delete;
+
+  // Returns false if there is no binary stored for key.
+  bool Load(const std::string& key, std::vector<uint8_t>* binary) const;
+
+  bool Store(const std::string& key, const std::vector<uint8_t>& binary) const;
+
+ private:
+  std::string GetPath(const std::string& key) const;
+
+  Option directory_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_COMPOSITOR_PROGRAMBINARYCACHE_H_
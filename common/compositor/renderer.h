@@ -35,6 +35,12 @@ class Renderer {
   Renderer& operator=(const Renderer& rhs) = delete;
 
   virtual bool Init() = 0;
+
+  // Prepares the programs commonly needed by Draw ahead of the first
+  // frame, so that they don't need to be compiled while drawing.
+  // Called after Init.
+  virtual void PrecompilePrograms() = 0;
+
   virtual bool Draw(const std::vector<RenderState>& commands,
                     NativeSurface* surface) = 0;
 
@@ -0,0 +1,105 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "rendererservice.h"
+
+#include "factory.h"
+#include "hwctrace.h"
+#include "nativegpuresource.h"
+#include "renderer.h"
+#include "scopedrendererstate.h"
+
+namespace hwcomposer {
+
+// Upper bound on ids of destroyed buffers kept till the next job.
+// Resources of buffers beyond it are left for the cache to evict.
+static const size_t kMaxReleasedBuffers = 256;
+
+RendererService::RendererService() {
+}
+
+RendererService::~RendererService() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!renderer_)
+    return;
+
+  {
+    // Cached GPU resources belong to the renderer context, release them
+    // while it's current and before it goes away.
+    ScopedRendererState state(renderer_.get());
+    gpu_resource_handler_.reset(nullptr);
+  }
+
+  renderer_.reset(nullptr);
+}
+
+bool RendererService::Init() {
+  std::lock_guard<std::mutex> lock(lock_);
+  return EnsureRenderer();
+}
+
+void RendererService::OnBufferDestroyed(uint64_t buffer_id) {
+  std::lock_guard<std::mutex> lock(released_lock_);
+  if (released_buffers_.size() < kMaxReleasedBuffers)
+    released_buffers_.emplace_back(buffer_id);
+}
+
+bool RendererService::EnsureRenderer() {
+  if (renderer_)
+    return true;
+
+  std::unique_ptr<Renderer> renderer(CreateRenderer());
+  if (!renderer->Init()) {
+    ETRACE("Failed to initialize renderer %s", PRINTERROR());
+    return false;
+  }
+
+  // Programs get compiled while the displays are being configured
+  // rather than on the first frame.
+  renderer->PrecompilePrograms();
+  renderer_ = std::move(renderer);
+  gpu_resource_handler_.reset(CreateNativeGpuResourceHandler());
+  return true;
+}
+
+ScopedRenderJob::ScopedRenderJob(RendererService *service)
+    : lock_(service->lock_) {
+  if (!service->EnsureRenderer())
+    return;
+
+  if (!service->renderer_->MakeCurrent()) {
+    ETRACE("Failed to make renderer context current.");
+    return;
+  }
+
+  renderer_ = service->renderer_.get();
+  resources_ = service->gpu_resource_handler_.get();
+  std::vector<uint64_t> released_buffers;
+  {
+    std::lock_guard<std::mutex> lock(service->released_lock_);
+    released_buffers.swap(service->released_buffers_);
+  }
+
+  if (!released_buffers.empty())
+    resources_->ReleaseBufferResources(released_buffers);
+}
+
+ScopedRenderJob::~ScopedRenderJob() {
+  if (renderer_)
+    renderer_->RestoreState();
+}
+
+}  // namespace hwcomposer
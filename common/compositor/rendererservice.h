@@ -0,0 +1,97 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_COMPOSITOR_RENDERERSERVICE_H_
+#define COMMON_COMPOSITOR_RENDERERSERVICE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "overlaybuffermanager.h"
+
+namespace hwcomposer {
+
+class NativeGpuResource;
+class Renderer;
+
+// Device wide renderer shared by the compositors of all displays. There
+// is one context, one program cache and one cache of imported buffers,
+// so buffers shared between displays are imported only once. Work is
+// submitted through ScopedRenderJob, which serializes displays.
+// Resources cached for a buffer are released with the next job after
+// the buffer has been destroyed.
+class RendererService : public OverlayBufferObserver {
+ public:
+  RendererService();
+  ~RendererService() override;
+
+  RendererService(const RendererService &) = delete;
+  RendererService &operator=(const RendererService &) = delete;
+
+  // Creates the renderer and starts compiling the common programs, in
+  // case it's not done yet. Returns false if renderer can't be created.
+  bool Init();
+
+  void OnBufferDestroyed(uint64_t buffer_id) override;
+
+ private:
+  friend class ScopedRenderJob;
+
+  // Expects lock_ to be held.
+  bool EnsureRenderer();
+
+  std::mutex lock_;
+  std::unique_ptr<Renderer> renderer_;
+  std::unique_ptr<NativeGpuResource> gpu_resource_handler_;
+  // Ids of buffers destroyed since the last job. Guarded by
+  // released_lock_, as buffers are destroyed while jobs run.
+  std::mutex released_lock_;
+  std::vector<uint64_t> released_buffers_;
+};
+
+// Gives exclusive access to the shared renderer, with its context
+// current, for the lifetime of the object.
+class ScopedRenderJob {
+ public:
+  explicit ScopedRenderJob(RendererService *service);
+  ~ScopedRenderJob();
+
+  ScopedRenderJob(const ScopedRenderJob &) = delete;
+  ScopedRenderJob &operator=(const ScopedRenderJob &) = delete;
+
+  bool IsValid() const {
+    return renderer_ != NULL;
+  }
+
+  Renderer *renderer() const {
+    return renderer_;
+  }
+
+  NativeGpuResource *resources() const {
+    return resources_;
+  }
+
+ private:
+  std::unique_lock<std::mutex> lock_;
+  Renderer *renderer_ = NULL;
+  NativeGpuResource *resources_ = NULL;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_COMPOSITOR_RENDERERSERVICE_H_
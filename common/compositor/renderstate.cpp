@@ -16,6 +16,8 @@
 
 #include "renderstate.h"
 
+#include <drm_fourcc.h>
+
 #include "compositionregion.h"
 #include "hwcutils.h"
 #include "nativegpuresource.h"
@@ -23,6 +25,18 @@
 
 namespace hwcomposer {
 
+static bool IsRGBFormat(uint32_t format) {
+  switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_ABGR8888:
+      return true;
+    default:
+      return false;
+  }
+}
+
 void RenderState::ConstructState(std::vector<OverlayLayer> &layers,
                                  const CompositionRegion &region,
                                  const NativeGpuResource *resources) {
@@ -107,15 +121,34 @@ void RenderState::ConstructState(std::vector<OverlayLayer> &layers,
       }
     }
 
-    if (layer.GetBlending() == HWCBlending::kBlendingNone) {
+    src.blending_ = layer.GetBlending();
+    if (src.blending_ == HWCBlending::kBlendingNone) {
       src.alpha_ = src.premult_ = 1.0f;
       break;
     }
 
     src.alpha_ = layer.GetAlpha() / 255.0f;
     src.premult_ =
-        (layer.GetBlending() == HWCBlending::kBlendingPremult) ? 1.0f : 0.0f;
+        (src.blending_ == HWCBlending::kBlendingPremult) ? 1.0f : 0.0f;
   }
+
+  if (layer_state_.size() != 1)
+    return;
+
+  const OverlayLayer &layer = layers.at(region.source_layers.front());
+  if (!layer.IsOpaque() || layer.GetTransform() != kIdentity ||
+      !IsRGBFormat(layer.GetBuffer()->GetFormat()) ||
+      layer.GetSourceCropWidth() != layer.GetDisplayFrameWidth() ||
+      layer.GetSourceCropHeight() != layer.GetDisplayFrameHeight())
+    return;
+
+  const HwcRect<int> &display_frame = layer.GetDisplayFrame();
+  const HwcRect<float> &source_crop = layer.GetSourceCrop();
+  copy_ = true;
+  copy_x_ = static_cast<int>(source_crop.left) + region.frame.left -
+            display_frame.left;
+  copy_y_ = static_cast<int>(source_crop.top) + region.frame.top -
+            display_frame.top;
 }
 
 }  // namespace hwcomposer
@@ -21,6 +21,8 @@
 
 #include <stdint.h>
 
+#include <hwcdefs.h>
+
 #include "compositordefs.h"
 
 namespace hwcomposer {
@@ -34,6 +36,7 @@ struct RenderState {
     float crop_bounds_[4];
     float alpha_;
     float premult_;
+    HWCBlending blending_;
     float texture_matrix_[4];
     GpuResourceHandle handle_;
   };
@@ -47,6 +50,14 @@ struct RenderState {
   float width_;
   float height_;
   std::vector<LayerState> layer_state_;
+  // Set if region shows a single opaque RGB layer which is
+  // neither transformed nor scaled, its texels can be copied
+  // to the target without running the blending program.
+  bool copy_ = false;
+  // Top left corner of the region in the layer's buffer,
+  // valid when copy_ is set.
+  int copy_x_ = 0;
+  int copy_y_ = 0;
 };
 
 }  // namespace hwcomposer
@@ -0,0 +1,106 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "nativeswresource.h"
+
+#include "hwctrace.h"
+#include "hwcutils.h"
+#include "overlaylayer.h"
+
+namespace hwcomposer {
+
+// Time a mapping can stay unused before we release it. Aged by time
+// as the cache is shared by all displays.
+static const int64_t kMaxUnusedTimeNs = 500000000;
+// Upper bound on number of mappings we keep around.
+static const size_t kMaxCachedImages = 32;
+
+NativeSWResource::~NativeSWResource() {
+  ReleaseGPUResources();
+}
+
+bool NativeSWResource::PrepareResources(
+    const std::vector<OverlayLayer>& layers,
+    const std::vector<size_t>& source_layers) {
+  int64_t now = GetMonotonicTimeNs();
+  layer_images_.assign(layers.size(), NULL);
+  for (size_t layer_index : source_layers) {
+    OverlayBuffer* buffer = layers.at(layer_index).GetBuffer();
+    uint64_t key = buffer->GetId();
+    CachedImage& cached = image_cache_[key];
+    cached.last_used_ns_ = now;
+    if (!cached.image_) {
+      std::unique_ptr<SWImage> image(new SWImage());
+      if (!image->Map(buffer)) {
+        ETRACE("Failed to map layer buffer.");
+        image_cache_.erase(key);
+        return false;
+      }
+
+      cached.image_ = std::move(image);
+    }
+
+    layer_images_.at(layer_index) = cached.image_.get();
+  }
+
+  EvictUnusedImages(now);
+
+  return true;
+}
+
+void NativeSWResource::EvictUnusedImages(int64_t now) {
+  for (auto it = image_cache_.begin(); it != image_cache_.end();) {
+    if (now - it->second.last_used_ns_ > kMaxUnusedTimeNs)
+      it = image_cache_.erase(it);
+    else
+      ++it;
+  }
+
+  while (image_cache_.size() > kMaxCachedImages) {
+    auto lru = image_cache_.begin();
+    for (auto it = image_cache_.begin(); it != image_cache_.end(); ++it) {
+      if (it->second.last_used_ns_ < lru->second.last_used_ns_)
+        lru = it;
+    }
+
+    if (lru->second.last_used_ns_ == now)
+      break;
+
+    image_cache_.erase(lru);
+  }
+}
+
+void NativeSWResource::ReleaseBufferResources(
+    const std::vector<uint64_t>& buffer_ids) {
+  for (uint64_t buffer_id : buffer_ids) {
+    image_cache_.erase(buffer_id);
+  }
+}
+
+void NativeSWResource::ReleaseGPUResources() {
+  std::vector<const SWImage*>().swap(layer_images_);
+  image_cache_.clear();
+}
+
+GpuResourceHandle NativeSWResource::GetResourceHandle(
+    uint32_t layer_index) const {
+  if (layer_images_.size() <= layer_index)
+    return NULL;
+
+  return layer_images_.at(layer_index);
+}
+
+}  // namespace hwcomposer
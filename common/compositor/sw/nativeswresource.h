@@ -0,0 +1,60 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_COMPOSITOR_SW_NATIVESWRESOURCE_H_
+#define COMMON_COMPOSITOR_SW_NATIVESWRESOURCE_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "nativegpuresource.h"
+#include "swimage.h"
+
+namespace hwcomposer {
+
+struct OverlayLayer;
+
+// Keeps CPU mappings of layer buffers, mapping and unmapping them
+// every frame would cost more than the composition itself.
+class NativeSWResource : public NativeGpuResource {
+ public:
+  NativeSWResource() = default;
+  ~NativeSWResource() override;
+
+  bool PrepareResources(const std::vector<OverlayLayer>& layers,
+                        const std::vector<size_t>& source_layers) override;
+  GpuResourceHandle GetResourceHandle(uint32_t layer_index) const override;
+  void ReleaseGPUResources() override;
+  void ReleaseBufferResources(const std::vector<uint64_t>& buffer_ids) override;
+
+ private:
+  struct CachedImage {
+    std::unique_ptr<SWImage> image_;
+    int64_t last_used_ns_ = 0;
+  };
+
+  void EvictUnusedImages(int64_t now);
+
+  std::vector<const SWImage*> layer_images_;
+  // Indexed by OverlayBuffer id.
+  std::map<uint64_t, CachedImage> image_cache_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_COMPOSITOR_SW_NATIVESWRESOURCE_H_
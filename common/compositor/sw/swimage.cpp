@@ -0,0 +1,138 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "swimage.h"
+
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <linux/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "hwctrace.h"
+#include "overlaybuffer.h"
+
+#ifndef DMA_BUF_IOCTL_SYNC
+struct dma_buf_sync {
+  __u64 flags;
+};
+
+#define DMA_BUF_SYNC_READ (1 << 0)
+#define DMA_BUF_SYNC_WRITE (2 << 0)
+#define DMA_BUF_SYNC_START (0 << 2)
+#define DMA_BUF_SYNC_END (1 << 2)
+#define DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct dma_buf_sync)
+#endif
+
+namespace hwcomposer {
+
+SWImage::~SWImage() {
+  Unmap();
+}
+
+bool SWImage::Map(const OverlayBuffer* buffer) {
+  Unmap();
+  uint32_t format = buffer->GetFormat();
+  uint32_t height = buffer->GetHeight();
+  uint32_t num_planes = 1;
+  size_t required = 0;
+  switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_ABGR8888:
+      required = buffer->GetOffset(0) +
+                 static_cast<size_t>(buffer->GetPitch(0)) * height;
+      break;
+    case DRM_FORMAT_NV12:
+      num_planes = 2;
+      required = buffer->GetOffset(1) +
+                 static_cast<size_t>(buffer->GetPitch(1)) * ((height + 1) / 2);
+      break;
+    default:
+      ETRACE("SWImage: Unsupported format %4.4s", (char*)&format);
+      return false;
+  }
+
+  int fd = dup(buffer->GetPrimeFD());
+  if (fd < 0) {
+    ETRACE("SWImage: Failed to duplicate buffer fd %s", PRINTERROR());
+    return false;
+  }
+
+  // Size of the dma-buf can be queried with lseek, fall back to
+  // the size needed by the layout in case it can't.
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < 0)
+    size = required;
+
+  if (static_cast<size_t>(size) < required) {
+    ETRACE("SWImage: Buffer of %zu bytes is too small for its layout",
+           static_cast<size_t>(size));
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    ETRACE("SWImage: mmap failed %s", PRINTERROR());
+    close(fd);
+    return false;
+  }
+
+  data_ = static_cast<uint8_t*>(data);
+  size_ = size;
+  fd_ = fd;
+  width_ = buffer->GetWidth();
+  height_ = height;
+  format_ = format;
+  for (uint32_t i = 0; i < num_planes; i++) {
+    pitches_[i] = buffer->GetPitch(i);
+    offsets_[i] = buffer->GetOffset(i);
+  }
+
+  return true;
+}
+
+void SWImage::Unmap() {
+  if (data_)
+    munmap(data_, size_);
+
+  if (fd_ >= 0)
+    close(fd_);
+
+  data_ = NULL;
+  size_ = 0;
+  fd_ = -1;
+}
+
+void SWImage::BeginAccess(bool write) const {
+  struct dma_buf_sync sync;
+  sync.flags = DMA_BUF_SYNC_START |
+               (write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ);
+  // Fails for buffers which are not dma-bufs, they don't need it.
+  ioctl(fd_, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+void SWImage::EndAccess(bool write) const {
+  struct dma_buf_sync sync;
+  sync.flags = DMA_BUF_SYNC_END |
+               (write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ);
+  ioctl(fd_, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+}  // namespace hwcomposer
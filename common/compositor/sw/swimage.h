@@ -0,0 +1,81 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_COMPOSITOR_SW_SWIMAGE_H_
+#define COMMON_COMPOSITOR_SW_SWIMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hwcomposer {
+
+class OverlayBuffer;
+
+// CPU mapping of a buffer. Only linear layouts can be accessed this
+// way, tiled buffers would be read as garbage.
+class SWImage {
+ public:
+  SWImage() = default;
+  ~SWImage();
+
+  SWImage(const SWImage& rhs) = delete;
+  SWImage& operator=(const SWImage& rhs) = delete;
+
+  bool Map(const OverlayBuffer* buffer);
+  void Unmap();
+
+  // Brackets CPU access to the mapping, so that CPU caches are
+  // coherent with what GPU and display see.
+  void BeginAccess(bool write) const;
+  void EndAccess(bool write) const;
+
+  uint8_t* GetPlane(uint32_t plane) const {
+    return data_ + offsets_[plane];
+  }
+
+  uint32_t GetPitch(uint32_t plane) const {
+    return pitches_[plane];
+  }
+
+  uint32_t GetWidth() const {
+    return width_;
+  }
+
+  uint32_t GetHeight() const {
+    return height_;
+  }
+
+  uint32_t GetFormat() const {
+    return format_;
+  }
+
+  bool IsMapped() const {
+    return data_ != NULL;
+  }
+
+ private:
+  uint8_t* data_ = NULL;
+  size_t size_ = 0;
+  int fd_ = -1;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  uint32_t format_ = 0;
+  uint32_t pitches_[2] = {0, 0};
+  uint32_t offsets_[2] = {0, 0};
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_COMPOSITOR_SW_SWIMAGE_H_
@@ -0,0 +1,502 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "swkernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SW_KERNELS_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SW_KERNELS_NEON
+#endif
+
+namespace hwcomposer {
+
+static const float kByteToFloat = 1.0f / 255.0f;
+
+// Blend kernels process whole vectors, spans have room for them.
+static size_t RoundUp(size_t count, size_t vector_size) {
+  return (count + vector_size - 1) & ~(vector_size - 1);
+}
+
+static inline float Clamp(float value) {
+  return value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+}
+
+static inline void LoadPixel(uint32_t pixel, bool swap_rb, bool has_alpha,
+                             SWSpan* span, size_t i) {
+  float c0 = (pixel & 0xff) * kByteToFloat;
+  float c2 = ((pixel >> 16) & 0xff) * kByteToFloat;
+  span->r[i] = swap_rb ? c0 : c2;
+  span->g[i] = ((pixel >> 8) & 0xff) * kByteToFloat;
+  span->b[i] = swap_rb ? c2 : c0;
+  span->a[i] = has_alpha ? (pixel >> 24) * kByteToFloat : 1.0f;
+}
+
+static inline uint32_t StorePixel(const SWSpan& span, bool swap_rb,
+                                  size_t i) {
+  uint32_t r = Clamp(span.r[i]) * 255.0f + 0.5f;
+  uint32_t g = Clamp(span.g[i]) * 255.0f + 0.5f;
+  uint32_t b = Clamp(span.b[i]) * 255.0f + 0.5f;
+  uint32_t a = Clamp(1.0f - span.a[i]) * 255.0f + 0.5f;
+  return (swap_rb ? r : b) | g << 8 | (swap_rb ? b : r) << 16 | a << 24;
+}
+
+static void LoadScalar(const uint32_t* pixels, size_t count, bool swap_rb,
+                       bool has_alpha, SWSpan* span) {
+  for (size_t i = 0; i < count; i++)
+    LoadPixel(pixels[i], swap_rb, has_alpha, span, i);
+}
+
+static bool BlendOpaqueScalar(const SWSpan& src, size_t count, SWSpan* dst) {
+  for (size_t i = 0; i < count; i++) {
+    float cover = dst->a[i];
+    dst->r[i] += src.r[i] * cover;
+    dst->g[i] += src.g[i] * cover;
+    dst->b[i] += src.b[i] * cover;
+    dst->a[i] = 0.0f;
+  }
+
+  return false;
+}
+
+static bool BlendPremultScalar(const SWSpan& src, float alpha, size_t count,
+                               SWSpan* dst) {
+  bool visible = false;
+  for (size_t i = 0; i < count; i++) {
+    float cover = dst->a[i];
+    float weight = alpha * cover;
+    dst->r[i] += src.r[i] * weight;
+    dst->g[i] += src.g[i] * weight;
+    dst->b[i] += src.b[i] * weight;
+    cover *= 1.0f - src.a[i] * alpha;
+    dst->a[i] = cover;
+    visible |= cover > kSWMinCover;
+  }
+
+  return visible;
+}
+
+static bool BlendCoverageScalar(const SWSpan& src, float alpha, size_t count,
+                                SWSpan* dst) {
+  bool visible = false;
+  for (size_t i = 0; i < count; i++) {
+    float cover = dst->a[i];
+    float src_alpha = src.a[i] * alpha;
+    float weight = src_alpha * cover;
+    dst->r[i] += src.r[i] * weight;
+    dst->g[i] += src.g[i] * weight;
+    dst->b[i] += src.b[i] * weight;
+    cover *= 1.0f - src_alpha;
+    dst->a[i] = cover;
+    visible |= cover > kSWMinCover;
+  }
+
+  return visible;
+}
+
+static void StoreScalar(const SWSpan& span, size_t count, bool swap_rb,
+                        uint32_t* pixels) {
+  for (size_t i = 0; i < count; i++)
+    pixels[i] = StorePixel(span, swap_rb, i);
+}
+
+static const SWKernels kScalarKernels = {
+    "scalar",           LoadScalar,         BlendOpaqueScalar,
+    BlendPremultScalar, BlendCoverageScalar, StoreScalar};
+
+#ifdef SW_KERNELS_X86
+// SSE2 is part of x86-64, it gives us everything needed for 4 pixel
+// wide kernels. Nothing in later SSE revisions speeds them up.
+#define SW_SSE2 __attribute__((target("sse2")))
+
+SW_SSE2 static void LoadSSE2(const uint32_t* pixels, size_t count,
+                             bool swap_rb, bool has_alpha, SWSpan* span) {
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128 scale = _mm_set1_ps(kByteToFloat);
+  const __m128 one = _mm_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+    __m128 c0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(v, mask)), scale);
+    __m128 c1 = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask)), scale);
+    __m128 c2 = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask)), scale);
+    __m128 c3 = has_alpha
+                    ? _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 24)), scale)
+                    : one;
+    _mm_store_ps(span->r + i, swap_rb ? c0 : c2);
+    _mm_store_ps(span->g + i, c1);
+    _mm_store_ps(span->b + i, swap_rb ? c2 : c0);
+    _mm_store_ps(span->a + i, c3);
+  }
+
+  for (; i < count; i++)
+    LoadPixel(pixels[i], swap_rb, has_alpha, span, i);
+}
+
+SW_SSE2 static bool BlendOpaqueSSE2(const SWSpan& src, size_t count,
+                                    SWSpan* dst) {
+  const __m128 zero = _mm_setzero_ps();
+  count = RoundUp(count, 4);
+  for (size_t i = 0; i < count; i += 4) {
+    __m128 cover = _mm_load_ps(dst->a + i);
+    _mm_store_ps(dst->r + i, _mm_add_ps(_mm_load_ps(dst->r + i),
+                                        _mm_mul_ps(_mm_load_ps(src.r + i),
+                                                   cover)));
+    _mm_store_ps(dst->g + i, _mm_add_ps(_mm_load_ps(dst->g + i),
+                                        _mm_mul_ps(_mm_load_ps(src.g + i),
+                                                   cover)));
+    _mm_store_ps(dst->b + i, _mm_add_ps(_mm_load_ps(dst->b + i),
+                                        _mm_mul_ps(_mm_load_ps(src.b + i),
+                                                   cover)));
+    _mm_store_ps(dst->a + i, zero);
+  }
+
+  return false;
+}
+
+// Coverage blending differs from premultiplied blending only in colors
+// being weighted by source alpha as well.
+SW_SSE2 static inline bool BlendSSE2(const SWSpan& src, float alpha,
+                                     bool coverage, size_t count,
+                                     SWSpan* dst) {
+  const __m128 layer_alpha = _mm_set1_ps(alpha);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 min_cover = _mm_set1_ps(kSWMinCover);
+  __m128 visible = _mm_setzero_ps();
+  count = RoundUp(count, 4);
+  for (size_t i = 0; i < count; i += 4) {
+    __m128 cover = _mm_load_ps(dst->a + i);
+    __m128 src_alpha = _mm_mul_ps(_mm_load_ps(src.a + i), layer_alpha);
+    __m128 weight =
+        _mm_mul_ps(coverage ? src_alpha : layer_alpha, cover);
+    _mm_store_ps(dst->r + i, _mm_add_ps(_mm_load_ps(dst->r + i),
+                                        _mm_mul_ps(_mm_load_ps(src.r + i),
+                                                   weight)));
+    _mm_store_ps(dst->g + i, _mm_add_ps(_mm_load_ps(dst->g + i),
+                                        _mm_mul_ps(_mm_load_ps(src.g + i),
+                                                   weight)));
+    _mm_store_ps(dst->b + i, _mm_add_ps(_mm_load_ps(dst->b + i),
+                                        _mm_mul_ps(_mm_load_ps(src.b + i),
+                                                   weight)));
+    cover = _mm_mul_ps(cover, _mm_sub_ps(one, src_alpha));
+    _mm_store_ps(dst->a + i, cover);
+    visible = _mm_or_ps(visible, _mm_cmpgt_ps(cover, min_cover));
+  }
+
+  return _mm_movemask_ps(visible) != 0;
+}
+
+SW_SSE2 static bool BlendPremultSSE2(const SWSpan& src, float alpha,
+                                     size_t count, SWSpan* dst) {
+  return BlendSSE2(src, alpha, false, count, dst);
+}
+
+SW_SSE2 static bool BlendCoverageSSE2(const SWSpan& src, float alpha,
+                                      size_t count, SWSpan* dst) {
+  return BlendSSE2(src, alpha, true, count, dst);
+}
+
+SW_SSE2 static inline __m128i ToByteSSE2(__m128 value) {
+  const __m128 scale = _mm_set1_ps(255.0f);
+  value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+  return _mm_cvtps_epi32(_mm_mul_ps(value, scale));
+}
+
+SW_SSE2 static void StoreSSE2(const SWSpan& span, size_t count, bool swap_rb,
+                              uint32_t* pixels) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i r = ToByteSSE2(_mm_load_ps(span.r + i));
+    __m128i g = ToByteSSE2(_mm_load_ps(span.g + i));
+    __m128i b = ToByteSSE2(_mm_load_ps(span.b + i));
+    __m128i a = ToByteSSE2(_mm_sub_ps(one, _mm_load_ps(span.a + i)));
+    __m128i v = _mm_or_si128(
+        _mm_or_si128(swap_rb ? r : b, _mm_slli_epi32(g, 8)),
+        _mm_or_si128(_mm_slli_epi32(swap_rb ? b : r, 16),
+                     _mm_slli_epi32(a, 24)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), v);
+  }
+
+  for (; i < count; i++)
+    pixels[i] = StorePixel(span, swap_rb, i);
+}
+
+static const SWKernels kSSE2Kernels = {
+    "sse2",           LoadSSE2,          BlendOpaqueSSE2,
+    BlendPremultSSE2, BlendCoverageSSE2, StoreSSE2};
+
+#define SW_AVX2 __attribute__((target("avx2")))
+
+SW_AVX2 static void LoadAVX2(const uint32_t* pixels, size_t count,
+                             bool swap_rb, bool has_alpha, SWSpan* span) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256 scale = _mm256_set1_ps(kByteToFloat);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i));
+    __m256 c0 =
+        _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(v, mask)), scale);
+    __m256 c1 = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask)),
+        scale);
+    __m256 c2 = _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask)),
+        scale);
+    __m256 c3 =
+        has_alpha
+            ? _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(v, 24)),
+                            scale)
+            : one;
+    _mm256_store_ps(span->r + i, swap_rb ? c0 : c2);
+    _mm256_store_ps(span->g + i, c1);
+    _mm256_store_ps(span->b + i, swap_rb ? c2 : c0);
+    _mm256_store_ps(span->a + i, c3);
+  }
+
+  for (; i < count; i++)
+    LoadPixel(pixels[i], swap_rb, has_alpha, span, i);
+}
+
+SW_AVX2 static bool BlendOpaqueAVX2(const SWSpan& src, size_t count,
+                                    SWSpan* dst) {
+  const __m256 zero = _mm256_setzero_ps();
+  count = RoundUp(count, 8);
+  for (size_t i = 0; i < count; i += 8) {
+    __m256 cover = _mm256_load_ps(dst->a + i);
+    _mm256_store_ps(dst->r + i,
+                    _mm256_add_ps(_mm256_load_ps(dst->r + i),
+                                  _mm256_mul_ps(_mm256_load_ps(src.r + i),
+                                                cover)));
+    _mm256_store_ps(dst->g + i,
+                    _mm256_add_ps(_mm256_load_ps(dst->g + i),
+                                  _mm256_mul_ps(_mm256_load_ps(src.g + i),
+                                                cover)));
+    _mm256_store_ps(dst->b + i,
+                    _mm256_add_ps(_mm256_load_ps(dst->b + i),
+                                  _mm256_mul_ps(_mm256_load_ps(src.b + i),
+                                                cover)));
+    _mm256_store_ps(dst->a + i, zero);
+  }
+
+  return false;
+}
+
+SW_AVX2 static inline bool BlendAVX2(const SWSpan& src, float alpha,
+                                     bool coverage, size_t count,
+                                     SWSpan* dst) {
+  const __m256 layer_alpha = _mm256_set1_ps(alpha);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 min_cover = _mm256_set1_ps(kSWMinCover);
+  __m256 visible = _mm256_setzero_ps();
+  count = RoundUp(count, 8);
+  for (size_t i = 0; i < count; i += 8) {
+    __m256 cover = _mm256_load_ps(dst->a + i);
+    __m256 src_alpha = _mm256_mul_ps(_mm256_load_ps(src.a + i), layer_alpha);
+    __m256 weight = _mm256_mul_ps(coverage ? src_alpha : layer_alpha, cover);
+    _mm256_store_ps(dst->r + i,
+                    _mm256_add_ps(_mm256_load_ps(dst->r + i),
+                                  _mm256_mul_ps(_mm256_load_ps(src.r + i),
+                                                weight)));
+    _mm256_store_ps(dst->g + i,
+                    _mm256_add_ps(_mm256_load_ps(dst->g + i),
+                                  _mm256_mul_ps(_mm256_load_ps(src.g + i),
+                                                weight)));
+    _mm256_store_ps(dst->b + i,
+                    _mm256_add_ps(_mm256_load_ps(dst->b + i),
+                                  _mm256_mul_ps(_mm256_load_ps(src.b + i),
+                                                weight)));
+    cover = _mm256_mul_ps(cover, _mm256_sub_ps(one, src_alpha));
+    _mm256_store_ps(dst->a + i, cover);
+    visible =
+        _mm256_or_ps(visible, _mm256_cmp_ps(cover, min_cover, _CMP_GT_OQ));
+  }
+
+  return _mm256_movemask_ps(visible) != 0;
+}
+
+SW_AVX2 static bool BlendPremultAVX2(const SWSpan& src, float alpha,
+                                     size_t count, SWSpan* dst) {
+  return BlendAVX2(src, alpha, false, count, dst);
+}
+
+SW_AVX2 static bool BlendCoverageAVX2(const SWSpan& src, float alpha,
+                                      size_t count, SWSpan* dst) {
+  return BlendAVX2(src, alpha, true, count, dst);
+}
+
+SW_AVX2 static inline __m256i ToByteAVX2(__m256 value) {
+  const __m256 scale = _mm256_set1_ps(255.0f);
+  value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()),
+                        _mm256_set1_ps(1.0f));
+  return _mm256_cvtps_epi32(_mm256_mul_ps(value, scale));
+}
+
+SW_AVX2 static void StoreAVX2(const SWSpan& span, size_t count, bool swap_rb,
+                              uint32_t* pixels) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i r = ToByteAVX2(_mm256_load_ps(span.r + i));
+    __m256i g = ToByteAVX2(_mm256_load_ps(span.g + i));
+    __m256i b = ToByteAVX2(_mm256_load_ps(span.b + i));
+    __m256i a = ToByteAVX2(_mm256_sub_ps(one, _mm256_load_ps(span.a + i)));
+    __m256i v = _mm256_or_si256(
+        _mm256_or_si256(swap_rb ? r : b, _mm256_slli_epi32(g, 8)),
+        _mm256_or_si256(_mm256_slli_epi32(swap_rb ? b : r, 16),
+                        _mm256_slli_epi32(a, 24)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i), v);
+  }
+
+  for (; i < count; i++)
+    pixels[i] = StorePixel(span, swap_rb, i);
+}
+
+static const SWKernels kAVX2Kernels = {
+    "avx2",           LoadAVX2,          BlendOpaqueAVX2,
+    BlendPremultAVX2, BlendCoverageAVX2, StoreAVX2};
+#endif
+
+#ifdef SW_KERNELS_NEON
+static void LoadNEON(const uint32_t* pixels, size_t count, bool swap_rb,
+                     bool has_alpha, SWSpan* span) {
+  const uint32x4_t mask = vdupq_n_u32(0xff);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint32x4_t v = vld1q_u32(pixels + i);
+    float32x4_t c0 =
+        vmulq_n_f32(vcvtq_f32_u32(vandq_u32(v, mask)), kByteToFloat);
+    float32x4_t c1 = vmulq_n_f32(
+        vcvtq_f32_u32(vandq_u32(vshrq_n_u32(v, 8), mask)), kByteToFloat);
+    float32x4_t c2 = vmulq_n_f32(
+        vcvtq_f32_u32(vandq_u32(vshrq_n_u32(v, 16), mask)), kByteToFloat);
+    float32x4_t c3 =
+        has_alpha ? vmulq_n_f32(vcvtq_f32_u32(vshrq_n_u32(v, 24)),
+                                kByteToFloat)
+                  : one;
+    vst1q_f32(span->r + i, swap_rb ? c0 : c2);
+    vst1q_f32(span->g + i, c1);
+    vst1q_f32(span->b + i, swap_rb ? c2 : c0);
+    vst1q_f32(span->a + i, c3);
+  }
+
+  for (; i < count; i++)
+    LoadPixel(pixels[i], swap_rb, has_alpha, span, i);
+}
+
+static bool BlendOpaqueNEON(const SWSpan& src, size_t count, SWSpan* dst) {
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  count = RoundUp(count, 4);
+  for (size_t i = 0; i < count; i += 4) {
+    float32x4_t cover = vld1q_f32(dst->a + i);
+    vst1q_f32(dst->r + i,
+              vmlaq_f32(vld1q_f32(dst->r + i), vld1q_f32(src.r + i), cover));
+    vst1q_f32(dst->g + i,
+              vmlaq_f32(vld1q_f32(dst->g + i), vld1q_f32(src.g + i), cover));
+    vst1q_f32(dst->b + i,
+              vmlaq_f32(vld1q_f32(dst->b + i), vld1q_f32(src.b + i), cover));
+    vst1q_f32(dst->a + i, zero);
+  }
+
+  return false;
+}
+
+static inline bool BlendNEON(const SWSpan& src, float alpha, bool coverage,
+                             size_t count, SWSpan* dst) {
+  const float32x4_t layer_alpha = vdupq_n_f32(alpha);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  float32x4_t max_cover = vdupq_n_f32(0.0f);
+  count = RoundUp(count, 4);
+  for (size_t i = 0; i < count; i += 4) {
+    float32x4_t cover = vld1q_f32(dst->a + i);
+    float32x4_t src_alpha = vmulq_f32(vld1q_f32(src.a + i), layer_alpha);
+    float32x4_t weight =
+        vmulq_f32(coverage ? src_alpha : layer_alpha, cover);
+    vst1q_f32(dst->r + i,
+              vmlaq_f32(vld1q_f32(dst->r + i), vld1q_f32(src.r + i), weight));
+    vst1q_f32(dst->g + i,
+              vmlaq_f32(vld1q_f32(dst->g + i), vld1q_f32(src.g + i), weight));
+    vst1q_f32(dst->b + i,
+              vmlaq_f32(vld1q_f32(dst->b + i), vld1q_f32(src.b + i), weight));
+    cover = vmulq_f32(cover, vsubq_f32(one, src_alpha));
+    vst1q_f32(dst->a + i, cover);
+    max_cover = vmaxq_f32(max_cover, cover);
+  }
+
+  return vmaxvq_f32(max_cover) > kSWMinCover;
+}
+
+static bool BlendPremultNEON(const SWSpan& src, float alpha, size_t count,
+                             SWSpan* dst) {
+  return BlendNEON(src, alpha, false, count, dst);
+}
+
+static bool BlendCoverageNEON(const SWSpan& src, float alpha, size_t count,
+                              SWSpan* dst) {
+  return BlendNEON(src, alpha, true, count, dst);
+}
+
+static inline uint32x4_t ToByteNEON(float32x4_t value) {
+  value = vminq_f32(vmaxq_f32(value, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+  return vcvtnq_u32_f32(vmulq_n_f32(value, 255.0f));
+}
+
+static void StoreNEON(const SWSpan& span, size_t count, bool swap_rb,
+                      uint32_t* pixels) {
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint32x4_t r = ToByteNEON(vld1q_f32(span.r + i));
+    uint32x4_t g = ToByteNEON(vld1q_f32(span.g + i));
+    uint32x4_t b = ToByteNEON(vld1q_f32(span.b + i));
+    uint32x4_t a = ToByteNEON(vsubq_f32(one, vld1q_f32(span.a + i)));
+    uint32x4_t v = vorrq_u32(
+        vorrq_u32(swap_rb ? r : b, vshlq_n_u32(g, 8)),
+        vorrq_u32(vshlq_n_u32(swap_rb ? b : r, 16), vshlq_n_u32(a, 24)));
+    vst1q_u32(pixels + i, v);
+  }
+
+  for (; i < count; i++)
+    pixels[i] = StorePixel(span, swap_rb, i);
+}
+
+static const SWKernels kNEONKernels = {
+    "neon",           LoadNEON,          BlendOpaqueNEON,
+    BlendPremultNEON, BlendCoverageNEON, StoreNEON};
+#endif
+
+const SWKernels& GetSWKernels() {
+#ifdef SW_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return kAVX2Kernels;
+
+  if (__builtin_cpu_supports("sse2"))
+    return kSSE2Kernels;
+#elif defined(SW_KERNELS_NEON)
+  return kNEONKernels;
+#endif
+  return kScalarKernels;
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,70 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_COMPOSITOR_SW_SWKERNELS_H_
+#define COMMON_COMPOSITOR_SW_SWKERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hwcomposer {
+
+// Maximum number of pixels processed by a kernel call.
+static const size_t kSWSpanWidth = 256;
+
+// Row of pixels, one array per channel. Colors are premultiplied and
+// in [0, 1] range. When used to accumulate layers, a holds the part
+// of the pixel which is not covered yet.
+struct SWSpan {
+  alignas(32) float r[kSWSpanWidth];
+  alignas(32) float g[kSWSpanWidth];
+  alignas(32) float b[kSWSpanWidth];
+  alignas(32) float a[kSWSpanWidth];
+};
+
+// Uncovered part of a pixel below which layers underneath can't
+// change its value anymore.
+static const float kSWMinCover = 0.5f / 255.0f;
+
+// Blending kernels of the software renderer, they implement what the
+// GL programs do per fragment. Layers are blended front to back, top
+// most first. Blend kernels return true if some pixel of dst is still
+// not covered and hence layers below need to be blended as well.
+struct SWKernels {
+  const char* name;
+  // Converts 32 bit RGB pixels to a span. swap_rb is set for formats
+  // with red in the low byte, alpha is 1 when has_alpha is false.
+  void (*load)(const uint32_t* pixels, size_t count, bool swap_rb,
+               bool has_alpha, SWSpan* span);
+  // Layer hides everything below it.
+  bool (*blend_opaque)(const SWSpan& src, size_t count, SWSpan* dst);
+  // Layer has premultiplied colors, alpha is the plane alpha.
+  bool (*blend_premult)(const SWSpan& src, float alpha, size_t count,
+                        SWSpan* dst);
+  // Colors of the layer are not premultiplied.
+  bool (*blend_coverage)(const SWSpan& src, float alpha, size_t count,
+                         SWSpan* dst);
+  // Converts the accumulated span to 32 bit pixels, alpha being the
+  // covered part of the pixel.
+  void (*store)(const SWSpan& span, size_t count, bool swap_rb,
+                uint32_t* pixels);
+};
+
+// Returns the fastest kernels supported by the CPU.
+const SWKernels& GetSWKernels();
+
+}  // namespace hwcomposer
+#endif  // COMMON_COMPOSITOR_SW_SWKERNELS_H_
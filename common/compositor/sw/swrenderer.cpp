@@ -0,0 +1,438 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "swrenderer.h"
+
+#include <drm_fourcc.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "hwctrace.h"
+#include "hwcutils.h"
+#include "swimage.h"
+#include "swsurface.h"
+
+namespace hwcomposer {
+
+// Upper bound on number of threads drawing, including the caller of
+// Draw. Composition is memory bound, more threads don't help.
+static const unsigned kMaxThreads = 4;
+// Number of rows of a region drawn by one task.
+static const int kBandHeight = 32;
+// Time to wait for the display to release the target.
+static const int kFenceTimeoutMs = 1000;
+// Tolerance, in texels, for treating a layer as unscaled.
+static const float kTexelEpsilon = 1.0f / 256.0f;
+
+static bool GetRGBLayout(uint32_t format, bool* swap_rb, bool* has_alpha) {
+  switch (format) {
+    case DRM_FORMAT_XRGB8888:
+      *swap_rb = false;
+      *has_alpha = false;
+      return true;
+    case DRM_FORMAT_ARGB8888:
+      *swap_rb = false;
+      *has_alpha = true;
+      return true;
+    case DRM_FORMAT_XBGR8888:
+      *swap_rb = true;
+      *has_alpha = false;
+      return true;
+    case DRM_FORMAT_ABGR8888:
+      *swap_rb = true;
+      *has_alpha = true;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static inline int Clamp(int value, int max) {
+  return value < 0 ? 0 : (value > max ? max : value);
+}
+
+static inline float Lerp(float a, float b, float t) {
+  return a + (b - a) * t;
+}
+
+static inline float Channel(uint32_t pixel, int shift) {
+  return ((pixel >> shift) & 0xff) * (1.0f / 255.0f);
+}
+
+// Bilinear filtering with clamp to edge, as done by the GPU for
+// external textures. u and v are in texels, relative to texel centers.
+static void SampleRGB(const SWImage& image, bool swap_rb, bool has_alpha,
+                      float u, float v, SWSpan* span, size_t i) {
+  int max_x = image.GetWidth() - 1;
+  int max_y = image.GetHeight() - 1;
+  float x_floor = floorf(u);
+  float y_floor = floorf(v);
+  float fx = u - x_floor;
+  float fy = v - y_floor;
+  int x0 = Clamp(static_cast<int>(x_floor), max_x);
+  int x1 = Clamp(static_cast<int>(x_floor) + 1, max_x);
+  int y0 = Clamp(static_cast<int>(y_floor), max_y);
+  int y1 = Clamp(static_cast<int>(y_floor) + 1, max_y);
+  const uint8_t* plane = image.GetPlane(0);
+  uint32_t pitch = image.GetPitch(0);
+  const uint32_t* row0 = reinterpret_cast<const uint32_t*>(plane + y0 * pitch);
+  const uint32_t* row1 = reinterpret_cast<const uint32_t*>(plane + y1 * pitch);
+  uint32_t p00 = row0[x0];
+  uint32_t p10 = row0[x1];
+  uint32_t p01 = row1[x0];
+  uint32_t p11 = row1[x1];
+  float channels[4];
+  for (int c = 0; c < 4; c++) {
+    int shift = c * 8;
+    channels[c] =
+        Lerp(Lerp(Channel(p00, shift), Channel(p10, shift), fx),
+             Lerp(Channel(p01, shift), Channel(p11, shift), fx), fy);
+  }
+
+  span->r[i] = swap_rb ? channels[0] : channels[2];
+  span->g[i] = channels[1];
+  span->b[i] = swap_rb ? channels[2] : channels[0];
+  span->a[i] = has_alpha ? channels[3] : 1.0f;
+}
+
+static float SampleByte(const uint8_t* plane, uint32_t pitch, int width,
+                        int height, int bytes_per_texel, int offset, float u,
+                        float v) {
+  float x_floor = floorf(u);
+  float y_floor = floorf(v);
+  float fx = u - x_floor;
+  float fy = v - y_floor;
+  int x0 = Clamp(static_cast<int>(x_floor), width - 1) * bytes_per_texel;
+  int x1 = Clamp(static_cast<int>(x_floor) + 1, width - 1) * bytes_per_texel;
+  const uint8_t* row0 =
+      plane + Clamp(static_cast<int>(y_floor), height - 1) * pitch + offset;
+  const uint8_t* row1 =
+      plane + Clamp(static_cast<int>(y_floor) + 1, height - 1) * pitch +
+      offset;
+  return Lerp(Lerp(row0[x0], row0[x1], fx), Lerp(row1[x0], row1[x1], fx),
+              fy) *
+         (1.0f / 255.0f);
+}
+
+// BT.601 limited range, what drivers use for external NV12 textures.
+static void SampleNV12(const SWImage& image, float u, float v, SWSpan* span,
+                       size_t i) {
+  int width = image.GetWidth();
+  int height = image.GetHeight();
+  int chroma_width = (width + 1) / 2;
+  int chroma_height = (height + 1) / 2;
+  float y = SampleByte(image.GetPlane(0), image.GetPitch(0), width, height, 1,
+                       0, u, v);
+  float cu = (u + 0.5f) * 0.5f - 0.5f;
+  float cv = (v + 0.5f) * 0.5f - 0.5f;
+  float cb = SampleByte(image.GetPlane(1), image.GetPitch(1), chroma_width,
+                        chroma_height, 2, 0, cu, cv) -
+             0.5f;
+  float cr = SampleByte(image.GetPlane(1), image.GetPitch(1), chroma_width,
+                        chroma_height, 2, 1, cu, cv) -
+             0.5f;
+  float luma = 1.164f * (y - 16.0f / 255.0f);
+  span->r[i] = std::min(std::max(luma + 1.596f * cr, 0.0f), 1.0f);
+  span->g[i] =
+      std::min(std::max(luma - 0.391f * cb - 0.813f * cr, 0.0f), 1.0f);
+  span->b[i] = std::min(std::max(luma + 2.018f * cb, 0.0f), 1.0f);
+  span->a[i] = 1.0f;
+}
+
+SWRenderer::~SWRenderer() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    exit_ = true;
+  }
+
+  work_cond_.notify_all();
+  for (std::thread& worker : workers_)
+    worker.join();
+}
+
+bool SWRenderer::Init() {
+  kernels_ = &GetSWKernels();
+  unsigned threads = std::thread::hardware_concurrency();
+  if (threads > kMaxThreads)
+    threads = kMaxThreads;
+
+  for (unsigned i = 1; i < threads; i++)
+    workers_.emplace_back(&SWRenderer::WorkerRoutine, this);
+
+  ITRACE("Software renderer using %s kernels and %zu threads",
+         kernels_->name, workers_.size() + 1);
+  return true;
+}
+
+void SWRenderer::PrecompilePrograms() {
+}
+
+bool SWRenderer::Draw(const std::vector<RenderState>& render_states,
+                      NativeSurface* surface) {
+  if (!surface->MakeCurrent())
+    return false;
+
+  int kms_fence = surface->ReleaseKMSFence();
+  if (kms_fence > 0)
+    InsertFence(kms_fence);
+
+  const SWImage& target = static_cast<SWSurface*>(surface)->GetImage();
+  bool swap_rb;
+  bool has_alpha;
+  if (!GetRGBLayout(target.GetFormat(), &swap_rb, &has_alpha)) {
+    uint32_t format = target.GetFormat();
+    ETRACE("Can't render to buffers of format %4.4s", (char*)&format);
+    return false;
+  }
+
+  // Display may still be showing the target of an earlier frame.
+  if (kms_fence_) {
+    HWCPoll(kms_fence_.get(), kFenceTimeoutMs);
+    kms_fence_.Reset(-1);
+  }
+
+  HwcRect<int> target_rect(0, 0, target.GetWidth(), target.GetHeight());
+  target_ = &target;
+  target.BeginAccess(true);
+
+  // Same as for GL, only the damaged area not covered by
+  // regions needs to be cleared.
+  clear_rects_.assign(1, IntersectRect(surface->GetSurfaceDamage(),
+                                       target_rect));
+  tasks_.clear();
+  sources_.clear();
+  for (const RenderState& state : render_states) {
+    if (state.layer_state_.empty())
+      break;
+
+    HwcRect<int> region(state.x_, state.y_, state.x_ + state.width_,
+                        state.y_ + state.height_);
+    SubtractRect(region, clear_rects_);
+    region = IntersectRect(region, target_rect);
+    for (int top = region.top; top < region.bottom; top += kBandHeight) {
+      int bottom = std::min(top + kBandHeight, region.bottom);
+      tasks_.emplace_back(Task{&state, top, bottom});
+    }
+
+    for (const RenderState::LayerState& layer : state.layer_state_) {
+      if (std::find(sources_.begin(), sources_.end(), layer.handle_) ==
+          sources_.end())
+        sources_.emplace_back(layer.handle_);
+    }
+  }
+
+  for (const HwcRect<int>& rect : clear_rects_) {
+    uint8_t* plane = target.GetPlane(0);
+    size_t size = (rect.right - rect.left) * sizeof(uint32_t);
+    for (int y = rect.top; y < rect.bottom; y++)
+      memset(plane + y * target.GetPitch(0) + rect.left * sizeof(uint32_t), 0,
+             size);
+  }
+
+  for (const SWImage* source : sources_)
+    source->BeginAccess(false);
+
+  next_task_ = 0;
+  if (!workers_.empty() && tasks_.size() > 1) {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      generation_++;
+      done_workers_ = 0;
+    }
+
+    work_cond_.notify_all();
+    RunTasks();
+    std::unique_lock<std::mutex> lock(lock_);
+    done_cond_.wait(lock, [this] { return done_workers_ == workers_.size(); });
+  } else {
+    RunTasks();
+  }
+
+  for (const SWImage* source : sources_)
+    source->EndAccess(false);
+
+  target.EndAccess(true);
+  target_ = NULL;
+  return true;
+}
+
+void SWRenderer::WorkerRoutine() {
+  uint32_t generation = 0;
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    work_cond_.wait(lock,
+                    [&] { return exit_ || generation != generation_; });
+    if (exit_)
+      return;
+
+    generation = generation_;
+    lock.unlock();
+    RunTasks();
+    lock.lock();
+    done_workers_++;
+    if (done_workers_ == workers_.size())
+      done_cond_.notify_one();
+  }
+}
+
+void SWRenderer::RunTasks() {
+  size_t count = tasks_.size();
+  for (size_t index = next_task_++; index < count; index = next_task_++)
+    DrawTask(tasks_[index]);
+}
+
+void SWRenderer::DrawTask(const Task& task) const {
+  const RenderState& state = *task.state;
+  bool swap_rb;
+  bool has_alpha;
+  GetRGBLayout(target_->GetFormat(), &swap_rb, &has_alpha);
+  int left = std::max(static_cast<int>(state.x_), 0);
+  int right = std::min(static_cast<int>(state.x_ + state.width_),
+                       static_cast<int>(target_->GetWidth()));
+  SWSpan src;
+  SWSpan dst;
+  for (int y = task.top; y < task.bottom; y++) {
+    uint32_t* row = reinterpret_cast<uint32_t*>(target_->GetPlane(0) +
+                                                y * target_->GetPitch(0));
+    if (state.copy_ && CopyRow(state, left, right, y, row))
+      continue;
+
+    for (int x = left; x < right; x += kSWSpanWidth) {
+      size_t count = std::min<size_t>(kSWSpanWidth, right - x);
+      // Kernels process whole vectors. Padding is treated as
+      // covered, so that it doesn't keep layers below visible.
+      size_t padded = std::min<size_t>((count + 7) & ~7, kSWSpanWidth);
+      for (size_t i = 0; i < padded; i++) {
+        dst.r[i] = dst.g[i] = dst.b[i] = 0.0f;
+        dst.a[i] = i < count ? 1.0f : 0.0f;
+        if (i >= count)
+          src.r[i] = src.g[i] = src.b[i] = src.a[i] = 0.0f;
+      }
+
+      for (const RenderState::LayerState& layer : state.layer_state_) {
+        SampleLayer(state, layer, x, y, count, &src);
+        bool visible;
+        if (layer.blending_ == HWCBlending::kBlendingNone) {
+          visible = kernels_->blend_opaque(src, count, &dst);
+        } else if (layer.blending_ == HWCBlending::kBlendingCoverage) {
+          visible = kernels_->blend_coverage(src, layer.alpha_, count, &dst);
+        } else {
+          visible = kernels_->blend_premult(src, layer.alpha_, count, &dst);
+        }
+
+        if (!visible)
+          break;
+      }
+
+      kernels_->store(dst, count, swap_rb, row + x);
+    }
+  }
+}
+
+void SWRenderer::SampleLayer(const RenderState& state,
+                             const RenderState::LayerState& layer, int x,
+                             int y, size_t count, SWSpan* span) const {
+  const SWImage& image = *layer.handle_;
+  float width = image.GetWidth();
+  float height = image.GetHeight();
+  const float* crop = layer.crop_bounds_;
+  const float* matrix = layer.texture_matrix_;
+  float crop_width = crop[2] - crop[0];
+  float crop_height = crop[3] - crop[1];
+  // Texture coordinates of the first pixel center, computed the same
+  // way as by the GL programs, converted to texels relative to texel
+  // centers. They change linearly along the row.
+  float tx = (x + 0.5f - state.x_) / state.width_;
+  float ty = (y + 0.5f - state.y_) / state.height_;
+  float u =
+      (crop[0] + (tx * matrix[0] + ty * matrix[1]) * crop_width) * width -
+      0.5f;
+  float v =
+      (crop[1] + (tx * matrix[2] + ty * matrix[3]) * crop_height) * height -
+      0.5f;
+  float du = matrix[0] / state.width_ * crop_width * width;
+  float dv = matrix[2] / state.width_ * crop_height * height;
+
+  if (image.GetFormat() == DRM_FORMAT_NV12) {
+    for (size_t i = 0; i < count; i++)
+      SampleNV12(image, u + i * du, v + i * dv, span, i);
+
+    return;
+  }
+
+  bool swap_rb;
+  bool has_alpha;
+  GetRGBLayout(image.GetFormat(), &swap_rb, &has_alpha);
+  // Unscaled rows which are not transformed sample texel centers, the
+  // pixels can be converted without filtering.
+  float sx = roundf(u);
+  float sy = roundf(v);
+  if (fabsf(du - 1.0f) < kTexelEpsilon && fabsf(dv) < kTexelEpsilon &&
+      fabsf(u - sx) < kTexelEpsilon && fabsf(v - sy) < kTexelEpsilon &&
+      sx >= 0.0f && sx + count <= width && sy >= 0.0f && sy < height) {
+    const uint32_t* pixels = reinterpret_cast<const uint32_t*>(
+        image.GetPlane(0) + static_cast<int>(sy) * image.GetPitch(0));
+    kernels_->load(pixels + static_cast<int>(sx), count, swap_rb, has_alpha,
+                   span);
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    SampleRGB(image, swap_rb, has_alpha, u + i * du, v + i * dv, span, i);
+}
+
+bool SWRenderer::CopyRow(const RenderState& state, int left, int right,
+                         int y, uint32_t* row) const {
+  const SWImage& image = *state.layer_state_.front().handle_;
+  // Alpha isn't copied, the result needs to be opaque.
+  if (image.GetFormat() != target_->GetFormat() ||
+      (target_->GetFormat() != DRM_FORMAT_XRGB8888 &&
+       target_->GetFormat() != DRM_FORMAT_XBGR8888))
+    return false;
+
+  int sx = state.copy_x_ + left - static_cast<int>(state.x_);
+  int sy = state.copy_y_ + y - static_cast<int>(state.y_);
+  if (sx < 0 || sy < 0 ||
+      sx + right - left > static_cast<int>(image.GetWidth()) ||
+      sy >= static_cast<int>(image.GetHeight()))
+    return false;
+
+  const uint32_t* pixels = reinterpret_cast<const uint32_t*>(
+      image.GetPlane(0) + sy * image.GetPitch(0));
+  memcpy(row + left, pixels + sx, (right - left) * sizeof(uint32_t));
+  return true;
+}
+
+void SWRenderer::InsertFence(uint64_t kms_fence) {
+  if (kms_fence > 0)
+    kms_fence_.Reset(kms_fence);
+}
+
+void SWRenderer::RestoreState() {
+}
+
+bool SWRenderer::MakeCurrent() {
+  return true;
+}
+
+void SWRenderer::SetExplicitSyncSupport(bool /*disable_explicit_sync*/) {
+  // Draw returns once the target is complete, there is no fence to
+  // hand to the display.
+}
+
+}  // namespace hwcomposer
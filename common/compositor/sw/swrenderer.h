@@ -0,0 +1,105 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_COMPOSITOR_SW_SWRENDERER_H_
+#define COMMON_COMPOSITOR_SW_SWRENDERER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <hwcdefs.h>
+#include <nativefence.h>
+
+#include "renderer.h"
+#include "renderstate.h"
+#include "swkernels.h"
+
+namespace hwcomposer {
+
+class SWImage;
+struct SWSpan;
+
+// Composites on the CPU, for systems where the GPU is not usable.
+// Produces the same result as the GL programs for the same render
+// states. Bands of rows are distributed among worker threads.
+class SWRenderer : public Renderer {
+ public:
+  SWRenderer() = default;
+  ~SWRenderer() override;
+
+  bool Init() override;
+  // Nothing to compile, kernels are chosen in Init.
+  void PrecompilePrograms() override;
+  bool Draw(const std::vector<RenderState>& commands,
+            NativeSurface* surface) override;
+
+  void InsertFence(uint64_t kms_fence) override;
+
+  void RestoreState() override;
+
+  bool MakeCurrent() override;
+
+  void SetExplicitSyncSupport(bool disable_explicit_sync) override;
+
+ private:
+  // Rows [top, bottom) of a region, the unit of work of a thread.
+  struct Task {
+    const RenderState* state;
+    int top;
+    int bottom;
+  };
+
+  void WorkerRoutine();
+  // Runs tasks of the current Draw call until none are left.
+  void RunTasks();
+  void DrawTask(const Task& task) const;
+  // Fills span with count pixels of layer, starting at (x, y) of the
+  // target.
+  void SampleLayer(const RenderState& state,
+                   const RenderState::LayerState& layer, int x, int y,
+                   size_t count, SWSpan* span) const;
+  // Copies pixels of a single layer region, returns false in case the
+  // layer can't be copied to the target as is.
+  bool CopyRow(const RenderState& state, int left, int right, int y,
+               uint32_t* row) const;
+
+  const SWKernels* kernels_ = NULL;
+  const SWImage* target_ = NULL;
+  std::vector<Task> tasks_;
+  std::atomic<size_t> next_task_{0};
+  std::vector<std::thread> workers_;
+  std::mutex lock_;
+  std::condition_variable work_cond_;
+  std::condition_variable done_cond_;
+  // Incremented for every Draw call which has tasks for workers.
+  uint32_t generation_ = 0;
+  // Number of workers done with tasks of current generation.
+  size_t done_workers_ = 0;
+  bool exit_ = false;
+  // Parts of the surface which need to be cleared in Draw.
+  std::vector<HwcRect<int>> clear_rects_;
+  // Buffers sampled by the current Draw call.
+  std::vector<const SWImage*> sources_;
+  // Out fence of the last commit, target may still be scanned out
+  // until it signals.
+  NativeFence kms_fence_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_COMPOSITOR_SW_SWRENDERER_H_
@@ -0,0 +1,43 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "swsurface.h"
+
+#include "hwctrace.h"
+#include "overlaybuffer.h"
+
+namespace hwcomposer {
+
+SWSurface::SWSurface(uint32_t width, uint32_t height)
+    : NativeSurface(width, height) {
+}
+
+SWSurface::~SWSurface() {
+}
+
+bool SWSurface::MakeCurrent() {
+  if (image_.IsMapped())
+    return true;
+
+  if (!image_.Map(layer_.GetBuffer())) {
+    ETRACE("Failed to map surface buffer.");
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace hwcomposer
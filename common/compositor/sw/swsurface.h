@@ -0,0 +1,44 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_COMPOSITOR_SW_SWSURFACE_H_
+#define COMMON_COMPOSITOR_SW_SWSURFACE_H_
+
+#include "nativesurface.h"
+
+#include "swimage.h"
+
+namespace hwcomposer {
+
+class SWSurface : public NativeSurface {
+ public:
+  SWSurface() = default;
+  ~SWSurface() override;
+  SWSurface(uint32_t width, uint32_t height);
+
+  // Maps the surface buffer on first use.
+  bool MakeCurrent() override;
+
+  const SWImage& GetImage() const {
+    return image_;
+  }
+
+ private:
+  SWImage image_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_COMPOSITOR_SW_SWSURFACE_H_
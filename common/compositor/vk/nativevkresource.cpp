@@ -21,17 +21,20 @@
 namespace hwcomposer {
 
 bool NativeVKResource::PrepareResources(
-    const std::vector<OverlayLayer>& layers) {
+    const std::vector<OverlayLayer>& layers,
+    const std::vector<size_t>& source_layers) {
   VkResult res;
 
   Reset();
+  layer_textures_.resize(layers.size());
 
   VkImageSubresourceRange clear_range = {};
   clear_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   clear_range.levelCount = 1;
   clear_range.layerCount = 1;
 
-  for (auto& layer : layers) {
+  for (size_t layer_index : source_layers) {
+    const OverlayLayer& layer = layers.at(layer_index);
     struct vk_import import = layer.GetBuffer()->ImportImage(dev_);
     if (import.res != VK_SUCCESS) {
       ETRACE("Failed to make import image (%d)\n", import.res);
@@ -78,7 +81,8 @@ bool NativeVKResource::PrepareResources(
     struct vk_resource resource;
     resource.image = import.image;
     resource.image_view = image_view;
-    layer_textures_.emplace_back(resource);
+    resource.format = layer.GetBuffer()->GetFormat();
+    layer_textures_.at(layer_index) = resource;
   }
   return true;
 }
@@ -87,21 +91,18 @@ NativeVKResource::~NativeVKResource() {
   Reset();
 }
 
-void NativeVKResource::Reset() {
-  for (auto& image_view : src_image_views_) {
-    vkDestroyImageView(dev_, image_view, NULL);
-  }
-  src_image_views_.clear();
-
-  for (auto& image : src_images_) {
-    vkDestroyImage(dev_, image, NULL);
-  }
-  src_images_.clear();
+void NativeVKResource::ReleaseGPUResources() {
+  Reset();
+}
 
-  for (auto& memory : src_image_memory_) {
-    vkFreeMemory(dev_, memory, NULL);
-  }
-  src_image_memory_.clear();
+// Frames which sample the images may still be in flight, the
+// renderer destroys them once those have completed.
+void NativeVKResource::Reset() {
+  VKRetiredResources retired;
+  retired.image_views.swap(src_image_views_);
+  retired.images.swap(src_images_);
+  retired.memory.swap(src_image_memory_);
+  retired_resources_.Append(retired);
 
   src_barrier_before_clear_.clear();
   layer_textures_.clear();
@@ -109,7 +110,7 @@ void NativeVKResource::Reset() {
 
 GpuResourceHandle NativeVKResource::GetResourceHandle(
     uint32_t layer_index) const {
-  if (layer_textures_.size() < layer_index) {
+  if (layer_textures_.size() <= layer_index) {
     struct vk_resource res = {};
     return res;
   }
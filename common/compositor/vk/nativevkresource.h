@@ -27,8 +27,10 @@ class NativeVKResource : public NativeGpuResource {
   NativeVKResource() = default;
   ~NativeVKResource() override;
 
-  bool PrepareResources(const std::vector<OverlayLayer>& layers) override;
+  bool PrepareResources(const std::vector<OverlayLayer>& layers,
+                        const std::vector<size_t>& source_layers) override;
   GpuResourceHandle GetResourceHandle(uint32_t layer_index) const override;
+  void ReleaseGPUResources() override;
 
  private:
   void Reset();
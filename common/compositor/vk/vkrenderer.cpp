@@ -15,13 +15,48 @@
 #include "vkrenderer.h"
 #include "vkprogram.h"
 
+#include <drm_fourcc.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
 #include "hwctrace.h"
+#include "hwcutils.h"
 #include "nativesurface.h"
 #include "renderstate.h"
 
 namespace hwcomposer {
 
 VKRenderer::~VKRenderer() {
+  if (dev_ == VK_NULL_HANDLE)
+    return;
+
+  for (Frame &frame : frames_) {
+    if (frame.submitted)
+      vkWaitForFences(dev_, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+
+    frame.ub_allocs.clear();
+    frame.retired.Destroy();
+    vkDestroyDescriptorPool(dev_, frame.desc_pool, NULL);
+    vkDestroyFence(dev_, frame.fence, NULL);
+    vkDestroySemaphore(dev_, frame.semaphore, NULL);
+  }
+
+  // Nothing is in flight anymore.
+  retired_resources_.Destroy();
+  vkDestroySemaphore(dev_, wait_semaphore_, NULL);
+}
+
+static bool HasExtension(const std::vector<VkExtensionProperties> &extensions,
+                         const char *name) {
+  for (const VkExtensionProperties &extension : extensions) {
+    if (!strcmp(extension.extensionName, name))
+      return true;
+  }
+
+  return false;
 }
 
 VKAPI_ATTR VkBool32 VKAPI_CALL VulkanDebugReportCallback(
@@ -202,10 +237,27 @@ bool VKRenderer::Init() {
 
   const char *enabled_layers[] = {};
 
-  const char *instance_extensions[] = {
+  std::vector<const char *> instance_extensions = {
       VK_KHR_SURFACE_EXTENSION_NAME, VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
   };
 
+  // Needed to export completion of a frame as sync_file.
+  uint32_t count = 0;
+  vkEnumerateInstanceExtensionProperties(NULL, &count, NULL);
+  std::vector<VkExtensionProperties> extensions(count);
+  vkEnumerateInstanceExtensionProperties(NULL, &count, extensions.data());
+  bool has_semaphore_capabilities =
+      HasExtension(extensions,
+                   VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) &&
+      HasExtension(extensions,
+                   VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME);
+  if (has_semaphore_capabilities) {
+    instance_extensions.emplace_back(
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    instance_extensions.emplace_back(
+        VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME);
+  }
+
   VkApplicationInfo app_info = {};
   app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
   app_info.apiVersion = VK_MAKE_VERSION(1, 0, 0);
@@ -215,8 +267,8 @@ bool VKRenderer::Init() {
   instance_create.pApplicationInfo = &app_info;
   instance_create.enabledLayerCount = ARRAY_SIZE(enabled_layers);
   instance_create.ppEnabledLayerNames = &enabled_layers[0];
-  instance_create.enabledExtensionCount = ARRAY_SIZE(instance_extensions);
-  instance_create.ppEnabledExtensionNames = &instance_extensions[0];
+  instance_create.enabledExtensionCount = instance_extensions.size();
+  instance_create.ppEnabledExtensionNames = instance_extensions.data();
 
   res = vkCreateInstance(&instance_create, NULL, &inst_);
   if (res != VK_SUCCESS) {
@@ -241,7 +293,6 @@ bool VKRenderer::Init() {
     ETRACE("Failed to create vulkan debug callback\n");
   }
 
-  uint32_t count;
   res = vkEnumeratePhysicalDevices(inst_, &count, NULL);
   if (res != VK_SUCCESS) {
     ETRACE("vkEnumeratePhysicalDevices failed (%d)\n", res);
@@ -280,7 +331,21 @@ bool VKRenderer::Init() {
   queue_create.queueCount = 1;
   queue_create.pQueuePriorities = &queue_priority;
 
-  const char *device_extensions[] = {};
+  std::vector<const char *> device_extensions;
+  count = 0;
+  vkEnumerateDeviceExtensionProperties(phys_dev, NULL, &count, NULL);
+  extensions.resize(count);
+  vkEnumerateDeviceExtensionProperties(phys_dev, NULL, &count,
+                                       extensions.data());
+  sync_fd_supported_ =
+      has_semaphore_capabilities &&
+      HasExtension(extensions, VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME) &&
+      HasExtension(extensions, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME);
+  if (sync_fd_supported_) {
+    device_extensions.emplace_back(VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME);
+    device_extensions.emplace_back(
+        VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME);
+  }
 
   VkDeviceCreateInfo device_create = {};
   device_create.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -288,8 +353,8 @@ bool VKRenderer::Init() {
   device_create.pQueueCreateInfos = &queue_create;
   device_create.enabledLayerCount = ARRAY_SIZE(enabled_layers);
   device_create.ppEnabledLayerNames = &enabled_layers[0];
-  device_create.enabledExtensionCount = ARRAY_SIZE(device_extensions);
-  device_create.ppEnabledExtensionNames = &device_extensions[0];
+  device_create.enabledExtensionCount = device_extensions.size();
+  device_create.ppEnabledExtensionNames = device_extensions.data();
 
   res = vkCreateDevice(phys_dev, &device_create, NULL, &dev_);
   if (res != VK_SUCCESS) {
@@ -304,8 +369,18 @@ bool VKRenderer::Init() {
 
   vkGetDeviceQueue(dev_, 0, 0, &queue_);
 
+  if (sync_fd_supported_) {
+    get_semaphore_fd_ = (PFN_vkGetSemaphoreFdKHR)vkGetDeviceProcAddr(
+        dev_, "vkGetSemaphoreFdKHR");
+    import_semaphore_fd_ = (PFN_vkImportSemaphoreFdKHR)vkGetDeviceProcAddr(
+        dev_, "vkImportSemaphoreFdKHR");
+    sync_fd_supported_ = get_semaphore_fd_ && import_semaphore_fd_;
+  }
+
+  // Command buffers of a frame are re-recorded every time it is used.
   VkCommandPoolCreateInfo pool_create = {};
   pool_create.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_create.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
   res = vkCreateCommandPool(dev_, &pool_create, NULL, &cmd_pool_);
   if (res != VK_SUCCESS) {
@@ -383,17 +458,45 @@ bool VKRenderer::Init() {
 
   VkDescriptorPoolCreateInfo desc_pool_create = {};
   desc_pool_create.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  desc_pool_create.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
   desc_pool_create.maxSets = 256;
   desc_pool_create.poolSizeCount = ARRAY_SIZE(pool_sizes);
   desc_pool_create.pPoolSizes = &pool_sizes[0];
 
-  res = vkCreateDescriptorPool(dev_, &desc_pool_create, NULL, &desc_pool_);
-  if (res != VK_SUCCESS) {
-    ETRACE("vkCreateDescriptorPool failed (%d)\n", res);
-    return false;
+  VkCommandBufferAllocateInfo cmd_buffer_alloc = {};
+  cmd_buffer_alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  cmd_buffer_alloc.commandPool = cmd_pool_;
+  cmd_buffer_alloc.commandBufferCount = 1;
+
+  VkFenceCreateInfo fence_create = {};
+  fence_create.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+  for (Frame &frame : frames_) {
+    res = vkCreateDescriptorPool(dev_, &desc_pool_create, NULL,
+                                 &frame.desc_pool);
+    if (res != VK_SUCCESS) {
+      ETRACE("vkCreateDescriptorPool failed (%d)\n", res);
+      return false;
+    }
+
+    res = vkAllocateCommandBuffers(dev_, &cmd_buffer_alloc, &frame.cmd_buffer);
+    if (res != VK_SUCCESS) {
+      ETRACE("vkAllocateCommandBuffer failed (%d)\n", res);
+      return false;
+    }
+
+    res = vkCreateFence(dev_, &fence_create, NULL, &frame.fence);
+    if (res != VK_SUCCESS) {
+      ETRACE("vkCreateFence failed (%d)\n", res);
+      return false;
+    }
+
+    if (sync_fd_supported_ && !CreateSemaphore(true, &frame.semaphore))
+      return false;
   }
 
+  if (sync_fd_supported_ && !CreateSemaphore(false, &wait_semaphore_))
+    return false;
+
   VkSamplerCreateInfo sampler_create = {};
   sampler_create.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
   sampler_create.magFilter = VK_FILTER_LINEAR;
@@ -452,8 +555,15 @@ bool VKRenderer::Init() {
     return false;
   }
 
+  // Pipelines created by an earlier run are loaded from disk. The
+  // driver checks the header of the data and ignores it if the data
+  // was produced by another device or driver version.
+  std::vector<uint8_t> pipeline_cache_data;
+  program_cache_.Load(GetPipelineCacheKey(), &pipeline_cache_data);
   VkPipelineCacheCreateInfo pipeline_cache_create = {};
   pipeline_cache_create.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_create.initialDataSize = pipeline_cache_data.size();
+  pipeline_cache_create.pInitialData = pipeline_cache_data.data();
 
   res = vkCreatePipelineCache(dev_, &pipeline_cache_create, NULL,
                               &pipeline_cache_);
@@ -465,12 +575,98 @@ bool VKRenderer::Init() {
   return true;
 }
 
+void VKRenderer::PrecompilePrograms() {
+  for (unsigned layer_count = 1; layer_count <= kPrecompiledLayerCount;
+       layer_count++)
+    GetProgram(layer_count);
+}
+
+std::string VKRenderer::GetPipelineCacheKey() const {
+  char uuid[2 * VK_UUID_SIZE + 1];
+  for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+    snprintf(uuid + 2 * i, 3, "%02x", device_props_.pipelineCacheUUID[i]);
+
+  char ids[64];
+  snprintf(ids, sizeof(ids), "%x:%x:%x", device_props_.vendorID,
+           device_props_.deviceID, device_props_.driverVersion);
+  return std::string("vkpipelinecache\n") + device_props_.deviceName + "\n" +
+         ids + "\n" + uuid;
+}
+
+void VKRenderer::StorePipelineCache() {
+  size_t size = 0;
+  VkResult res = vkGetPipelineCacheData(dev_, pipeline_cache_, &size, NULL);
+  if (res != VK_SUCCESS || !size)
+    return;
+
+  std::vector<uint8_t> data(size);
+  res = vkGetPipelineCacheData(dev_, pipeline_cache_, &size, data.data());
+  if (res != VK_SUCCESS) {
+    ETRACE("vkGetPipelineCacheData failed (%d)\n", res);
+    return;
+  }
+
+  data.resize(size);
+  program_cache_.Store(GetPipelineCacheKey(), data);
+}
+
+bool VKRenderer::CreateSemaphore(bool exportable, VkSemaphore *semaphore) {
+  VkExportSemaphoreCreateInfoKHR export_create = {};
+  export_create.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO_KHR;
+  export_create.handleTypes =
+      VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT_KHR;
+
+  VkSemaphoreCreateInfo semaphore_create = {};
+  semaphore_create.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  if (exportable)
+    semaphore_create.pNext = &export_create;
+
+  VkResult res = vkCreateSemaphore(dev_, &semaphore_create, NULL, semaphore);
+  if (res != VK_SUCCESS) {
+    ETRACE("vkCreateSemaphore failed (%d)\n", res);
+    return false;
+  }
+
+  return true;
+}
+
+VKRenderer::Frame *VKRenderer::BeginFrame() {
+  Frame &frame = frames_[frame_index_];
+  frame_index_ = (frame_index_ + 1) % kFramesInFlight;
+  if (frame.submitted) {
+    // Only blocks when the GPU is kFramesInFlight frames behind.
+    VkResult res =
+        vkWaitForFences(dev_, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+    if (res != VK_SUCCESS) {
+      ETRACE("vkWaitForFences failed (%d)\n", res);
+      return NULL;
+    }
+
+    vkResetFences(dev_, 1, &frame.fence);
+    frame.retired.Destroy();
+    frame.submitted = false;
+  }
+
+  // Also cleans up after a Draw which failed before submitting.
+  vkResetDescriptorPool(dev_, frame.desc_pool, 0);
+  frame.ub_allocs.clear();
+  return &frame;
+}
+
 bool VKRenderer::Draw(const std::vector<RenderState> &render_states,
                       NativeSurface *surface) {
   VkResult res;
   uint32_t frame_width = surface->GetWidth();
   uint32_t frame_height = surface->GetHeight();
+  uint32_t target_format = surface->GetLayer()->GetBuffer()->GetFormat();
   surface->MakeCurrent();
+  int kms_fence = surface->ReleaseKMSFence();
+  if (kms_fence > 0)
+    InsertFence(kms_fence);
+
+  Frame *frame = BeginFrame();
+  if (!frame)
+    return false;
 
   src_image_infos_.clear();
   ub_allocs_.clear();
@@ -496,7 +692,7 @@ bool VKRenderer::Draw(const std::vector<RenderState> &render_states,
 
   VkDescriptorSetAllocateInfo alloc_desc_set = {};
   alloc_desc_set.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  alloc_desc_set.descriptorPool = desc_pool_;
+  alloc_desc_set.descriptorPool = frame->desc_pool;
   alloc_desc_set.descriptorSetCount = (uint32_t)desc_layouts.size();
   alloc_desc_set.pSetLayouts = desc_layouts.data();
 
@@ -546,18 +742,7 @@ bool VKRenderer::Draw(const std::vector<RenderState> &render_states,
   vkUpdateDescriptorSets(dev_, write_desc_sets.size(), write_desc_sets.data(),
                          0, NULL);
 
-  VkCommandBufferAllocateInfo cmd_buffer_alloc = {};
-  cmd_buffer_alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  cmd_buffer_alloc.commandPool = cmd_pool_;
-  cmd_buffer_alloc.commandBufferCount = 1;
-
-  VkCommandBuffer cmd_buffer;
-  res = vkAllocateCommandBuffers(dev_, &cmd_buffer_alloc, &cmd_buffer);
-  if (res != VK_SUCCESS) {
-    ETRACE("vkAllocateCommandBuffer failed (%d)\n", res);
-    return false;
-  }
-
+  VkCommandBuffer cmd_buffer = frame->cmd_buffer;
   VkCommandBufferBeginInfo begin_info = {};
   begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
   begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
@@ -586,11 +771,16 @@ bool VKRenderer::Draw(const std::vector<RenderState> &render_states,
   clear_value[0].color.float32[2] = 0.0f;
   clear_value[0].color.float32[3] = 0.0f;
 
+  // Render pass clears only the render area, content outside
+  // of the damaged area is still valid.
+  const HwcRect<int> &damage = surface->GetSurfaceDamage();
   VkExtent2D extent = {};
-  extent.width = frame_width;
-  extent.height = frame_height;
+  extent.width = damage.right - damage.left;
+  extent.height = damage.bottom - damage.top;
 
   VkRect2D rect = {};
+  rect.offset.x = damage.left;
+  rect.offset.y = damage.top;
   rect.extent = extent;
 
   VkRenderPassBeginInfo pass_begin = {};
@@ -615,10 +805,15 @@ bool VKRenderer::Draw(const std::vector<RenderState> &render_states,
   vkCmdBindVertexBuffers(cmd_buffer, 0, 1, &vert_buffer_, &zero_offset);
 
   size_t last_layer_count = 0;
+  bool has_copies = false;
   for (size_t cmd_index = 0; cmd_index < render_states.size(); cmd_index++) {
     const RenderState &state = render_states[cmd_index];
     size_t layer_count = state.layer_state_.size();
     VkDescriptorSet desc_set = desc_sets[cmd_index];
+    if (CanCopy(state, target_format)) {
+      has_copies = true;
+      continue;
+    }
 
     VkRect2D scissor = {};
     scissor.offset = {
@@ -646,6 +841,11 @@ bool VKRenderer::Draw(const std::vector<RenderState> &render_states,
 
   vkCmdEndRenderPass(cmd_buffer);
 
+  // Copies are done after the render pass so that its clear doesn't
+  // overwrite them, all in one batch.
+  if (has_copies)
+    RecordCopies(cmd_buffer, render_states, target_format);
+
   res = vkEndCommandBuffer(cmd_buffer);
   if (res != VK_SUCCESS) {
     ETRACE("vkEndCommandBuffer failed (%d)\n", res);
@@ -657,31 +857,206 @@ bool VKRenderer::Draw(const std::vector<RenderState> &render_states,
   submit.commandBufferCount = 1;
   submit.pCommandBuffers = &cmd_buffer;
 
-  res = vkQueueSubmit(queue_, 1, &submit, VK_NULL_HANDLE);
+  // Target may still be scanned out, wait for the KMS fences
+  // passed to InsertFence before writing to it.
+  ConsumeWaitFence();
+  VkPipelineStageFlags wait_stage =
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+      VK_PIPELINE_STAGE_TRANSFER_BIT;
+  if (wait_pending_) {
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = &wait_semaphore_;
+    submit.pWaitDstStageMask = &wait_stage;
+  }
+
+  bool export_fence = sync_fd_supported_ && !disable_explicit_sync_;
+  if (export_fence) {
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &frame->semaphore;
+  }
+
+  res = vkQueueSubmit(queue_, 1, &submit, frame->fence);
   if (res != VK_SUCCESS) {
     ETRACE("%d: vkQueueSubmit failed (%d)\n", __LINE__, res);
     return false;
   }
 
-  res = vkQueueWaitIdle(queue_);
-  if (res != VK_SUCCESS) {
-    ETRACE("vkQueueWaitIdle failed (%d)\n", res);
-    return false;
+  wait_pending_ = false;
+  frame->submitted = true;
+  frame->ub_allocs.swap(ub_allocs_);
+  // Queue executes in order, whatever was retired before this
+  // frame is unused once it has completed.
+  frame->retired.Append(retired_resources_);
+
+  int sync_fd = -1;
+  if (export_fence) {
+    VkSemaphoreGetFdInfoKHR get_fd = {};
+    get_fd.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+    get_fd.semaphore = frame->semaphore;
+    get_fd.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT_KHR;
+    res = get_semaphore_fd_(dev_, &get_fd, &sync_fd);
+    if (res != VK_SUCCESS) {
+      ETRACE("vkGetSemaphoreFdKHR failed (%d)\n", res);
+      // Semaphore stays signalled, replace it once the GPU is done.
+      vkQueueWaitIdle(queue_);
+      vkDestroySemaphore(dev_, frame->semaphore, NULL);
+      frame->semaphore = VK_NULL_HANDLE;
+      if (!CreateSemaphore(true, &frame->semaphore))
+        sync_fd_supported_ = false;
+
+      sync_fd = -1;
+    }
   }
 
-  vkFreeCommandBuffers(dev_, cmd_pool_, 1, &cmd_buffer);
+  if (sync_fd < 0) {
+    // Without a sync_file the frame needs to be complete
+    // before the target is handed over to KMS.
+    res = vkWaitForFences(dev_, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+    if (res != VK_SUCCESS) {
+      ETRACE("vkWaitForFences failed (%d)\n", res);
+      return false;
+    }
+  } else {
+    surface->SetNativeFence(sync_fd);
+  }
 
-  res = vkFreeDescriptorSets(dev_, desc_pool_, desc_sets.size(),
-                             desc_sets.data());
-  if (res != VK_SUCCESS) {
-    ETRACE("vkFreeDescriptorSets failed (%d)\n", res);
+  return true;
+}
+
+bool VKRenderer::CanCopy(const RenderState &state,
+                         uint32_t target_format) const {
+  if (!state.copy_)
     return false;
+
+  // Blit copies alpha, or the undefined X byte, as is. Only use it
+  // when the target ignores alpha and the formats match, other
+  // states are drawn so that the result is opaque.
+  return state.layer_state_.front().handle_.format == target_format &&
+         (target_format == DRM_FORMAT_XRGB8888 ||
+          target_format == DRM_FORMAT_XBGR8888);
+}
+
+void VKRenderer::RecordCopies(VkCommandBuffer cmd_buffer,
+                              const std::vector<RenderState> &render_states,
+                              uint32_t target_format) {
+  std::vector<VkImageMemoryBarrier> barriers;
+  VkImageMemoryBarrier dst_barrier = dst_barrier_before_clear_;
+  dst_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dst_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  dst_barrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  dst_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers.emplace_back(dst_barrier);
+
+  for (const RenderState &state : render_states) {
+    if (!CanCopy(state, target_format))
+      continue;
+
+    VkImage image = state.layer_state_.front().handle_.image;
+    auto it = std::find_if(barriers.begin(), barriers.end(),
+                           [image](const VkImageMemoryBarrier &barrier) {
+                             return barrier.image == image;
+                           });
+    if (it != barriers.end())
+      continue;
+
+    VkImageMemoryBarrier src_barrier = dst_barrier;
+    src_barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    src_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    src_barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    src_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    src_barrier.image = image;
+    barriers.emplace_back(src_barrier);
   }
 
-  return true;
+  vkCmdPipelineBarrier(cmd_buffer,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL,
+                       barriers.size(), barriers.data());
+
+  for (const RenderState &state : render_states) {
+    if (!CanCopy(state, target_format))
+      continue;
+
+    // Layers are neither scaled nor transformed, blit is only
+    // used to convert between RGB formats.
+    VkImageBlit blit = {};
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.layerCount = 1;
+    blit.srcOffsets[0] = {state.copy_x_, state.copy_y_, 0};
+    blit.srcOffsets[1] = {state.copy_x_ + (int32_t)state.width_,
+                          state.copy_y_ + (int32_t)state.height_, 1};
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstOffsets[0] = {(int32_t)state.x_, (int32_t)state.y_, 0};
+    blit.dstOffsets[1] = {(int32_t)(state.x_ + state.width_),
+                          (int32_t)(state.y_ + state.height_), 1};
+    vkCmdBlitImage(cmd_buffer, state.layer_state_.front().handle_.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst_barrier.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_NEAREST);
+  }
+
+  // Return images to the layouts the render pass left them in.
+  for (VkImageMemoryBarrier &barrier : barriers) {
+    std::swap(barrier.oldLayout, barrier.newLayout);
+    std::swap(barrier.srcAccessMask, barrier.dstAccessMask);
+  }
+
+  vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0,
+                       NULL, barriers.size(), barriers.data());
 }
 
 void VKRenderer::InsertFence(uint64_t kms_fence) {
+  if (kms_fence <= 0)
+    return;
+
+  int fd = static_cast<int>(kms_fence);
+  if (wait_fence_.get() <= 0) {
+    wait_fence_.Reset(fd);
+    return;
+  }
+
+  // Several displays can insert fences before the next Draw, the
+  // submission needs to wait for all of them.
+  int merged = sync_merge("VKRenderer", wait_fence_.get(), fd);
+  if (merged < 0) {
+    ETRACE("Failed to merge KMS fences %s", PRINTERROR());
+    HWCPoll(fd, -1);
+    close(fd);
+    return;
+  }
+
+  close(fd);
+  wait_fence_.Reset(merged);
+}
+
+void VKRenderer::ConsumeWaitFence() {
+  if (wait_fence_.get() <= 0)
+    return;
+
+  if (sync_fd_supported_ && !wait_pending_) {
+    // Temporary import, semaphore reverts to its own payload
+    // once the next submission has waited on it.
+    VkImportSemaphoreFdInfoKHR import = {};
+    import.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+    import.semaphore = wait_semaphore_;
+    import.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT_KHR;
+    import.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT_KHR;
+    import.fd = wait_fence_.get();
+    VkResult res = import_semaphore_fd_(dev_, &import);
+    if (res == VK_SUCCESS) {
+      // Semaphore owns fd now.
+      wait_fence_.Release();
+      wait_pending_ = true;
+      return;
+    }
+
+    ETRACE("vkImportSemaphoreFdKHR failed (%d)\n", res);
+  }
+
+  HWCPoll(wait_fence_.get(), -1);
+  wait_fence_.Reset(-1);
 }
 
 void VKRenderer::RestoreState() {
@@ -692,6 +1067,7 @@ bool VKRenderer::MakeCurrent() {
 }
 
 void VKRenderer::SetExplicitSyncSupport(bool disable_explicit_sync) {
+  disable_explicit_sync_ = disable_explicit_sync;
 }
 
 VKProgram *VKRenderer::GetProgram(unsigned texture_count) {
@@ -707,6 +1083,8 @@ VKProgram *VKRenderer::GetProgram(unsigned texture_count) {
       programs_.resize(texture_count);
 
     programs_[texture_count - 1] = std::move(program);
+    // Pipelines are rarely created, keep the cache on disk in sync.
+    StorePipelineCache();
     return programs_[texture_count - 1].get();
   }
 
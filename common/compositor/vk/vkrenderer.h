@@ -15,8 +15,12 @@
 #ifndef VK_RENDERER_H_
 #define VK_RENDERER_H_
 
+#include <scopedfd.h>
+
 #include <memory>
+#include <string>
 
+#include "programbinarycache.h"
 #include "renderer.h"
 #include "vkprogram.h"
 #include "vkshim.h"
@@ -29,6 +33,10 @@ class VKRenderer : public Renderer {
   ~VKRenderer();
 
   bool Init() override;
+  // Creates the pipelines for up to kPrecompiledLayerCount layers.
+  // Pipeline cache is stored on disk, so this is cheap after the
+  // first run.
+  void PrecompilePrograms() override;
   bool Draw(const std::vector<RenderState> &commands,
             NativeSurface *surface) override;
   void InsertFence(uint64_t kms_fence) override;
@@ -37,7 +45,43 @@ class VKRenderer : public Renderer {
   void SetExplicitSyncSupport(bool disable_explicit_sync) override;
 
  private:
+  static const unsigned kPrecompiledLayerCount = 4;
+  static const unsigned kFramesInFlight = 3;
+
+  // Objects used to record and submit one frame. Frames are used
+  // round robin, a frame is recycled once its fence has signalled.
+  struct Frame {
+    VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+    VkDescriptorPool desc_pool = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    // Signalled together with fence, exported as sync_file.
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    bool submitted = false;
+    std::vector<RingBuffer::Allocation> ub_allocs;
+    VKRetiredResources retired;
+  };
+
+  // Returns the next frame, waiting for the GPU to finish
+  // with it if needed.
+  Frame *BeginFrame();
+  bool CreateSemaphore(bool exportable, VkSemaphore *semaphore);
+  // Makes the next submission wait for wait_fence_, through
+  // wait_semaphore_ if possible, else by waiting on the CPU.
+  void ConsumeWaitFence();
+
   VKProgram *GetProgram(unsigned texture_count);
+  // Pipeline cache data is only valid for the device and driver
+  // version which produced it.
+  std::string GetPipelineCacheKey() const;
+  void StorePipelineCache();
+  // Returns true if state can be blitted to a target of target_format
+  // instead of being drawn.
+  bool CanCopy(const RenderState &state, uint32_t target_format) const;
+  // Records blits of all RenderStates for which CanCopy is true.
+  // Called after the render pass has ended.
+  void RecordCopies(VkCommandBuffer cmd_buffer,
+                    const std::vector<RenderState> &render_states,
+                    uint32_t target_format);
   uint32_t GetMemoryTypeIndex(uint32_t mem_type_bits, uint32_t required_props);
   VkBuffer UploadBuffer(size_t data_size, const uint8_t *data,
                         VkBufferUsageFlags usage);
@@ -45,12 +89,26 @@ class VKRenderer : public Renderer {
   VkPhysicalDeviceProperties device_props_;
   VkPhysicalDeviceMemoryProperties device_mem_props_;
   VkDeviceMemory uniform_buffer_mem_;
-  VkDescriptorPool desc_pool_;
   VkCommandPool cmd_pool_;
   VkQueue queue_;
   VkBuffer vert_buffer_;
 
   std::vector<std::unique_ptr<VKProgram>> programs_;
+  Frame frames_[kFramesInFlight];
+  unsigned frame_index_ = 0;
+  // Set if completion of a frame can be exported as sync_file
+  // and KMS fences imported.
+  bool sync_fd_supported_ = false;
+  bool disable_explicit_sync_ = false;
+  PFN_vkGetSemaphoreFdKHR get_semaphore_fd_ = NULL;
+  PFN_vkImportSemaphoreFdKHR import_semaphore_fd_ = NULL;
+  // KMS fences passed to InsertFence since the last submission,
+  // merged into one.
+  ScopedFd wait_fence_;
+  // Holds wait_fence_ until the next frame is submitted.
+  VkSemaphore wait_semaphore_ = VK_NULL_HANDLE;
+  bool wait_pending_ = false;
+  ProgramBinaryCache program_cache_;
 };
 
 }  // namespace hwcomposer
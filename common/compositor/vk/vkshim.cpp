@@ -33,6 +33,32 @@ size_t ub_offset_align_;
 std::vector<VkImageMemoryBarrier> src_barrier_before_clear_;
 VkImageMemoryBarrier dst_barrier_before_clear_;
 VkFramebuffer framebuffer_;
+VKRetiredResources retired_resources_;
+
+void VKRetiredResources::Append(VKRetiredResources &other) {
+  image_views.insert(image_views.end(), other.image_views.begin(),
+                     other.image_views.end());
+  images.insert(images.end(), other.images.begin(), other.images.end());
+  memory.insert(memory.end(), other.memory.begin(), other.memory.end());
+  other.image_views.clear();
+  other.images.clear();
+  other.memory.clear();
+}
+
+void VKRetiredResources::Destroy() {
+  for (VkImageView image_view : image_views)
+    vkDestroyImageView(dev_, image_view, NULL);
+
+  for (VkImage image : images)
+    vkDestroyImage(dev_, image, NULL);
+
+  for (VkDeviceMemory device_memory : memory)
+    vkFreeMemory(dev_, device_memory, NULL);
+
+  image_views.clear();
+  images.clear();
+  memory.clear();
+}
 
 VkFormat DrmToVkFormat(int drm_format) {
   switch (drm_format) {
@@ -129,6 +129,18 @@ class RingBuffer {
   void Free(uint8_t *ptr);
 };
 
+// Objects which are no longer needed but may still be read by
+// frames in flight. They are destroyed once those frames completed.
+struct VKRetiredResources {
+  std::vector<VkImageView> image_views;
+  std::vector<VkImage> images;
+  std::vector<VkDeviceMemory> memory;
+
+  // Moves all objects of other to this.
+  void Append(VKRetiredResources &other);
+  void Destroy();
+};
+
 extern VkDevice dev_;
 extern VkInstance inst_;
 extern VkRenderPass render_pass_;
@@ -144,6 +156,8 @@ extern size_t ub_offset_align_;
 extern std::vector<VkImageMemoryBarrier> src_barrier_before_clear_;
 extern VkImageMemoryBarrier dst_barrier_before_clear_;
 extern VkFramebuffer framebuffer_;
+// Objects retired since the last frame was submitted.
+extern VKRetiredResources retired_resources_;
 
 }  // namespace hwcomposer
 
@@ -49,18 +49,18 @@ bool VKSurface::InitializeGPUResources() {
   clear_range.levelCount = 1;
   clear_range.layerCount = 1;
 
-  dst_barrier_before_clear_ = {};
-  dst_barrier_before_clear_.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  dst_barrier_before_clear_.srcAccessMask = 0;
-  dst_barrier_before_clear_.dstAccessMask =
+  dst_barrier_ = {};
+  dst_barrier_.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  dst_barrier_.srcAccessMask = 0;
+  dst_barrier_.dstAccessMask =
       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  dst_barrier_before_clear_.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  dst_barrier_before_clear_.newLayout =
+  dst_barrier_.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  dst_barrier_.newLayout =
       VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-  dst_barrier_before_clear_.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  dst_barrier_before_clear_.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  dst_barrier_before_clear_.image = image_;
-  dst_barrier_before_clear_.subresourceRange = clear_range;
+  dst_barrier_.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  dst_barrier_.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  dst_barrier_.image = image_;
+  dst_barrier_.subresourceRange = clear_range;
 
   VkImageViewCreateInfo view_create = {};
   view_create.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -102,11 +102,19 @@ bool VKSurface::InitializeGPUResources() {
 }
 
 bool VKSurface::MakeCurrent() {
-  if (surface_fb_ == VK_NULL_HANDLE && !InitializeGPUResources()) {
-    ETRACE("Failed to initialize gpu resources.");
-    return false;
+  if (surface_fb_ == VK_NULL_HANDLE) {
+    if (!InitializeGPUResources()) {
+      ETRACE("Failed to initialize gpu resources.");
+      return false;
+    }
+  } else {
+    // Keep content of earlier frames, only the damaged
+    // area gets drawn.
+    dst_barrier_.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
   }
 
+  dst_barrier_before_clear_ = dst_barrier_;
+
   framebuffer_ = surface_fb_;
 
   return true;
@@ -36,6 +36,7 @@ class VKSurface : public NativeSurface {
   VkImage image_;
   VkImageView image_view_;
   VkFramebuffer surface_fb_;
+  VkImageMemoryBarrier dst_barrier_;
 };
 
 }  // namespace hwcomposer
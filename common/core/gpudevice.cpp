@@ -39,10 +39,12 @@
 
 #include "display.h"
 #include "displayplanemanager.h"
+#include "drmkmsbackend.h"
 #include "drmscopedtypes.h"
 #include "headless.h"
 #include "hwcthread.h"
 #include "overlaybuffermanager.h"
+#include "rendererservice.h"
 #include "spinlock.h"
 #include "vblankeventhandler.h"
 #include "virtualdisplay.h"
@@ -73,6 +75,11 @@ class GpuDevice::DisplayManager : public HWCThread {
 
  private:
   void HotPlugEventHandler();
+  // Needs to outlive displays and buffers, they release
+  // their KMS objects when destroyed.
+  std::unique_ptr<KMSBackend> kms_backend_;
+  // Renderer shared by the compositors of all displays.
+  std::unique_ptr<RendererService> renderer_service_;
   std::unique_ptr<NativeDisplay> headless_;
   std::unique_ptr<NativeDisplay> virtual_display_;
   std::vector<std::unique_ptr<NativeDisplay>> displays_;
@@ -101,7 +108,10 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
     return false;
   }
 
+  kms_backend_.reset(new DrmKMSBackend(fd_));
+  renderer_service_.reset(new RendererService());
   buffer_manager_.reset(new OverlayBufferManager());
+  buffer_manager_->SetObserver(renderer_service_.get());
   if (!buffer_manager_->Initialize(fd_)) {
     ETRACE("Failed to Initialize Buffer Manager.");
     return false;
@@ -116,7 +126,9 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
       return false;
     }
 
-    std::unique_ptr<NativeDisplay> display(new Display(fd_, i, c->crtc_id));
+    std::unique_ptr<NativeDisplay> display(
+        new Display(fd_, kms_backend_.get(), renderer_service_.get(), i,
+                    c->crtc_id));
     if (!display->Initialize(buffer_manager_.get())) {
       ETRACE("Failed to Initialize Display %d", c->crtc_id);
       return false;
@@ -125,7 +137,8 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
     displays_.emplace_back(std::move(display));
   }
 
-  virtual_display_.reset(new VirtualDisplay(fd_, buffer_manager_.get(), 0, 0));
+  virtual_display_.reset(new VirtualDisplay(
+      fd_, buffer_manager_.get(), renderer_service_.get(), 0, 0));
 
   if (!UpdateDisplayState()) {
     ETRACE("Failed to connect display.");
@@ -16,8 +16,35 @@
 
 #include <hwclayer.h>
 
+#include <utility>
+
 namespace hwcomposer {
 
+HwcLayer::HwcLayer(HwcLayer&& rhs) {
+  *this = std::move(rhs);
+}
+
+HwcLayer& HwcLayer::operator=(HwcLayer&& rhs) {
+  if (this == &rhs)
+    return *this;
+
+  acquire_fence = std::move(rhs.acquire_fence);
+  release_fence = std::move(rhs.release_fence);
+  transform_ = rhs.transform_;
+  alpha_ = rhs.alpha_;
+  source_crop_ = rhs.source_crop_;
+  display_frame_ = rhs.display_frame_;
+  blending_ = rhs.blending_;
+  sf_handle_ = rhs.sf_handle_;
+  surface_damage_rects_ = std::move(rhs.surface_damage_rects_);
+  surface_damage_.kNumRects = rhs.surface_damage_.kNumRects;
+  surface_damage_.kRects = surface_damage_rects_.data();
+  rhs.surface_damage_rects_.clear();
+  rhs.surface_damage_.kNumRects = 0;
+  rhs.surface_damage_.kRects = rhs.surface_damage_rects_.data();
+  return *this;
+}
+
 void HwcLayer::SetNativeHandle(HWCNativeHandle handle) {
   sf_handle_ = handle;
 }
@@ -43,7 +70,10 @@ void HwcLayer::SetDisplayFrame(const HwcRect<int>& display_frame) {
 }
 
 void HwcLayer::SetSurfaceDamage(const HwcRegion& surface_damage) {
-  surface_damage_ = surface_damage;
+  surface_damage_rects_.assign(
+      surface_damage.kRects, surface_damage.kRects + surface_damage.kNumRects);
+  surface_damage_.kNumRects = surface_damage.kNumRects;
+  surface_damage_.kRects = surface_damage_rects_.data();
 }
 
 }  // namespace hwcomposer
@@ -70,12 +70,13 @@ int NativeSync::CreateNextTimelineFence() {
   return sw_sync_fence_create(timeline_fd_.get(), "NativeSync", timeline_);
 }
 
-int NativeSync::IncreaseTimelineToPoint(int point) {
-  int timeline_increase = point - timeline_current_;
+int NativeSync::IncreaseTimelineToPoint(int64_t point) {
+  int64_t timeline_increase = point - timeline_current_;
   if (timeline_increase <= 0)
     return 0;
 
-  int ret = sw_sync_timeline_inc(timeline_fd_.get(), timeline_increase);
+  int ret = sw_sync_timeline_inc(timeline_fd_.get(),
+                                 static_cast<unsigned>(timeline_increase));
   if (ret)
     ETRACE("Failed to increment sync timeline %s", PRINTERROR());
   else
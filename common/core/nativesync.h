@@ -32,8 +32,21 @@ class NativeSync {
 
   int CreateNextTimelineFence();
 
+  // Signals all fences created for points up to and
+  // including point.
+  int IncreaseTimelineToPoint(int64_t point);
+
+  // Returns the point of the last fence created.
+  int64_t GetTimelinePoint() const {
+    return timeline_;
+  }
+
+  // Returns the last point signalled.
+  int64_t GetSignalledPoint() const {
+    return timeline_current_;
+  }
+
  private:
-  int IncreaseTimelineToPoint(int point);
 #ifndef USE_ANDROID_SYNC
   int sw_sync_fence_create(int fd, const char *name, unsigned value);
   int sw_sync_timeline_inc(int fd, unsigned count);
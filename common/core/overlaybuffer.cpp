@@ -21,10 +21,13 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <atomic>
+
 #include <hwcdefs.h>
 #include <nativebufferhandler.h>
 
 #include "hwctrace.h"
+#include "kmsbackend.h"
 
 // minigbm specific DRM_FORMAT_YVU420_ANDROID enum
 #define DRM_FORMAT_YVU420_ANDROID              fourcc_code('9', '9', '9', '7')
@@ -35,6 +38,11 @@ OverlayBuffer::~OverlayBuffer() {
   ReleaseFrameBuffer();
 }
 
+uint64_t OverlayBuffer::GenerateId() {
+  static std::atomic<uint64_t> next_id(1);
+  return next_id++;
+}
+
 void OverlayBuffer::Initialize(const HwcBuffer& bo) {
   width_ = bo.width;
   height_ = bo.height;
@@ -47,6 +55,7 @@ void OverlayBuffer::Initialize(const HwcBuffer& bo) {
   SetRecommendedFormat(bo.format);
   prime_fd_ = bo.prime_fd;
   usage_ = bo.usage;
+  modifier_ = bo.modifier;
 }
 
 void OverlayBuffer::InitializeFromNativeHandle(
@@ -177,27 +186,27 @@ void OverlayBuffer::SetRecommendedFormat(uint32_t format) {
   }
 }
 
-bool OverlayBuffer::CreateFrameBuffer(uint32_t gpu_fd) {
-  ReleaseFrameBuffer();
-  int ret = drmModeAddFB2(gpu_fd, width_, height_, format_, gem_handles_,
-                          pitches_, offsets_, &fb_id_, 0);
+bool OverlayBuffer::CreateFrameBuffer(KMSBackend* kms) {
+  // Gem handles, pitches and offsets don't change during the
+  // lifetime of the buffer, re-use the framebuffer as long as
+  // format is the same.
+  if (fb_id_ && kms_ == kms && fb_format_ == format_)
+    return true;
 
-  if (ret) {
-    ETRACE("drmModeAddFB2 error (%dx%d, %c%c%c%c, handle %d pitch %d) (%s)",
-           width_, height_, format_, format_ >> 8, format_ >> 16, format_ >> 24,
-           gem_handles_[0], pitches_[0], strerror(-ret));
-
-    fb_id_ = 0;
+  ReleaseFrameBuffer();
+  fb_id_ = kms->AddFrameBuffer(width_, height_, format_, gem_handles_,
+                               pitches_, offsets_);
+  if (!fb_id_)
     return false;
-  }
 
-  gpu_fd_ = gpu_fd;
+  kms_ = kms;
+  fb_format_ = format_;
   return true;
 }
 
 void OverlayBuffer::ReleaseFrameBuffer() {
-  if (fb_id_ && gpu_fd_ && drmModeRmFB(gpu_fd_, fb_id_))
-    ETRACE("Failed to remove fb %s", PRINTERROR());
+  if (fb_id_ && kms_)
+    kms_->RemoveFrameBuffer(fb_id_);
 
   fb_id_ = 0;
 }
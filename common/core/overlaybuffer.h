@@ -24,6 +24,7 @@
 
 namespace hwcomposer {
 
+class KMSBackend;
 class NativeBufferHandler;
 
 class OverlayBuffer {
@@ -54,17 +55,47 @@ class OverlayBuffer {
     return pitches_[0];
   }
 
+  uint32_t GetPitch(uint32_t plane) const {
+    return pitches_[plane];
+  }
+
+  uint32_t GetOffset(uint32_t plane) const {
+    return offsets_[plane];
+  }
+
   uint32_t GetUsage() const {
     return usage_;
   }
 
+  uint64_t GetModifier() const {
+    return modifier_;
+  }
+
   uint32_t GetFb() const {
     return fb_id_;
   }
 
+  uint32_t GetPrimeFD() const {
+    return prime_fd_;
+  }
+
+  uint32_t GetGemHandle() const {
+    return gem_handles_[0];
+  }
+
+  // Unique for the lifetime of the process, unlike prime fd and GEM
+  // handles which are handed out again once a buffer is freed.
+  uint64_t GetId() const {
+    return id_;
+  }
+
   GpuImage ImportImage(GpuDisplay egl_display);
 
-  bool CreateFrameBuffer(uint32_t gpu_fd);
+  // Creates a framebuffer for this buffer. In case we already have
+  // one created for the current format, it's re-used. Framebuffer
+  // is released only when this buffer is destroyed or the format
+  // changes.
+  bool CreateFrameBuffer(KMSBackend* kms);
 
   void ReleaseFrameBuffer();
 
@@ -78,6 +109,9 @@ class OverlayBuffer {
   friend class NativeSurface;
 
  private:
+  static uint64_t GenerateId();
+
+  uint64_t id_ = GenerateId();
   uint32_t width_ = 0;
   uint32_t height_ = 0;
   uint32_t format_ = 0;
@@ -85,9 +119,11 @@ class OverlayBuffer {
   uint32_t offsets_[4];
   uint32_t gem_handles_[4];
   uint32_t fb_id_ = 0;
+  uint32_t fb_format_ = 0;
   uint32_t prime_fd_ = 0;
   uint32_t usage_ = 0;
-  uint32_t gpu_fd_ = 0;
+  uint64_t modifier_ = 0;
+  KMSBackend* kms_ = NULL;
   bool is_yuv_ = false;
   HWCNativeHandle handle_ = 0;
 };
@@ -17,10 +17,16 @@
 #include "overlaybuffermanager.h"
 
 #include "hwctrace.h"
+#include "hwcutils.h"
 #include "overlaylayer.h"
 
 namespace hwcomposer {
 
+// Time a buffer can stay unreferenced before we release it, about
+// eight frames at 60Hz. Measured in time rather than calls to
+// ReclaimStaleBuffers, as every display makes those.
+static const int64_t kMaxIdleTimeNs = 133000000;
+
 ImportedBuffer::~ImportedBuffer() {
   if (owned_buffer_)
     buffer_manager_->UnRegisterBuffer(buffer_);
@@ -39,129 +45,188 @@ bool OverlayBufferManager::Initialize(uint32_t gpu_fd) {
   return true;
 }
 
+bool OverlayBufferManager::Initialize(NativeBufferHandler* buffer_handler) {
+  buffer_handler_.reset(buffer_handler);
+  return buffer_handler_ != NULL;
+}
+
 ImportedBuffer* OverlayBufferManager::CreateBuffer(const HwcBuffer& bo) {
-  buffers_.emplace_back();
-  Buffer& buffer = buffers_.back();
-  buffer.buffer_.reset(new OverlayBuffer());
-  buffer.buffer_->Initialize(bo);
-  buffer.ref_count_ = 1;
-  buffer.sync_object_.reset(new NativeSync());
-  if (!buffer.sync_object_->Init()) {
-    ETRACE("Failed to create sync object.");
-  }
+  ScopedSpinLock lock(lock_);
+  Buffer* buffer = new Buffer();
+  buffer->buffer_.reset(new OverlayBuffer());
+  buffer->buffer_->Initialize(bo);
 
-  return new ImportedBuffer(buffer.buffer_.get(), this,
-                            buffer.sync_object_->CreateNextTimelineFence());
+  buffers_[buffer->buffer_.get()].reset(buffer);
+  return CreateImportedBuffer(buffer);
 }
 
 ImportedBuffer* OverlayBufferManager::CreateBufferFromNativeHandle(
     HWCNativeHandle handle) {
-  buffers_.emplace_back();
-  Buffer& buffer = buffers_.back();
-  buffer.buffer_.reset(new OverlayBuffer());
-  buffer.buffer_->InitializeFromNativeHandle(handle, buffer_handler_.get());
-  buffer.ref_count_ = 1;
-  buffer.sync_object_.reset(new NativeSync());
-  if (!buffer.sync_object_->Init()) {
-    ETRACE("Failed to create sync object.");
+  const void* native_key = GetNativeBufferKey(handle);
+  ReleasedBuffers released;
+  ImportedBuffer* imported = NULL;
+  {
+    ScopedSpinLock lock(lock_);
+    auto cached = native_buffers_.find(native_key);
+    if (cached != native_buffers_.end()) {
+      Buffer* buffer = cached->second;
+      // Handles are freed by the client without telling us, a new one
+      // can end up at the same address.
+      if (buffer->native_id_ == GetNativeBufferId(handle))
+        return CreateImportedBuffer(buffer);
+
+      // Buffer can't be found by handle anymore. It's released once
+      // frames still showing it are done.
+      native_buffers_.erase(cached);
+      buffer->native_key_ = NULL;
+      if (buffer->ref_count_ == 0)
+        ReleaseBuffer(buffers_.find(buffer->buffer_.get()), released);
+    }
+
+    Buffer* buffer = new Buffer();
+    buffer->buffer_.reset(new OverlayBuffer());
+    buffer->buffer_->InitializeFromNativeHandle(handle, buffer_handler_.get());
+    buffer->native_key_ = native_key;
+    buffer->native_id_ = GetNativeBufferId(handle);
+
+    buffers_[buffer->buffer_.get()].reset(buffer);
+    native_buffers_.emplace(native_key, buffer);
+    imported = CreateImportedBuffer(buffer);
   }
 
-  return new ImportedBuffer(buffer.buffer_.get(), this,
-                            buffer.sync_object_->CreateNextTimelineFence());
+  DestroyBuffers(released);
+  return imported;
+}
+
+ImportedBuffer* OverlayBufferManager::CreateImportedBuffer(Buffer* buffer) {
+  buffer->ref_count_++;
+  return new ImportedBuffer(buffer->buffer_.get(), this);
 }
 
 void OverlayBufferManager::RegisterBuffer(const OverlayBuffer* const buffer) {
-  for (Buffer& overlay_buffer : buffers_) {
-    if (overlay_buffer.buffer_.get() != buffer)
-      continue;
+  ScopedSpinLock lock(lock_);
+  RegisterBufferLocked(buffer);
+}
 
-    overlay_buffer.ref_count_++;
-    break;
-  }
+void OverlayBufferManager::RegisterBufferLocked(
+    const OverlayBuffer* const buffer) {
+  auto it = buffers_.find(buffer);
+  if (it == buffers_.end())
+    return;
+
+  it->second->ref_count_++;
 }
 
 void OverlayBufferManager::RegisterBuffers(
     const std::vector<const OverlayBuffer*>& buffers) {
+  ScopedSpinLock lock(lock_);
   for (const OverlayBuffer* const buffer : buffers) {
-    for (Buffer& overlay_buffer : buffers_) {
-      if (overlay_buffer.buffer_.get() != buffer)
-        continue;
-
-      overlay_buffer.ref_count_++;
-      break;
-    }
+    RegisterBufferLocked(buffer);
   }
 }
 
 void OverlayBufferManager::UnRegisterBuffer(const OverlayBuffer* const buffer) {
-  int32_t index = -1;
-  for (Buffer& overlay_buffer : buffers_) {
-    index++;
-    if (overlay_buffer.buffer_.get() != buffer)
-      continue;
-
-    overlay_buffer.ref_count_--;
-    if (overlay_buffer.ref_count_ > 0) {
-      index = -1;
-    }
-
-    break;
+  ReleasedBuffers released;
+  {
+    ScopedSpinLock lock(lock_);
+    UnRegisterBufferLocked(buffer, released);
   }
 
-  if (index >= 0 && index < buffers_.size()) {
-    buffers_.erase(buffers_.begin() + index);
-  }
+  DestroyBuffers(released);
 }
 
-void OverlayBufferManager::UnRegisterBuffers(
-    const std::vector<const OverlayBuffer*>& buffers) {
-  for (const OverlayBuffer* const buffer : buffers) {
-    int32_t index = -1;
-    for (Buffer& overlay_buffer : buffers_) {
-      index++;
-      if (overlay_buffer.buffer_.get() != buffer)
-        continue;
+void OverlayBufferManager::UnRegisterBufferLocked(
+    const OverlayBuffer* const buffer, ReleasedBuffers& released) {
+  auto it = buffers_.find(buffer);
+  if (it == buffers_.end())
+    return;
 
-      overlay_buffer.ref_count_--;
-      if (overlay_buffer.ref_count_ > 0) {
-        index = -1;
-      }
+  Buffer* overlay_buffer = it->second.get();
+  if (overlay_buffer->ref_count_ > 0)
+    overlay_buffer->ref_count_--;
 
-      break;
-    }
+  if (overlay_buffer->ref_count_ > 0)
+    return;
+
+  // Buffers not created from a native handle can't be re-used.
+  if (!overlay_buffer->native_key_) {
+    ReleaseBuffer(it, released);
+    return;
+  }
 
-    if (index >= 0 && index < buffers_.size()) {
-      buffers_.erase(buffers_.begin() + index);
+  overlay_buffer->idle_since_ns_ = GetMonotonicTimeNs();
+}
+
+void OverlayBufferManager::UnRegisterBuffers(
+    const std::vector<const OverlayBuffer*>& buffers) {
+  ReleasedBuffers released;
+  {
+    ScopedSpinLock lock(lock_);
+    for (const OverlayBuffer* const buffer : buffers) {
+      UnRegisterBufferLocked(buffer, released);
     }
   }
+
+  DestroyBuffers(released);
 }
 
 void OverlayBufferManager::UnRegisterLayerBuffers(
     std::vector<OverlayLayer>& layers) {
   CTRACE();
-  for (OverlayLayer& layer : layers) {
-    const OverlayBuffer* const buffer = layer.GetBuffer();
-    if (!buffer)
-      continue;
-    int32_t index = -1;
-    for (Buffer& overlay_buffer : buffers_) {
-      index++;
-      if (overlay_buffer.buffer_.get() != buffer)
+  ReleasedBuffers released;
+  {
+    ScopedSpinLock lock(lock_);
+    for (OverlayLayer& layer : layers) {
+      const OverlayBuffer* const buffer = layer.GetBuffer();
+      if (!buffer)
         continue;
 
-      overlay_buffer.ref_count_--;
+      UnRegisterBufferLocked(buffer, released);
       layer.ReleaseBuffer();
-      if (overlay_buffer.ref_count_ > 0) {
-        index = -1;
-      }
-
-      break;
     }
+  }
 
-    if (index >= 0 && index < buffers_.size()) {
-      buffers_.erase(buffers_.begin() + index);
+  DestroyBuffers(released);
+}
+
+void OverlayBufferManager::ReclaimStaleBuffers() {
+  int64_t now = GetMonotonicTimeNs();
+  ReleasedBuffers released;
+  {
+    ScopedSpinLock lock(lock_);
+    for (auto it = buffers_.begin(); it != buffers_.end();) {
+      const Buffer* buffer = it->second.get();
+      if (buffer->ref_count_ == 0 &&
+          now - buffer->idle_since_ns_ > kMaxIdleTimeNs) {
+        auto stale = it++;
+        ReleaseBuffer(stale, released);
+      } else {
+        ++it;
+      }
     }
   }
+
+  DestroyBuffers(released);
+}
+
+void OverlayBufferManager::ReleaseBuffer(BufferMap::iterator it,
+                                         ReleasedBuffers& released) {
+  if (it->second->native_key_)
+    native_buffers_.erase(it->second->native_key_);
+
+  released.emplace_back(std::move(it->second));
+  buffers_.erase(it);
+}
+
+void OverlayBufferManager::DestroyBuffers(ReleasedBuffers& released) {
+  for (std::unique_ptr<Buffer>& buffer : released) {
+    if (observer_)
+      observer_->OnBufferDestroyed(buffer->buffer_->GetId());
+
+    buffer.reset();
+  }
+
+  released.clear();
 }
 
 }  // namespace hwcomposer
@@ -23,9 +23,9 @@
 #include <spinlock.h>
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
-#include "nativesync.h"
 #include "overlaybuffer.h"
 
 namespace hwcomposer {
@@ -34,57 +34,67 @@ class NativeBufferHandler;
 class OverlayBufferManager;
 struct OverlayLayer;
 
+// Notified when OverlayBufferManager destroys a buffer, so that
+// resources created for it elsewhere can be released.
+class OverlayBufferObserver {
+ public:
+  virtual ~OverlayBufferObserver() {
+  }
+
+  // buffer_id is the id of the destroyed buffer, see
+  // OverlayBuffer::GetId. Can be called from any thread.
+  virtual void OnBufferDestroyed(uint64_t buffer_id) = 0;
+};
+
 struct ImportedBuffer {
  public:
   ImportedBuffer(OverlayBuffer* const buffer,
-                 OverlayBufferManager* buffer_manager, int release_fence)
-      : buffer_(buffer),
-        release_fence_(release_fence),
-        buffer_manager_(buffer_manager) {
+                 OverlayBufferManager* buffer_manager)
+      : buffer_(buffer), buffer_manager_(buffer_manager) {
   }
 
   ~ImportedBuffer();
 
   OverlayBuffer* const buffer_;
-  int release_fence_;
   bool owned_buffer_ = true;
 
  private:
   OverlayBufferManager* buffer_manager_;
 };
 
+// Shared by all displays. All methods can be called from any thread.
 class OverlayBufferManager {
  public:
   OverlayBufferManager() = default;
-  OverlayBufferManager(OverlayBufferManager&& rhs) = default;
-  OverlayBufferManager& operator=(OverlayBufferManager&& other) = default;
+  OverlayBufferManager(const OverlayBufferManager& rhs) = delete;
+  OverlayBufferManager& operator=(const OverlayBufferManager& rhs) = delete;
 
   ~OverlayBufferManager();
 
   bool Initialize(uint32_t gpu_fd);
 
-  // Creates new ImportedBuffer for bo. Also, creates
-  // a sync fence object associated for this buffer.
-  // Sync fence is automatically signalled when buffer
-  // is destroyed. RefCount of buffer is initialized to
-  // 1.
+  // Uses buffer_handler, taking ownership of it, instead of creating
+  // one for the GPU. Buffers of a handler which doesn't allocate from
+  // the GPU, e.g. MemfdBufferHandler, can only be shown through
+  // FakeKMSBackend.
+  bool Initialize(NativeBufferHandler* buffer_handler);
+
+  // Creates new ImportedBuffer for bo. RefCount of buffer
+  // is initialized to 1.
   ImportedBuffer* CreateBuffer(const HwcBuffer& bo);
 
-  // Creates new ImportedBuffer for handle. Also, creates
-  // a sync fence object associated for this buffer.
-  // Sync fence is automatically signalled when buffer
-  // is destroyed. RefCount of buffer is initialized to
-  // 1.
+  // Creates new ImportedBuffer for handle. In case handle
+  // was seen before, the OverlayBuffer created for it is
+  // re-used and it's RefCount is increased by 1.
   ImportedBuffer* CreateBufferFromNativeHandle(HWCNativeHandle handle);
 
   // Increments RefCount of buffer by 1. Buffer will not be released
-  // or associated fence object signalled until UnRegisterBuffer
-  // is called and RefCount decreases to zero.
+  // until UnRegisterBuffer is called and RefCount decreases to zero.
   void RegisterBuffer(const OverlayBuffer* const buffer);
 
-  // Decreases RefCount of buffer by 1. Buffer will be released
-  // and associated fence object will be signalled if RefCount
-  // is equal to zero.
+  // Decreases RefCount of buffer by 1. Buffer is kept around
+  // for re-use and released by ReclaimStaleBuffers once it
+  // has not been used for a while.
   void UnRegisterBuffer(const OverlayBuffer* const buffer);
 
   // Convenient function to call together RegisterBuffer for
@@ -97,19 +107,55 @@ class OverlayBufferManager {
 
   void UnRegisterLayerBuffers(std::vector<OverlayLayer>& layers);
 
+  // Releases buffers which have not been referenced for a while.
+  // Expected to be called once per frame by every display.
+  void ReclaimStaleBuffers();
+
   NativeBufferHandler* GetNativeBufferHandler() const {
     return buffer_handler_.get();
   }
 
+  // observer needs to outlive this manager.
+  void SetObserver(OverlayBufferObserver* observer) {
+    observer_ = observer;
+  }
+
  private:
   struct Buffer {
     std::unique_ptr<OverlayBuffer> buffer_;
-    std::unique_ptr<NativeSync> sync_object_;
+    const void* native_key_ = NULL;
+    // GetNativeBufferId of the native handle when it was imported.
+    uint64_t native_id_ = 0;
     uint32_t ref_count_ = 0;
+    // When ref_count_ last dropped to zero.
+    int64_t idle_since_ns_ = 0;
   };
 
-  std::vector<Buffer> buffers_;
+  typedef std::vector<std::unique_ptr<Buffer>> ReleasedBuffers;
+  typedef std::unordered_map<const OverlayBuffer*, std::unique_ptr<Buffer>>
+      BufferMap;
+
+  // Expect lock_ to be held.
+  ImportedBuffer* CreateImportedBuffer(Buffer* buffer);
+  void RegisterBufferLocked(const OverlayBuffer* const buffer);
+  void UnRegisterBufferLocked(const OverlayBuffer* const buffer,
+                              ReleasedBuffers& released);
+  // Removes the buffer from our lists and moves it to released.
+  void ReleaseBuffer(BufferMap::iterator it, ReleasedBuffers& released);
+
+  // Expects lock_ not to be held. Tearing buffers down frees their
+  // framebuffers and GEM handles, which shouldn't block other threads
+  // spinning on lock_.
+  void DestroyBuffers(ReleasedBuffers& released);
+
+  // All buffers, indexed by OverlayBuffer.
+  BufferMap buffers_;
+  // Buffers created from native handles, indexed by GetNativeBufferKey.
+  std::unordered_map<const void*, Buffer*> native_buffers_;
   std::unique_ptr<NativeBufferHandler> buffer_handler_;
+  OverlayBufferObserver* observer_ = NULL;
+  // Guards all state above, displays share the manager.
+  SpinLock lock_;
 };
 
 }  // namespace hwcomposer
@@ -17,13 +17,12 @@
 #include "overlaylayer.h"
 
 #include <drm_mode.h>
+#include <math.h>
 #include <hwctrace.h>
 
-namespace hwcomposer {
+#include "hwcutils.h"
 
-int OverlayLayer::GetReleaseFence() {
-  return imported_buffer_->release_fence_;
-}
+namespace hwcomposer {
 
 void OverlayLayer::ReleaseBuffer() {
   imported_buffer_->owned_buffer_ = false;
@@ -70,6 +69,7 @@ void OverlayLayer::SetDisplayFrame(const HwcRect<int>& display_frame) {
   display_frame_width_ = display_frame.right - display_frame.left;
   display_frame_height_ = display_frame.bottom - display_frame.top;
   display_frame_ = display_frame;
+  surface_damage_ = display_frame;
 }
 
 void OverlayLayer::ValidatePreviousFrameState(const OverlayLayer& rhs) {
@@ -115,6 +115,45 @@ void OverlayLayer::ValidatePreviousFrameState(const OverlayLayer& rhs) {
 void OverlayLayer::SetSurfaceDamage(const HwcRegion& surface_damage,
                                     const OverlayLayer& rhs) {
   ValidatePreviousFrameState(rhs);
+  surface_damage_ = display_frame_;
+  if (layer_pos_changed_ || layer_attributes_changed_)
+    return;
+
+  // No damage rects means the whole layer changed.
+  if (!surface_damage.kNumRects)
+    return;
+
+  // Damage is in buffer co-ordinates, we don't map it
+  // through rotation and reflection.
+  if (transform_ != kIdentity)
+    return;
+
+  HwcRect<int> damage(0, 0, 0, 0);
+  for (uint32_t i = 0; i < surface_damage.kNumRects; i++)
+    damage = UnionRect(damage, surface_damage.kRects[i]);
+
+  damage = IntersectRect(damage, HwcRect<int>(source_crop_));
+  // A single empty rect means the buffer content didn't change.
+  if (IsEmptyRect(damage)) {
+    surface_damage_ = HwcRect<int>(0, 0, 0, 0);
+    return;
+  }
+
+  // Scale damage from source crop to display frame, rounding outwards.
+  float scale_x = static_cast<float>(display_frame_width_) /
+                  (source_crop_.right - source_crop_.left);
+  float scale_y = static_cast<float>(display_frame_height_) /
+                  (source_crop_.bottom - source_crop_.top);
+  HwcRect<int> display_damage(
+      display_frame_.left +
+          static_cast<int>(floorf((damage.left - source_crop_.left) * scale_x)),
+      display_frame_.top +
+          static_cast<int>(floorf((damage.top - source_crop_.top) * scale_y)),
+      display_frame_.left + static_cast<int>(ceilf(
+                                (damage.right - source_crop_.left) * scale_x)),
+      display_frame_.top + static_cast<int>(ceilf(
+                               (damage.bottom - source_crop_.top) * scale_y)));
+  surface_damage_ = IntersectRect(display_damage, display_frame_);
 }
 
 void OverlayLayer::Dump() {
@@ -37,11 +37,6 @@ struct OverlayLayer {
     return acquire_fence_.get();
   }
 
-  // Creates a Release Fence which will
-  // be signalled when this layer is no
-  // longer in use.
-  int GetReleaseFence();
-
   void ReleaseAcquireFence() {
     acquire_fence_.Reset(-1);
   }
@@ -70,6 +65,18 @@ struct OverlayLayer {
     return blending_;
   }
 
+  // Returns true if layer hides everything below it.
+  // Alpha is not applied with kBlendingNone.
+  bool IsOpaque() const {
+    return blending_ == HWCBlending::kBlendingNone;
+  }
+
+  // Returns true if layer doesn't contribute to the
+  // composited result.
+  bool IsTransparent() const {
+    return blending_ != HWCBlending::kBlendingNone && alpha_ == 0;
+  }
+
   uint32_t GetRotation() const {
     return rotation_;
   }
@@ -135,6 +142,24 @@ struct OverlayLayer {
   // previous frame.
   void SetSurfaceDamage(const HwcRegion& surface_damage,
                         const OverlayLayer& rhs);
+
+  // Part of display frame which changed since previous
+  // frame, in display co-ordinates. Defaults to whole
+  // display frame.
+  const HwcRect<int>& GetSurfaceDamage() const {
+    return surface_damage_;
+  }
+
+  // Number of consecutive frames before this one in which the
+  // layer showed the same buffer, unchanged and at the same place.
+  void SetStaticFrameCount(uint32_t count) {
+    static_frames_ = count;
+  }
+
+  uint32_t GetStaticFrameCount() const {
+    return static_frames_;
+  }
+
   void Dump();
 
  private:
@@ -145,9 +170,11 @@ struct OverlayLayer {
   uint32_t source_crop_height_;
   uint32_t display_frame_width_;
   uint32_t display_frame_height_;
+  uint32_t static_frames_ = 0;
   uint8_t alpha_ = 0xff;
   HwcRect<float> source_crop_;
   HwcRect<int> display_frame_;
+  HwcRect<int> surface_damage_;
   ScopedFd acquire_fence_;
   HWCBlending blending_ = HWCBlending::kBlendingNone;
   bool layer_pos_changed_ = true;
@@ -0,0 +1,140 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+
+#include "commitscheduler.h"
+
+#include <errno.h>
+#include <time.h>
+
+namespace hwcomposer {
+
+namespace {
+
+const int64_t kOneSecondNs = 1000 * 1000 * 1000;
+// Time the kernel needs between a commit and the vblank it is
+// applied on.
+const int64_t kLatchMarginNs = 1000 * 1000;
+
+// Follows increases at once and decays slowly, so that a single
+// fast frame doesn't make the next deadline miss.
+void UpdateCost(int64_t sample, int64_t* cost) {
+  if (sample > *cost) {
+    *cost = sample;
+  } else {
+    *cost += (sample - *cost) / 16;
+  }
+}
+
+}  // namespace
+
+CommitScheduler::CommitScheduler() : enabled_("commitlatch", 1, false) {
+}
+
+int64_t CommitScheduler::Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * kOneSecondNs + ts.tv_nsec;
+}
+
+void CommitScheduler::SetMode(const drmModeModeInfo& mode) {
+  float refresh = 0.0f;
+  if (mode.clock && mode.htotal && mode.vtotal) {
+    refresh = (mode.clock * 1000.0f) / (mode.htotal * mode.vtotal);
+    if (mode.flags & DRM_MODE_FLAG_INTERLACE)
+      refresh *= 2;
+
+    if (mode.flags & DRM_MODE_FLAG_DBLSCAN)
+      refresh /= 2;
+
+    if (mode.vscan > 1)
+      refresh /= mode.vscan;
+  }
+
+  ScopedSpinLock lock(lock_);
+  nominal_period_ = refresh > 0.0f ? kOneSecondNs / refresh : 0;
+  period_ = nominal_period_;
+  last_flip_ = 0;
+}
+
+void CommitScheduler::AddFlipTime(int64_t timestamp) {
+  ScopedSpinLock lock(lock_);
+  if (timestamp <= last_flip_)
+    return;
+
+  if (last_flip_ && nominal_period_) {
+    // Flips skip vblanks when no frame was ready, only
+    // neighbouring ones refine the period.
+    int64_t interval = timestamp - last_flip_;
+    if (interval > nominal_period_ / 2 &&
+        interval < nominal_period_ + nominal_period_ / 2)
+      period_ += (interval - period_) / 16;
+  }
+
+  last_flip_ = timestamp;
+}
+
+void CommitScheduler::AddCompositionTime(int64_t duration) {
+  ScopedSpinLock lock(lock_);
+  UpdateCost(duration, &composition_cost_);
+}
+
+void CommitScheduler::AddCommitTime(int64_t duration) {
+  ScopedSpinLock lock(lock_);
+  UpdateCost(duration, &commit_cost_);
+}
+
+int64_t CommitScheduler::PredictVblank(int64_t time) {
+  ScopedSpinLock lock(lock_);
+  return PredictVblankLocked(time);
+}
+
+int64_t CommitScheduler::PredictVblankLocked(int64_t time) const {
+  if (!last_flip_ || !period_)
+    return 0;
+
+  int64_t elapsed = time > last_flip_ ? time - last_flip_ : 0;
+  return last_flip_ + (elapsed / period_ + 1) * period_;
+}
+
+int64_t CommitScheduler::GetLatchTime(int64_t now) {
+  if (!enabled_.get())
+    return 0;
+
+  ScopedSpinLock lock(lock_);
+  int64_t lead = commit_cost_ + kLatchMarginNs;
+  int64_t vblank = PredictVblankLocked(now + lead);
+  if (!vblank)
+    return 0;
+
+  return vblank - lead;
+}
+
+int64_t CommitScheduler::GetTargetPresentTime(int64_t now) {
+  ScopedSpinLock lock(lock_);
+  return PredictVblankLocked(now + composition_cost_ + commit_cost_ +
+                             kLatchMarginNs);
+}
+
+void CommitScheduler::SleepUntil(int64_t time) {
+  struct timespec ts;
+  ts.tv_sec = time / kOneSecondNs;
+  ts.tv_nsec = time % kOneSecondNs;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+}  // namespace hwcomposer
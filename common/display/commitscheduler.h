@@ -0,0 +1,75 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+
+#ifndef COMMON_DISPLAY_COMMITSCHEDULER_H_
+#define COMMON_DISPLAY_COMMITSCHEDULER_H_
+
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include <spinlock.h>
+
+#include "option.h"
+
+namespace hwcomposer {
+
+// Predicts vblanks of a pipe from the times its flips complete and
+// estimates how long composition and commits take, so that a frame
+// can be committed as late as possible while still making the next
+// vblank. All times are CLOCK_MONOTONIC nanoseconds. Late latching
+// can be turned off with the commitlatch option.
+class CommitScheduler {
+ public:
+  CommitScheduler();
+
+  static int64_t Now();
+
+  // Sets nominal refresh period from mode and forgets any
+  // flips seen so far.
+  void SetMode(const drmModeModeInfo& mode);
+
+  void AddFlipTime(int64_t timestamp);
+  void AddCompositionTime(int64_t duration);
+  void AddCommitTime(int64_t duration);
+
+  // First vblank after time, 0 in case there is no prediction.
+  int64_t PredictVblank(int64_t time);
+
+  // Latest time at which a commit started after now still makes
+  // the next vblank. Returns 0 if commits shouldn't be delayed.
+  int64_t GetLatchTime(int64_t now);
+
+  // Vblank at which a frame composed from now on is expected to be
+  // shown, 0 in case there is no prediction.
+  int64_t GetTargetPresentTime(int64_t now);
+
+  void SleepUntil(int64_t time);
+
+ private:
+  int64_t PredictVblankLocked(int64_t time) const;
+
+  SpinLock lock_;
+  int64_t period_ = 0;
+  int64_t nominal_period_ = 0;
+  int64_t last_flip_ = 0;
+  int64_t composition_cost_ = 0;
+  int64_t commit_cost_ = 0;
+  Option enabled_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_COMMITSCHEDULER_H_
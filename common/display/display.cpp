@@ -30,7 +30,9 @@ namespace hwcomposer {
 
 static const int32_t kUmPerInch = 25400;
 
-Display::Display(uint32_t gpu_fd, uint32_t pipe_id, uint32_t crtc_id)
+Display::Display(uint32_t gpu_fd, KMSBackend *kms,
+                 RendererService *renderer_service, uint32_t pipe_id,
+                 uint32_t crtc_id)
     : crtc_id_(crtc_id),
       pipe_(pipe_id),
       connector_(0),
@@ -39,6 +41,8 @@ Display::Display(uint32_t gpu_fd, uint32_t pipe_id, uint32_t crtc_id)
       dpix_(0),
       dpiy_(0),
       gpu_fd_(gpu_fd),
+      kms_(kms),
+      renderer_service_(renderer_service),
       power_mode_(kOn),
       refresh_(0.0),
       is_connected_(false) {
@@ -51,7 +55,8 @@ Display::~Display() {
 
 bool Display::Initialize(OverlayBufferManager *buffer_manager) {
   vblank_handler_.reset(new VblankEventHandler());
-  display_queue_.reset(new DisplayQueue(gpu_fd_, crtc_id_, buffer_manager));
+  display_queue_.reset(new DisplayQueue(kms_, crtc_id_, buffer_manager,
+                                       renderer_service_));
 
   return true;
 }
@@ -216,6 +221,13 @@ bool Display::Present(std::vector<HwcLayer *> &source_layers,
   return display_queue_->QueueUpdate(source_layers, retire_fence);
 }
 
+bool Display::GetTargetPresentTime(int64_t *timestamp) {
+  if (!is_connected_ || power_mode_ != kOn)
+    return false;
+
+  return display_queue_->GetTargetPresentTime(timestamp);
+}
+
 int Display::RegisterVsyncCallback(std::shared_ptr<VsyncCallback> callback,
                                    uint32_t display_id) {
   return vblank_handler_->RegisterCallback(callback, display_id);
@@ -37,12 +37,15 @@ class DisplayPlaneManager;
 class DisplayQueue;
 class OverlayBufferManager;
 class GpuDevice;
+class RendererService;
+class KMSBackend;
 class NativeSync;
 struct HwcLayer;
 
 class Display : public NativeDisplay {
  public:
-  Display(uint32_t gpu_fd, uint32_t pipe_id, uint32_t crtc_id);
+  Display(uint32_t gpu_fd, KMSBackend *kms, RendererService *renderer_service,
+          uint32_t pipe_id, uint32_t crtc_id);
   ~Display() override;
 
   bool Initialize(OverlayBufferManager *buffer_manager) override;
@@ -85,6 +88,8 @@ class Display : public NativeDisplay {
   bool Present(std::vector<HwcLayer *> &source_layers,
                int32_t *retire_fence) override;
 
+  bool GetTargetPresentTime(int64_t *timestamp) override;
+
   int RegisterVsyncCallback(std::shared_ptr<VsyncCallback> callback,
                             uint32_t display_id) override;
 
@@ -123,6 +128,8 @@ class Display : public NativeDisplay {
   int32_t dpix_;
   int32_t dpiy_;
   uint32_t gpu_fd_;
+  KMSBackend *kms_;
+  RendererService *renderer_service_;
   uint32_t power_mode_;
   float refresh_;
   bool is_connected_;
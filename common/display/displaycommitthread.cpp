@@ -0,0 +1,128 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+
+#include "displaycommitthread.h"
+
+#include <iterator>
+
+#include "displayqueue.h"
+#include "hwctrace.h"
+
+namespace hwcomposer {
+
+DisplayCommitThread::DisplayCommitThread(DisplayQueue* display_queue)
+    : HWCThread(-8, "DisplayCommitThread"),
+      depth_("commitdepth", 2, false),
+      drop_stale_("commitdrop", 0, false),
+      display_queue_(display_queue) {
+}
+
+DisplayCommitThread::~DisplayCommitThread() {
+}
+
+bool DisplayCommitThread::Initialize() {
+  if (!InitWorker()) {
+    ETRACE("Failed to initalize thread for DisplayCommitThread. %s",
+           PRINTERROR());
+    return false;
+  }
+
+  return true;
+}
+
+bool DisplayCommitThread::QueueFrame(std::shared_ptr<DisplayFrame> frame) {
+  CTRACE();
+  if (!initialized_)
+    return false;
+
+  int32_t depth = depth_.get();
+  uint32_t max_pending = depth > 1 ? depth : 1;
+  std::vector<std::shared_ptr<DisplayFrame>> dropped;
+  std::unique_lock<std::mutex> lock(lock_);
+  if (drop_stale_.get()) {
+    while (pending_ >= max_pending && !frames_.empty()) {
+      dropped.emplace_back(std::move(frames_.front()));
+      frames_.pop_front();
+      pending_--;
+    }
+  }
+
+  cond_.wait(lock, [this, max_pending] { return pending_ < max_pending; });
+  frames_.emplace_back(std::move(frame));
+  pending_++;
+  lock.unlock();
+
+  for (std::shared_ptr<DisplayFrame>& stale : dropped)
+    display_queue_->DropFrame(stale.get());
+
+  Resume();
+  if (depth <= 1)
+    Flush();
+
+  return true;
+}
+
+void DisplayCommitThread::Flush() {
+  std::unique_lock<std::mutex> lock(lock_);
+  cond_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void DisplayCommitThread::ExitThread() {
+  Flush();
+  HWCThread::Exit();
+}
+
+void DisplayCommitThread::HandleRoutine() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!frames_.empty()) {
+    lock.unlock();
+    // Frames queued while waiting for the deadline can still
+    // make it, latch the newest one which is ready by then.
+    bool latched = display_queue_->WaitForLatchTime();
+    lock.lock();
+
+    size_t newest = 0;
+    if (latched) {
+      for (size_t i = frames_.size(); i-- > 1;) {
+        if (display_queue_->IsFrameReady(*frames_[i])) {
+          newest = i;
+          break;
+        }
+      }
+    }
+
+    std::vector<std::shared_ptr<DisplayFrame>> stale(
+        std::make_move_iterator(frames_.begin()),
+        std::make_move_iterator(frames_.begin() + newest));
+    frames_.erase(frames_.begin(), frames_.begin() + newest);
+    std::shared_ptr<DisplayFrame> frame = std::move(frames_.front());
+    frames_.pop_front();
+    lock.unlock();
+
+    for (std::shared_ptr<DisplayFrame>& stale_frame : stale)
+      display_queue_->DropFrame(stale_frame.get());
+
+    display_queue_->CommitFrame(frame, false);
+    frame.reset();
+
+    lock.lock();
+    pending_ -= stale.size() + 1;
+    cond_.notify_all();
+  }
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,103 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+
+#ifndef COMMON_DISPLAY_DISPLAYCOMMITTHREAD_H_
+#define COMMON_DISPLAY_DISPLAYCOMMITTHREAD_H_
+
+#include <stdint.h>
+
+#include <scopedfd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "displayplanestate.h"
+#include "hwcthread.h"
+#include "option.h"
+#include "overlaylayer.h"
+
+namespace hwcomposer {
+
+class DisplayQueue;
+
+// Composed frame waiting to be committed.
+struct DisplayFrame {
+  // Layers planes are assigned from. A run of static layers may be
+  // replaced by one layer showing squash_surface_.
+  std::vector<OverlayLayer> layers_;
+  // Layers pre-composited into squash_surface_.
+  std::vector<OverlayLayer> squashed_layers_;
+  // All layers of the frame, in the order they were queued.
+  std::vector<const OverlayLayer*> client_layers_;
+  NativeSurface* squash_surface_ = NULL;
+  DisplayPlaneStateList planes_;
+  // Points of the frame on DisplayQueue release and retire timelines.
+  int64_t release_point_ = 0;
+  int64_t retire_point_ = 0;
+  // Fences handed out for the frame, also used for frames which
+  // are skipped as they are identical to this one.
+  ScopedFd release_fence_;
+  ScopedFd retire_fence_;
+  bool use_out_fence_ = false;
+  std::atomic<bool> dropped_{false};
+};
+
+// Commits frames of a DisplayQueue in the order they were queued, so
+// that composing the next frame overlaps with waiting for the previous
+// flip. The commitdepth option sets how many frames can be pending,
+// queued or being committed. 1 makes QueueFrame wait till the frame is
+// committed. With 2, the default, a second frame can be queued while
+// the first one waits for its commit deadline, so late latching can
+// commit the newer one if it's ready by then and drop the older one.
+// When the queue is full, frames which haven't been picked up yet are
+// dropped if the commitdrop option is set, otherwise QueueFrame waits.
+class DisplayCommitThread : public HWCThread {
+ public:
+  explicit DisplayCommitThread(DisplayQueue* display_queue);
+  ~DisplayCommitThread() override;
+
+  bool Initialize();
+
+  // Returns false if the thread isn't running, frame needs to be
+  // committed by the caller in that case.
+  bool QueueFrame(std::shared_ptr<DisplayFrame> frame);
+
+  // Waits till all queued frames have been committed.
+  void Flush();
+
+  void ExitThread();
+
+ protected:
+  void HandleRoutine() override;
+
+ private:
+  std::mutex lock_;
+  std::condition_variable cond_;
+  std::deque<std::shared_ptr<DisplayFrame>> frames_;
+  // frames_ plus the frame being committed.
+  uint32_t pending_ = 0;
+  Option depth_;
+  Option drop_stale_;
+  DisplayQueue* display_queue_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_DISPLAYCOMMITTHREAD_H_
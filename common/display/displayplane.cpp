@@ -28,20 +28,11 @@ namespace hwcomposer {
 DisplayPlane::Property::Property() {
 }
 
-bool DisplayPlane::Property::Initialize(
-    uint32_t fd, const char* name,
-    const ScopedDrmObjectPropertyPtr& plane_props) {
-  uint32_t count_props = plane_props->count_props;
-  for (uint32_t i = 0; i < count_props; i++) {
-    ScopedDrmPropertyPtr property(
-        drmModeGetProperty(fd, plane_props->props[i]));
-    if (property && !strcmp(property->name, name)) {
-      id = property->prop_id;
-      break;
-    }
-  }
-  if (!id) {
+bool DisplayPlane::Property::Initialize(KMSBackend* kms, uint32_t plane_id,
+                                       const char* name) {
+  if (!kms->GetProperty(plane_id, DRM_MODE_OBJECT_PLANE, name, &id, NULL)) {
     ETRACE("Could not find property %s", name);
+    id = 0;
     return false;
   }
   return true;
@@ -58,75 +49,68 @@ DisplayPlane::DisplayPlane(uint32_t plane_id, uint32_t possible_crtcs)
 DisplayPlane::~DisplayPlane() {
 }
 
-bool DisplayPlane::Initialize(uint32_t gpu_fd,
+bool DisplayPlane::Initialize(KMSBackend* kms,
                               const std::vector<uint32_t>& formats) {
   supported_formats_ = formats;
 
-  ScopedDrmObjectPropertyPtr plane_props(
-      drmModeObjectGetProperties(gpu_fd, id_, DRM_MODE_OBJECT_PLANE));
-  if (!plane_props) {
+  uint32_t type_prop = 0;
+  uint64_t type = 0;
+  if (!kms->GetProperty(id_, DRM_MODE_OBJECT_PLANE, "type", &type_prop,
+                        &type)) {
     ETRACE("Unable to get plane properties.");
     return false;
   }
-  uint32_t count_props = plane_props->count_props;
-  for (uint32_t i = 0; i < count_props; i++) {
-    ScopedDrmPropertyPtr property(
-        drmModeGetProperty(gpu_fd, plane_props->props[i]));
-    if (property && !strcmp(property->name, "type")) {
-      type_ = plane_props->prop_values[i];
-      break;
-    }
-  }
+  type_ = type;
 
-  bool ret = crtc_prop_.Initialize(gpu_fd, "CRTC_ID", plane_props);
+  bool ret = crtc_prop_.Initialize(kms, id_, "CRTC_ID");
   if (!ret)
     return false;
 
-  ret = fb_prop_.Initialize(gpu_fd, "FB_ID", plane_props);
+  ret = fb_prop_.Initialize(kms, id_, "FB_ID");
   if (!ret)
     return false;
 
-  ret = crtc_x_prop_.Initialize(gpu_fd, "CRTC_X", plane_props);
+  ret = crtc_x_prop_.Initialize(kms, id_, "CRTC_X");
   if (!ret)
     return false;
 
-  ret = crtc_y_prop_.Initialize(gpu_fd, "CRTC_Y", plane_props);
+  ret = crtc_y_prop_.Initialize(kms, id_, "CRTC_Y");
   if (!ret)
     return false;
 
-  ret = crtc_w_prop_.Initialize(gpu_fd, "CRTC_W", plane_props);
+  ret = crtc_w_prop_.Initialize(kms, id_, "CRTC_W");
   if (!ret)
     return false;
 
-  ret = crtc_h_prop_.Initialize(gpu_fd, "CRTC_H", plane_props);
+  ret = crtc_h_prop_.Initialize(kms, id_, "CRTC_H");
   if (!ret)
     return false;
 
-  ret = src_x_prop_.Initialize(gpu_fd, "SRC_X", plane_props);
+  ret = src_x_prop_.Initialize(kms, id_, "SRC_X");
   if (!ret)
     return false;
 
-  ret = src_y_prop_.Initialize(gpu_fd, "SRC_Y", plane_props);
+  ret = src_y_prop_.Initialize(kms, id_, "SRC_Y");
   if (!ret)
     return false;
 
-  ret = src_w_prop_.Initialize(gpu_fd, "SRC_W", plane_props);
+  ret = src_w_prop_.Initialize(kms, id_, "SRC_W");
   if (!ret)
     return false;
 
-  ret = src_h_prop_.Initialize(gpu_fd, "SRC_H", plane_props);
+  ret = src_h_prop_.Initialize(kms, id_, "SRC_H");
   if (!ret)
     return false;
 
-  ret = rotation_prop_.Initialize(gpu_fd, "rotation", plane_props);
+  ret = rotation_prop_.Initialize(kms, id_, "rotation");
   if (!ret)
     ETRACE("Could not get rotation property");
 
-  ret = alpha_prop_.Initialize(gpu_fd, "alpha", plane_props);
+  ret = alpha_prop_.Initialize(kms, id_, "alpha");
   if (!ret)
     ETRACE("Could not get alpha property");
 
-  ret = in_fence_fd_prop_.Initialize(gpu_fd, "IN_FENCE_FD", plane_props);
+  ret = in_fence_fd_prop_.Initialize(kms, id_, "IN_FENCE_FD");
   if (!ret) {
     ETRACE("Could not get IN_FENCE_FD property");
     in_fence_fd_prop_.id = 0;
@@ -135,7 +119,7 @@ bool DisplayPlane::Initialize(uint32_t gpu_fd,
   return true;
 }
 
-bool DisplayPlane::UpdateProperties(drmModeAtomicReqPtr property_set,
+bool DisplayPlane::UpdateProperties(KMSPropertySet* property_set,
                                     uint32_t crtc_id,
                                     const OverlayLayer* layer) const {
   uint64_t alpha = 0xFF;
@@ -148,57 +132,54 @@ bool DisplayPlane::UpdateProperties(drmModeAtomicReqPtr property_set,
 
   IDISPLAYMANAGERTRACE("buffer->GetFb() ---------------------- STARTS %d",
                        buffer->GetFb());
-  int success =
-      drmModeAtomicAddProperty(property_set, id_, crtc_prop_.id, crtc_id) < 0;
-  success |= drmModeAtomicAddProperty(property_set, id_, fb_prop_.id,
-                                      buffer->GetFb()) < 0;
-  success |= drmModeAtomicAddProperty(property_set, id_, crtc_x_prop_.id,
-                                      display_frame.left) < 0;
-  success |= drmModeAtomicAddProperty(property_set, id_, crtc_y_prop_.id,
-                                      display_frame.top) < 0;
+  int success = property_set->AddProperty(id_, crtc_prop_.id, crtc_id) < 0;
+  success |= property_set->AddProperty(id_, fb_prop_.id, buffer->GetFb()) < 0;
+  success |= property_set->AddProperty(id_, crtc_x_prop_.id,
+                                       display_frame.left) < 0;
+  success |=
+      property_set->AddProperty(id_, crtc_y_prop_.id, display_frame.top) < 0;
   if (type_ == DRM_PLANE_TYPE_CURSOR) {
-    success |= drmModeAtomicAddProperty(property_set, id_, crtc_w_prop_.id,
-                                        buffer->GetWidth()) < 0;
-    success |= drmModeAtomicAddProperty(property_set, id_, crtc_h_prop_.id,
-                                        buffer->GetHeight()) < 0;
+    success |= property_set->AddProperty(id_, crtc_w_prop_.id,
+                                         buffer->GetWidth()) < 0;
+    success |= property_set->AddProperty(id_, crtc_h_prop_.id,
+                                         buffer->GetHeight()) < 0;
   } else {
-    success |= drmModeAtomicAddProperty(property_set, id_, crtc_w_prop_.id,
-                                        layer->GetDisplayFrameWidth()) < 0;
-    success |= drmModeAtomicAddProperty(property_set, id_, crtc_h_prop_.id,
-                                        layer->GetDisplayFrameHeight()) < 0;
+    success |= property_set->AddProperty(id_, crtc_w_prop_.id,
+                                         layer->GetDisplayFrameWidth()) < 0;
+    success |= property_set->AddProperty(id_, crtc_h_prop_.id,
+                                         layer->GetDisplayFrameHeight()) < 0;
   }
 
   success |=
-      drmModeAtomicAddProperty(property_set, id_, src_x_prop_.id,
-                               static_cast<int>(source_crop.left) << 16) < 0;
+      property_set->AddProperty(id_, src_x_prop_.id,
+                                static_cast<int>(source_crop.left) << 16) < 0;
   success |=
-      drmModeAtomicAddProperty(property_set, id_, src_y_prop_.id,
-                               static_cast<int>(source_crop.top) << 16) < 0;
+      property_set->AddProperty(id_, src_y_prop_.id,
+                                static_cast<int>(source_crop.top) << 16) < 0;
   if (type_ == DRM_PLANE_TYPE_CURSOR) {
-    success |= drmModeAtomicAddProperty(property_set, id_, src_w_prop_.id,
-                                        buffer->GetWidth() << 16) < 0;
-    success |= drmModeAtomicAddProperty(property_set, id_, src_h_prop_.id,
-                                        buffer->GetHeight() << 16) < 0;
+    success |= property_set->AddProperty(id_, src_w_prop_.id,
+                                         buffer->GetWidth() << 16) < 0;
+    success |= property_set->AddProperty(id_, src_h_prop_.id,
+                                         buffer->GetHeight() << 16) < 0;
   } else {
-    success |= drmModeAtomicAddProperty(property_set, id_, src_w_prop_.id,
-                                        layer->GetSourceCropWidth() << 16) < 0;
-    success |= drmModeAtomicAddProperty(property_set, id_, src_h_prop_.id,
-                                        layer->GetSourceCropHeight() << 16) < 0;
+    success |= property_set->AddProperty(
+                   id_, src_w_prop_.id, layer->GetSourceCropWidth() << 16) < 0;
+    success |= property_set->AddProperty(
+                   id_, src_h_prop_.id, layer->GetSourceCropHeight() << 16) < 0;
   }
 
   if (rotation_prop_.id) {
-    success = drmModeAtomicAddProperty(property_set, id_, rotation_prop_.id,
-                                       layer->GetRotation()) < 0;
+    success = property_set->AddProperty(id_, rotation_prop_.id,
+                                        layer->GetRotation()) < 0;
   }
 
   if (alpha_prop_.id) {
-    success =
-        drmModeAtomicAddProperty(property_set, id_, alpha_prop_.id, alpha) < 0;
+    success = property_set->AddProperty(id_, alpha_prop_.id, alpha) < 0;
   }
 
   if (fence != -1 && in_fence_fd_prop_.id) {
-    success = drmModeAtomicAddProperty(property_set, id_, in_fence_fd_prop_.id,
-                                       fence) < 0;
+    success =
+        property_set->AddProperty(id_, in_fence_fd_prop_.id, fence) < 0;
   }
 
   if (success) {
@@ -210,11 +191,10 @@ bool DisplayPlane::UpdateProperties(drmModeAtomicReqPtr property_set,
   return true;
 }
 
-bool DisplayPlane::Disable(drmModeAtomicReqPtr property_set) {
+bool DisplayPlane::Disable(KMSPropertySet* property_set) {
   enabled_ = false;
-  int success =
-      drmModeAtomicAddProperty(property_set, id_, crtc_prop_.id, 0) < 0;
-  success |= drmModeAtomicAddProperty(property_set, id_, fb_prop_.id, 0) < 0;
+  int success = property_set->AddProperty(id_, crtc_prop_.id, 0) < 0;
+  success |= property_set->AddProperty(id_, fb_prop_.id, 0) < 0;
 
   if (success) {
     ETRACE("Failed to disable plane with id: %d", id_);
@@ -21,10 +21,10 @@
 #include <stdint.h>
 #include <xf86drmMode.h>
 
-#include <drmscopedtypes.h>
-
 #include <vector>
 
+#include "kmsbackend.h"
+
 namespace hwcomposer {
 
 class GpuDevice;
@@ -36,14 +36,14 @@ class DisplayPlane {
 
   ~DisplayPlane();
 
-  bool Initialize(uint32_t gpu_fd, const std::vector<uint32_t>& formats);
+  bool Initialize(KMSBackend* kms, const std::vector<uint32_t>& formats);
 
-  bool UpdateProperties(drmModeAtomicReqPtr property_set, uint32_t crtc_id,
+  bool UpdateProperties(KMSPropertySet* property_set, uint32_t crtc_id,
                         const OverlayLayer* layer) const;
 
   bool ValidateLayer(const OverlayLayer* layer);
 
-  bool Disable(drmModeAtomicReqPtr property_set);
+  bool Disable(KMSPropertySet* property_set);
 
   uint32_t id() const;
 
@@ -66,8 +66,7 @@ class DisplayPlane {
  private:
   struct Property {
     Property();
-    bool Initialize(uint32_t fd, const char* name,
-                    const ScopedDrmObjectPropertyPtr& plane_properties);
+    bool Initialize(KMSBackend* kms, uint32_t plane_id, const char* name);
     uint32_t id = 0;
   };
 
@@ -30,13 +30,27 @@
 
 namespace hwcomposer {
 
-DisplayPlaneManager::DisplayPlaneManager(int gpu_fd, uint32_t crtc_id,
+// Upper bound on number of plane configurations we remember.
+static const size_t kMaxTestCommitCacheSize = 128;
+// Offscreen targets are allocated in steps of this many pixels, so
+// that planes changing size slightly can still use the same targets.
+static const uint32_t kOffScreenSizeAlignment = 64;
+// Number of frames a free offscreen target is kept around.
+static const uint32_t kMaxIdleFrames = 60;
+
+static uint32_t GetSizeClass(uint32_t size, uint32_t max_size) {
+  uint32_t mask = kOffScreenSizeAlignment - 1;
+  size = (size + mask) & ~mask;
+  return size < max_size ? size : max_size;
+}
+
+DisplayPlaneManager::DisplayPlaneManager(KMSBackend *kms, uint32_t crtc_id,
                                          OverlayBufferManager *buffer_manager)
     : buffer_manager_(buffer_manager),
       width_(0),
       height_(0),
       crtc_id_(crtc_id),
-      gpu_fd_(gpu_fd) {
+      kms_(kms) {
 }
 
 DisplayPlaneManager::~DisplayPlaneManager() {
@@ -44,35 +58,22 @@ DisplayPlaneManager::~DisplayPlaneManager() {
 
 bool DisplayPlaneManager::Initialize(uint32_t pipe_id, uint32_t width,
                                      uint32_t height) {
-  ScopedDrmPlaneResPtr plane_resources(drmModeGetPlaneResources(gpu_fd_));
-  if (!plane_resources) {
+  std::vector<KMSPlane> kms_planes;
+  if (!kms_->GetPlanes(&kms_planes)) {
     ETRACE("Failed to get plane resources");
     return false;
   }
 
-  uint32_t num_planes = plane_resources->count_planes;
   uint32_t pipe_bit = 1 << pipe_id;
   std::set<uint32_t> plane_ids;
-  for (uint32_t i = 0; i < num_planes; ++i) {
-    ScopedDrmPlanePtr drm_plane(
-        drmModeGetPlane(gpu_fd_, plane_resources->planes[i]));
-    if (!drm_plane) {
-      ETRACE("Failed to get plane ");
-      return false;
-    }
-
-    if (!(pipe_bit & drm_plane->possible_crtcs))
+  for (const KMSPlane &kms_plane : kms_planes) {
+    if (!(pipe_bit & kms_plane.possible_crtcs))
       continue;
 
-    uint32_t formats_size = drm_plane->count_formats;
-    plane_ids.insert(drm_plane->plane_id);
+    plane_ids.insert(kms_plane.id);
     std::unique_ptr<DisplayPlane> plane(
-        CreatePlane(drm_plane->plane_id, drm_plane->possible_crtcs));
-    std::vector<uint32_t> supported_formats(formats_size);
-    for (uint32_t j = 0; j < formats_size; j++)
-      supported_formats[j] = drm_plane->formats[j];
-
-    if (plane->Initialize(gpu_fd_, supported_formats)) {
+        CreatePlane(kms_plane.id, kms_plane.possible_crtcs));
+    if (plane->Initialize(kms_, kms_plane.formats)) {
       if (plane->type() == DRM_PLANE_TYPE_CURSOR) {
         cursor_plane_.reset(plane.release());
       } else if (plane->type() == DRM_PLANE_TYPE_PRIMARY) {
@@ -97,6 +98,7 @@ bool DisplayPlaneManager::Initialize(uint32_t pipe_id, uint32_t width,
 
   width_ = width;
   height_ = height;
+  InvalidateTestCommitCache();
 
   return true;
 }
@@ -219,7 +221,7 @@ std::tuple<bool, DisplayPlaneStateList> DisplayPlaneManager::ValidateLayers(
 }
 
 bool DisplayPlaneManager::CommitFrame(const DisplayPlaneStateList &comp_planes,
-                                      drmModeAtomicReqPtr pset,
+                                      KMSPropertySet *pset,
                                       uint32_t flags) {
   CTRACE();
   if (!pset) {
@@ -258,16 +260,18 @@ bool DisplayPlaneManager::CommitFrame(const DisplayPlaneStateList &comp_planes,
     plane->Disable(pset);
   }
 
-  int ret = drmModeAtomicCommit(gpu_fd_, pset, flags, NULL);
+  int ret = kms_->Commit(pset, flags);
   if (ret) {
-    ETRACE("Failed to commit pset ret=%s\n", PRINTERROR());
+    ETRACE("Failed to commit pset ret=%s\n", strerror(-ret));
     return false;
   }
 
   return true;
 }
 
-void DisplayPlaneManager::DisablePipe(drmModeAtomicReqPtr property_set) {
+void DisplayPlaneManager::DisablePipe(
+    KMSPropertySet *property_set,
+    std::vector<std::unique_ptr<NativeSurface>> *released) {
   CTRACE();
   // Disable planes.
   if (cursor_plane_)
@@ -279,52 +283,146 @@ void DisplayPlaneManager::DisablePipe(drmModeAtomicReqPtr property_set) {
 
   primary_plane_->Disable(property_set);
 
-  int ret = drmModeAtomicCommit(gpu_fd_, property_set,
-                                DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+  int ret = kms_->Commit(property_set, DRM_MODE_ATOMIC_ALLOW_MODESET);
   if (ret)
-    ETRACE("Failed to disable pipe:%s\n", PRINTERROR());
+    ETRACE("Failed to disable pipe:%s\n", strerror(-ret));
+
+  for (OffScreenTarget &target : surfaces_)
+    released->emplace_back(std::move(target.surface_));
+
+  std::vector<OffScreenTarget>().swap(surfaces_);
+  InvalidateTestCommitCache();
+}
 
-  std::vector<std::unique_ptr<NativeSurface>>().swap(surfaces_);
+void DisplayPlaneManager::InvalidateTestCommitCache() {
+  test_commit_cache_.clear();
+}
+
+void DisplayPlaneManager::GetTestCommitSignature(
+    const std::vector<OverlayPlane> &commit_planes,
+    std::vector<uint32_t> *signature) const {
+  signature->reserve(commit_planes.size() * 18);
+  for (const OverlayPlane &commit_plane : commit_planes) {
+    const OverlayLayer *layer = commit_plane.layer;
+    const OverlayBuffer *buffer = layer->GetBuffer();
+    // Everything DisplayPlane::UpdateProperties sets, other than the
+    // framebuffer and fence, and what of the buffer the framebuffer
+    // depends on.
+    signature->emplace_back(commit_plane.plane->id());
+    signature->emplace_back(buffer->GetFormat());
+    signature->emplace_back(buffer->GetModifier() & 0xFFFFFFFF);
+    signature->emplace_back(buffer->GetModifier() >> 32);
+    signature->emplace_back(buffer->GetWidth());
+    signature->emplace_back(buffer->GetHeight());
+    signature->emplace_back(buffer->GetStride());
+    signature->emplace_back(static_cast<int>(layer->GetSourceCrop().left));
+    signature->emplace_back(static_cast<int>(layer->GetSourceCrop().top));
+    signature->emplace_back(layer->GetSourceCropWidth());
+    signature->emplace_back(layer->GetSourceCropHeight());
+    signature->emplace_back(layer->GetDisplayFrame().left);
+    signature->emplace_back(layer->GetDisplayFrame().top);
+    signature->emplace_back(layer->GetDisplayFrameWidth());
+    signature->emplace_back(layer->GetDisplayFrameHeight());
+    signature->emplace_back(layer->GetRotation());
+    signature->emplace_back(layer->GetAlpha());
+    signature->emplace_back(static_cast<uint32_t>(layer->GetBlending()));
+  }
 }
 
 bool DisplayPlaneManager::TestCommit(
     const std::vector<OverlayPlane> &commit_planes) const {
-  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+  std::vector<uint32_t> signature;
+  GetTestCommitSignature(commit_planes, &signature);
+  auto cached = test_commit_cache_.find(signature);
+  if (cached != test_commit_cache_.end()) {
+    test_commit_cache_hits_++;
+    return cached->second;
+  }
+
+  test_commit_cache_misses_++;
+  std::unique_ptr<KMSPropertySet> pset(kms_->CreatePropertySet());
+  if (!pset) {
+    ETRACE("Failed to allocate property set %d", -ENOMEM);
+    return false;
+  }
+
   for (auto i = commit_planes.begin(); i != commit_planes.end(); i++) {
     if (!(i->plane->UpdateProperties(pset.get(), crtc_id_, i->layer))) {
       return false;
     }
   }
 
-  if (drmModeAtomicCommit(gpu_fd_, pset.get(), DRM_MODE_ATOMIC_TEST_ONLY,
-                          NULL)) {
-    IDISPLAYMANAGERTRACE("Test Commit Failed. %s ", PRINTERROR());
-    return false;
+  bool result = true;
+  int ret = kms_->Commit(pset.get(), DRM_MODE_ATOMIC_TEST_ONLY);
+  if (ret) {
+    IDISPLAYMANAGERTRACE("Test Commit Failed. %s ", strerror(-ret));
+    result = false;
   }
 
-  return true;
+  if (test_commit_cache_.size() >= kMaxTestCommitCacheSize)
+    test_commit_cache_.clear();
+
+  test_commit_cache_.emplace(std::move(signature), result);
+  IDISPLAYMANAGERTRACE("Test Commit cache hits: %u misses: %u",
+                       test_commit_cache_hits_, test_commit_cache_misses_);
+  return result;
 }
 
 void DisplayPlaneManager::EnsureOffScreenTarget(DisplayPlaneState &plane) {
   NativeSurface *surface = NULL;
-  for (auto &fb : surfaces_) {
-    if (!fb->InUse()) {
-      surface = fb.get();
-      break;
-    }
+  const HwcRect<int> &display_rect = plane.GetDisplayFrame();
+  uint32_t width =
+      GetSizeClass(display_rect.right - display_rect.left, width_);
+  uint32_t height =
+      GetSizeClass(display_rect.bottom - display_rect.top, height_);
+  const HwcRect<int> &surface_damage = plane.GetSurfaceDamage();
+  for (OffScreenTarget &target : surfaces_) {
+    NativeSurface *fb = target.surface_.get();
+    // Content of every surface not rendered this frame is now
+    // stale in the damaged area.
+    fb->UpdateSurfaceDamage(surface_damage);
+    if (surface || fb->InUse() || target.width_ != width ||
+        target.height_ != height)
+      continue;
+
+    // Re-using the framebuffer of the surface requires the
+    // plane to scan it out in the same format.
+    uint32_t format = fb->GetFramebufferFormat();
+    if (format &&
+        plane.plane()->GetFormatForFrameBuffer(
+            fb->GetLayer()->GetBuffer()->GetFormat()) != format)
+      continue;
+
+    surface = fb;
+    target.last_used_frame_ = frame_;
   }
 
   if (!surface) {
-    NativeSurface *new_surface = CreateBackBuffer(width_, height_);
+    std::unique_ptr<NativeSurface> new_surface(CreateBackBuffer(width, height));
     new_surface->Init(buffer_manager_);
-    surfaces_.emplace_back(std::move(new_surface));
-    surface = surfaces_.back().get();
+    surface = new_surface.get();
+    surfaces_.emplace_back(
+        OffScreenTarget{std::move(new_surface), width, height, frame_});
   }
 
-  surface->SetPlaneTarget(plane, gpu_fd_);
+  surface->SetPlaneTarget(plane, kms_);
   plane.SetOffScreenTarget(surface);
 }
 
+void DisplayPlaneManager::ReleaseFreeOffScreenTargets(
+    std::vector<std::unique_ptr<NativeSurface>> *released) {
+  frame_++;
+  for (auto it = surfaces_.begin(); it != surfaces_.end();) {
+    if (!it->surface_->InUse() &&
+        frame_ - it->last_used_frame_ > kMaxIdleFrames) {
+      released->emplace_back(std::move(it->surface_));
+      it = surfaces_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 void DisplayPlaneManager::ValidateFinalLayers(
     DisplayPlaneStateList &composition,
     std::vector<OverlayLayer> &layers) {
@@ -369,7 +467,7 @@ bool DisplayPlaneManager::FallbacktoGPU(
     return true;
 
   if (layer->GetBuffer()->GetFb() == 0) {
-    if (!layer->GetBuffer()->CreateFrameBuffer(gpu_fd_)) {
+    if (!layer->GetBuffer()->CreateFrameBuffer(kms_)) {
       return true;
     }
   }
@@ -31,6 +31,7 @@
 #include "nativesync.h"
 
 #include "displayplanestate.h"
+#include "kmsbackend.h"
 
 namespace hwcomposer {
 
@@ -42,7 +43,7 @@ struct OverlayLayer;
 
 class DisplayPlaneManager {
  public:
-  DisplayPlaneManager(int gpu_fd, uint32_t crtc_id,
+  DisplayPlaneManager(KMSBackend *kms, uint32_t crtc_id,
                       OverlayBufferManager *buffer_manager);
 
   virtual ~DisplayPlaneManager();
@@ -54,14 +55,38 @@ class DisplayPlaneManager {
       bool disable_overlay);
 
   bool CommitFrame(const DisplayPlaneStateList &planes,
-                   drmModeAtomicReqPtr property_set, uint32_t flags);
+                   KMSPropertySet *property_set, uint32_t flags);
 
-  void DisablePipe(drmModeAtomicReqPtr property_set);
+  // Turns off all planes. Offscreen targets are moved to released,
+  // they need to be destroyed with the renderer context current.
+  void DisablePipe(KMSPropertySet *property_set,
+                   std::vector<std::unique_ptr<NativeSurface>> *released);
 
   bool CheckPlaneFormat(uint32_t format);
 
+  // Picks a free offscreen target for plane from the pool, matching
+  // size class of its display frame and framebuffer format. A new one
+  // is allocated in case there is none.
   void EnsureOffScreenTarget(DisplayPlaneState &plane);
 
+  // Moves offscreen targets which have not been used for a while to
+  // released. Expected to be called once per frame. Targets need to be
+  // destroyed with the renderer context current.
+  void ReleaseFreeOffScreenTargets(
+      std::vector<std::unique_ptr<NativeSurface>> *released);
+
+  // Drops all cached TEST_ONLY results. Needs to be called whenever
+  // the pipe configuration changes i.e. modeset, hotplug or DPMS.
+  void InvalidateTestCommitCache();
+
+  uint32_t GetTestCommitCacheHits() const {
+    return test_commit_cache_hits_;
+  }
+
+  uint32_t GetTestCommitCacheMisses() const {
+    return test_commit_cache_misses_;
+  }
+
  protected:
   struct OverlayPlane {
    public:
@@ -82,16 +107,34 @@ class DisplayPlaneManager {
   void ValidateFinalLayers(DisplayPlaneStateList &list,
 			   std::vector<OverlayLayer> &layers);
 
+  // Builds a compact signature of plane configuration to be used as key
+  // for test_commit_cache_.
+  void GetTestCommitSignature(const std::vector<OverlayPlane> &commit_planes,
+                              std::vector<uint32_t> *signature) const;
+
+  struct OffScreenTarget {
+    std::unique_ptr<NativeSurface> surface_;
+    // Size of the buffer, i.e. the size class.
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t last_used_frame_;
+  };
+
   OverlayBufferManager *buffer_manager_;
-  std::vector<std::unique_ptr<NativeSurface>> surfaces_;
+  std::vector<OffScreenTarget> surfaces_;
   std::unique_ptr<DisplayPlane> primary_plane_;
   std::unique_ptr<DisplayPlane> cursor_plane_;
   std::vector<std::unique_ptr<DisplayPlane>> overlay_planes_;
+  // Results of previous TEST_ONLY commits, keyed by plane configuration.
+  mutable std::map<std::vector<uint32_t>, bool> test_commit_cache_;
+  mutable uint32_t test_commit_cache_hits_ = 0;
+  mutable uint32_t test_commit_cache_misses_ = 0;
 
   uint32_t width_;
   uint32_t height_;
+  uint32_t frame_ = 0;
   uint32_t crtc_id_;
-  uint32_t gpu_fd_;
+  KMSBackend *kms_;
 };
 
 }  // namespace hwcomposer
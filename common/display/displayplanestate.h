@@ -89,6 +89,20 @@ class DisplayPlaneState {
     state_ = state;
   }
 
+  // Part of display frame which needs to be re-composited
+  // for this frame. Whole display frame unless set.
+  void SetSurfaceDamage(const HwcRect<int> &surface_damage) {
+    surface_damage_ = surface_damage;
+    has_surface_damage_ = true;
+  }
+
+  const HwcRect<int> &GetSurfaceDamage() const {
+    if (has_surface_damage_)
+      return surface_damage_;
+
+    return display_frame_;
+  }
+
   void ForceGPURendering() {
     state_ = State::kRender;
   }
@@ -131,6 +145,8 @@ class DisplayPlaneState {
   const OverlayLayer *layer_ = NULL;
   NativeSurface *offscreen_target_ = NULL;
   HwcRect<int> display_frame_;
+  HwcRect<int> surface_damage_;
+  bool has_surface_damage_ = false;
   std::vector<size_t> source_layers_;
   std::vector<CompositionRegion> composition_region_;
 };
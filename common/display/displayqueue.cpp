@@ -24,14 +24,19 @@
 
 #include "displayplanemanager.h"
 #include "hwctrace.h"
+#include "hwcutils.h"
 #include "overlaylayer.h"
 #include "vblankeventhandler.h"
 #include "nativesurface.h"
 
 namespace hwcomposer {
 
-DisplayQueue::DisplayQueue(uint32_t gpu_fd, uint32_t crtc_id,
-                           OverlayBufferManager* buffer_manager)
+// Squashing fewer layers saves neither planes nor composition.
+static const size_t kMinSquashLayers = 2;
+
+DisplayQueue::DisplayQueue(KMSBackend* kms, uint32_t crtc_id,
+                           OverlayBufferManager* buffer_manager,
+                           RendererService* renderer_service)
     : frame_(0),
       dpms_prop_(0),
       out_fence_ptr_prop_(0),
@@ -43,27 +48,38 @@ DisplayQueue::DisplayQueue(uint32_t gpu_fd, uint32_t crtc_id,
       crtc_prop_(0),
       blob_id_(0),
       old_blob_id_(0),
-      gpu_fd_(gpu_fd),
+      kms_(kms),
       lut_size_(0),
       broadcastrgb_id_(0),
       broadcastrgb_full_(-1),
       broadcastrgb_automatic_(-1),
-      buffer_manager_(buffer_manager) {
-  compositor_.Init();
-  ScopedDrmObjectPropertyPtr crtc_props(
-      drmModeObjectGetProperties(gpu_fd_, crtc_id_, DRM_MODE_OBJECT_CRTC));
-  GetDrmObjectProperty("ACTIVE", crtc_props, &active_prop_);
-  GetDrmObjectProperty("MODE_ID", crtc_props, &mode_id_prop_);
-  GetDrmObjectProperty("GAMMA_LUT", crtc_props, &lut_id_prop_);
-  GetDrmObjectPropertyValue("GAMMA_LUT_SIZE", crtc_props, &lut_size_);
-  GetDrmObjectProperty("OUT_FENCE_PTR", crtc_props, &out_fence_ptr_prop_);
+      buffer_manager_(buffer_manager),
+      idle_frames_("idleframes", 60, false),
+      squash_frames_("squashframes", 30, false) {
+  compositor_.Init(renderer_service);
+  GetDrmObjectProperty("ACTIVE", crtc_id_, DRM_MODE_OBJECT_CRTC, &active_prop_);
+  GetDrmObjectProperty("MODE_ID", crtc_id_, DRM_MODE_OBJECT_CRTC,
+                       &mode_id_prop_);
+  GetDrmObjectProperty("GAMMA_LUT", crtc_id_, DRM_MODE_OBJECT_CRTC,
+                       &lut_id_prop_);
+  GetDrmObjectPropertyValue("GAMMA_LUT_SIZE", crtc_id_, DRM_MODE_OBJECT_CRTC,
+                            &lut_size_);
+  GetDrmObjectProperty("OUT_FENCE_PTR", crtc_id_, DRM_MODE_OBJECT_CRTC,
+                       &out_fence_ptr_prop_);
   disable_overlay_usage_ = out_fence_ptr_prop_ == 0;
 
   memset(&mode_, 0, sizeof(mode_));
+  if (!release_timeline_.Init())
+    ETRACE("Failed to create release timeline.");
+
+  if (!retire_timeline_.Init())
+    ETRACE("Failed to create retire timeline.");
+
   display_plane_manager_.reset(
-      new DisplayPlaneManager(gpu_fd_, crtc_id_, buffer_manager_));
+      new DisplayPlaneManager(kms_, crtc_id_, buffer_manager_));
 
   kms_fence_handler_.reset(new KMSFenceEventHandler(this));
+  commit_thread_.reset(new DisplayCommitThread(this));
   /* use 0x80 as default brightness for all colors */
   brightness_ = 0x808080;
   /* use 0x80 as default brightness for all colors */
@@ -77,18 +93,18 @@ DisplayQueue::DisplayQueue(uint32_t gpu_fd, uint32_t crtc_id,
 
 DisplayQueue::~DisplayQueue() {
   if (blob_id_)
-    drmModeDestroyPropertyBlob(gpu_fd_, blob_id_);
+    kms_->DestroyPropertyBlob(blob_id_);
 
   if (old_blob_id_)
-    drmModeDestroyPropertyBlob(gpu_fd_, old_blob_id_);
+    kms_->DestroyPropertyBlob(old_blob_id_);
 }
 
 bool DisplayQueue::Initialize(uint32_t width, uint32_t height, uint32_t pipe,
                               uint32_t connector,
                               const drmModeModeInfo& mode_info) {
   frame_ = 0;
-  previous_layers_.clear();
-  previous_plane_state_.clear();
+  previous_frame_.reset();
+  committed_frame_.reset();
 
   if (!display_plane_manager_->Initialize(pipe, width, height)) {
     ETRACE("Failed to initialize DisplayQueue Manager.");
@@ -97,44 +113,30 @@ bool DisplayQueue::Initialize(uint32_t width, uint32_t height, uint32_t pipe,
 
   connector_ = connector;
   mode_ = mode_info;
+  scheduler_.SetMode(mode_info);
 
-  ScopedDrmObjectPropertyPtr connector_props(drmModeObjectGetProperties(
-      gpu_fd_, connector_, DRM_MODE_OBJECT_CONNECTOR));
-  if (!connector_props) {
-    ETRACE("Unable to get connector properties.");
-    return false;
-  }
-
-  GetDrmObjectProperty("DPMS", connector_props, &dpms_prop_);
-  GetDrmObjectProperty("CRTC_ID", connector_props, &crtc_prop_);
-  GetDrmObjectProperty("Broadcast RGB", connector_props, &broadcastrgb_id_);
-
-  drmModePropertyPtr broadcastrgb_props =
-      drmModeGetProperty(gpu_fd_, broadcastrgb_id_);
+  GetDrmObjectProperty("DPMS", connector_, DRM_MODE_OBJECT_CONNECTOR,
+                       &dpms_prop_);
+  GetDrmObjectProperty("CRTC_ID", connector_, DRM_MODE_OBJECT_CONNECTOR,
+                       &crtc_prop_);
+  GetDrmObjectProperty("Broadcast RGB", connector_, DRM_MODE_OBJECT_CONNECTOR,
+                       &broadcastrgb_id_);
 
   // This is a valid case on DSI panels.
-  if (!broadcastrgb_props)
+  if (!broadcastrgb_id_)
     return true;
 
-  if (!(broadcastrgb_props->flags & DRM_MODE_PROP_ENUM))
-    return false;
-
-  for (int i = 0; i < broadcastrgb_props->count_enums; i++) {
-    if (!strcmp(broadcastrgb_props->enums[i].name, "Full")) {
-      broadcastrgb_full_ = broadcastrgb_props->enums[i].value;
-    } else if (!strcmp(broadcastrgb_props->enums[i].name, "Automatic")) {
-      broadcastrgb_automatic_ = broadcastrgb_props->enums[i].value;
-    }
-  }
-  drmModeFreeProperty(broadcastrgb_props);
+  broadcastrgb_full_ = kms_->GetPropertyEnumValue(broadcastrgb_id_, "Full");
+  broadcastrgb_automatic_ =
+      kms_->GetPropertyEnumValue(broadcastrgb_id_, "Automatic");
 
   return true;
 }
 
-bool DisplayQueue::GetFence(drmModeAtomicReqPtr property_set,
+bool DisplayQueue::GetFence(KMSPropertySet* property_set,
                             int32_t* out_fence) {
-  int ret = drmModeAtomicAddProperty(property_set, crtc_id_,
-                                     out_fence_ptr_prop_, (uintptr_t)out_fence);
+  int ret = property_set->AddProperty(crtc_id_, out_fence_ptr_prop_,
+                                      (uintptr_t)out_fence);
   if (ret < 0) {
     ETRACE("Failed to add OUT_FENCE_PTR property to pset: %d", ret);
     return false;
@@ -143,25 +145,22 @@ bool DisplayQueue::GetFence(drmModeAtomicReqPtr property_set,
   return true;
 }
 
-bool DisplayQueue::ApplyPendingModeset(drmModeAtomicReqPtr property_set) {
+bool DisplayQueue::ApplyPendingModeset(KMSPropertySet* property_set) {
   if (old_blob_id_) {
-    drmModeDestroyPropertyBlob(gpu_fd_, old_blob_id_);
+    kms_->DestroyPropertyBlob(old_blob_id_);
     old_blob_id_ = 0;
   }
 
-  drmModeCreatePropertyBlob(gpu_fd_, &mode_, sizeof(drmModeModeInfo),
-                            &blob_id_);
+  blob_id_ = kms_->CreatePropertyBlob(&mode_, sizeof(drmModeModeInfo));
   if (blob_id_ == 0)
     return false;
 
   bool active = true;
 
-  int ret = drmModeAtomicAddProperty(property_set, crtc_id_, mode_id_prop_,
-                                     blob_id_) < 0 ||
-            drmModeAtomicAddProperty(property_set, connector_, crtc_prop_,
-                                     crtc_id_) < 0 ||
-            drmModeAtomicAddProperty(property_set, crtc_id_, active_prop_,
-                                     active) < 0;
+  int ret =
+      property_set->AddProperty(crtc_id_, mode_id_prop_, blob_id_) < 0 ||
+      property_set->AddProperty(connector_, crtc_prop_, crtc_id_) < 0 ||
+      property_set->AddProperty(crtc_id_, active_prop_, active) < 0;
   if (ret) {
     ETRACE("Failed to add blob %d to pset", blob_id_);
     return false;
@@ -185,13 +184,19 @@ bool DisplayQueue::SetPowerMode(uint32_t power_mode) {
       break;
     case kOn:
       needs_modeset_ = true;
+      // Flips seen before the pipe was off don't predict vblanks.
+      scheduler_.SetMode(mode_);
+      display_plane_manager_->InvalidateTestCommitCache();
       needs_color_correction_ = true;
       flags_ = DRM_MODE_ATOMIC_ALLOW_MODESET;
-      drmModeConnectorSetProperty(gpu_fd_, connector_, dpms_prop_,
-                                  DRM_MODE_DPMS_ON);
+      kms_->SetProperty(connector_, DRM_MODE_OBJECT_CONNECTOR, dpms_prop_,
+                        DRM_MODE_DPMS_ON);
 
       if (!kms_fence_handler_->Initialize())
         return false;
+
+      if (!commit_thread_->Initialize())
+        return false;
       break;
     default:
       break;
@@ -205,7 +210,7 @@ void DisplayQueue::GetCachedLayers(const std::vector<OverlayLayer>& layers,
                                    bool* render_layers) {
   CTRACE();
   bool needs_gpu_composition = false;
-  for (const DisplayPlaneState& plane : previous_plane_state_) {
+  for (const DisplayPlaneState& plane : previous_frame_->planes_) {
     bool region_changed = false;
     composition->emplace_back(plane.plane());
     DisplayPlaneState& last_plane = composition->back();
@@ -224,17 +229,28 @@ void DisplayQueue::GetCachedLayers(const std::vector<OverlayLayer>& layers,
         }
       }
 
-      display_plane_manager_->EnsureOffScreenTarget(last_plane);
       if (!region_changed) {
         const std::vector<CompositionRegion>& comp_regions =
             plane.GetCompositionRegion();
         last_plane.GetCompositionRegion().assign(comp_regions.begin(),
                                                  comp_regions.end());
+        // Layout is same as last frame, only content which
+        // changed needs to be composited again.
+        HwcRect<int> surface_damage(0, 0, 0, 0);
+        for (size_t i = 0; i < layers_size; i++) {
+          surface_damage = UnionRect(
+              surface_damage,
+              layers.at(source_layers.at(i)).GetSurfaceDamage());
+        }
+
+        last_plane.SetSurfaceDamage(surface_damage);
       }
+
+      display_plane_manager_->EnsureOffScreenTarget(last_plane);
     } else {
       const OverlayLayer* layer =
           &(*(layers.begin() + last_plane.source_layers().front()));
-      layer->GetBuffer()->CreateFrameBuffer(gpu_fd_);
+      layer->GetBuffer()->CreateFrameBuffer(kms_);
       last_plane.SetOverlayLayer(layer);
     }
   }
@@ -245,12 +261,30 @@ void DisplayQueue::GetCachedLayers(const std::vector<OverlayLayer>& layers,
 bool DisplayQueue::QueueUpdate(std::vector<HwcLayer*>& source_layers,
                                int32_t* retire_fence) {
   CTRACE();
+  int64_t start = CommitScheduler::Now();
   size_t size = source_layers.size();
-  size_t previous_size = previous_layers_.size();
-  std::vector<OverlayLayer> layers;
+  size_t previous_size =
+      previous_frame_ ? previous_frame_->client_layers_.size() : 0;
+  std::shared_ptr<DisplayFrame> frame(new DisplayFrame());
+  std::vector<OverlayLayer>& layers = frame->layers_;
   std::vector<HwcRect<int>> layers_rects;
+  std::vector<NativeSurface*> freed_surfaces;
   bool layers_changed = false;
+  // Committing a frame which shows the same buffers, unchanged and
+  // with the same attributes, as the last one wouldn't change what
+  // is on screen.
+  bool same_frame = use_layer_cache_ && !needs_modeset_ &&
+                    !needs_color_correction_ && previous_frame_ &&
+                    !previous_frame_->dropped_ && size == previous_size;
   spin_lock_.lock();
+  buffer_manager_->ReclaimStaleBuffers();
+  // Offscreen targets of frames which are no longer on screen can
+  // be composited to again.
+  freed_surfaces.swap(freed_surfaces_);
+  // They may still be scanned out till the last commit's out fence
+  // signals. The fence goes with each target, so that renderers only
+  // wait for it when drawing to targets of this display.
+  int render_fence = freed_surfaces.empty() ? -1 : render_fence_.Release();
   for (size_t layer_index = 0; layer_index < size; layer_index++) {
     HwcLayer* layer = source_layers.at(layer_index);
     const HwcRegion& current_surface_damage = layer->GetSurfaceDamage();
@@ -267,27 +301,108 @@ bool DisplayQueue::QueueUpdate(std::vector<HwcLayer*>& source_layers,
     ImportedBuffer* buffer =
         buffer_manager_->CreateBufferFromNativeHandle(layer->GetNativeHandle());
     overlay_layer.SetBuffer(buffer);
-    int ret = layer->release_fence.Reset(overlay_layer.GetReleaseFence());
-    if (ret < 0)
-      ETRACE("Failed to create fence for layer, error: %s", PRINTERROR());
 
     if (!use_layer_cache_)
       continue;
 
     if (previous_size > layer_index) {
-      overlay_layer.SetSurfaceDamage(current_surface_damage,
-                                     previous_layers_.at(layer_index));
+      const OverlayLayer& previous_layer =
+          *previous_frame_->client_layers_.at(layer_index);
+      overlay_layer.SetSurfaceDamage(current_surface_damage, previous_layer);
+      if (overlay_layer.GetBuffer() == previous_layer.GetBuffer() &&
+          !overlay_layer.HasLayerPositionChanged() &&
+          !overlay_layer.HasLayerAttributesChanged() &&
+          IsEmptyRect(overlay_layer.GetSurfaceDamage())) {
+        overlay_layer.SetStaticFrameCount(
+            previous_layer.GetStaticFrameCount() + 1);
+      } else {
+        same_frame = false;
+      }
     }
 
     if (overlay_layer.HasLayerAttributesChanged()) {
       layers_changed = true;
+      same_frame = false;
     }
   }
 
+  // Once the stack has been static for long enough, compose it into
+  // the primary plane so that other planes can be turned off.
+  bool collapse = false;
+  if (same_frame) {
+    static_frames_++;
+    int32_t idle_frames = idle_frames_.get();
+    collapse = !collapsed_ && idle_frames > 0 &&
+               static_frames_ >= static_cast<uint32_t>(idle_frames) &&
+               previous_frame_->planes_.size() > 1;
+    same_frame = !collapse;
+  } else {
+    static_frames_ = 0;
+  }
+
+  if (same_frame) {
+    buffer_manager_->UnRegisterLayerBuffers(layers);
+  } else {
+    // All layers of this frame are released together, they share
+    // one point on the release timeline.
+    frame->release_fence_.Reset(release_timeline_.CreateNextTimelineFence());
+    frame->release_point_ = release_timeline_.GetTimelinePoint();
+    // Frame is committed asynchronously, the retire fence is
+    // signalled once it's on screen.
+    frame->retire_fence_.Reset(retire_timeline_.CreateNextTimelineFence());
+    frame->retire_point_ = retire_timeline_.GetTimelinePoint();
+  }
+
   spin_lock_.unlock();
 
-  if (!use_layer_cache_ || size != previous_size) {
+  for (NativeSurface* surface : freed_surfaces) {
+    if (render_fence > 0)
+      surface->SetKMSFence(dup(render_fence));
+
+    surface->SetInUse(false);
+  }
+
+  if (render_fence > 0)
+    close(render_fence);
+
+  // Buffers stay on screen till the previous frame is replaced,
+  // its fences apply to this frame as well.
+  const DisplayFrame* fence_frame =
+      same_frame ? previous_frame_.get() : frame.get();
+  int release_fence = fence_frame->release_fence_.get();
+  for (HwcLayer* layer : source_layers) {
+    int ret = layer->release_fence.Reset(dup(release_fence));
+    if (ret < 0)
+      ETRACE("Failed to create fence for layer, error: %s", PRINTERROR());
+  }
+
+  if (same_frame) {
+    skipped_commits_++;
+    IDISPLAYMANAGERTRACE("Skipped redundant commit, total: %d",
+                         skipped_commits_);
+    *retire_fence = dup(previous_frame_->retire_fence_.get());
+    ReleaseSurfaces();
+    return true;
+  }
+
+  if (!use_layer_cache_ || !previous_frame_ || size != previous_size) {
+    layers_changed = true;
+  }
+
+  if (collapse) {
+    collapsed_ = true;
+    collapsed_since_ = start;
+    idle_collapses_++;
+  } else if (collapsed_) {
+    // Content changed, layers get their own planes again. The frame
+    // is validated from scratch and committed atomically, so the
+    // switch doesn't show.
+    collapsed_ = false;
+    collapsed_time_ += start - collapsed_since_;
     layers_changed = true;
+    IDISPLAYMANAGERTRACE("Idle collapses: %d residency: %lld ms",
+                         idle_collapses_,
+                         static_cast<long long>(collapsed_time_ / 1000000));
   }
 
   if (needs_modeset_) {
@@ -297,10 +412,17 @@ bool DisplayQueue::QueueUpdate(std::vector<HwcLayer*>& source_layers,
     use_layer_cache_ = true;
   }
 
-  DisplayPlaneStateList current_composition_planes;
+  // Collapsing composes all layers anyway.
+  if (SquashLayers(frame.get(), layers_rects, !collapse))
+    layers_changed = true;
+
+  DisplayPlaneStateList& current_composition_planes = frame->planes_;
   bool render_layers;
   // Validate Overlays and Layers usage.
-  if (!layers_changed) {
+  if (collapse) {
+    std::tie(render_layers, current_composition_planes) =
+        display_plane_manager_->ValidateLayers(layers, needs_modeset_, true);
+  } else if (!layers_changed) {
     GetCachedLayers(layers, &current_composition_planes, &render_layers);
   } else {
     std::tie(render_layers, current_composition_planes) =
@@ -310,137 +432,415 @@ bool DisplayQueue::QueueUpdate(std::vector<HwcLayer*>& source_layers,
 
   DUMP_CURRENT_COMPOSITION_PLANES();
 
+  frame->use_out_fence_ = !disable_overlay_usage_;
   if (render_layers) {
-      if (!compositor_.BeginFrame(disable_overlay_usage_)) {
-	ETRACE("Failed to initialize compositor.");
-	return false;
-      }
+    if (!compositor_.BeginFrame(disable_overlay_usage_)) {
+      ETRACE("Failed to initialize compositor.");
+      DropFrame(frame.get());
+      return false;
+    }
 
     // Prepare for final composition.
     if (!compositor_.Draw(current_composition_planes, layers, layers_rects)) {
       ETRACE("Failed to prepare for the frame composition. ");
+      DropFrame(frame.get());
       return false;
     }
+
+    IDISPLAYMANAGERTRACE("Composition regions separated: %u merged: %u",
+                         compositor_.GetSeparatedRegionCount(),
+                         compositor_.GetMergedRegionCount());
+
+    // Without an out fence, flush any 3D operations before
+    // the commit.
+    if (needs_modeset_ || !frame->use_out_fence_)
+      compositor_.InsertFence(0);
   }
 
-  int32_t fence = 0;
-  // Do the actual commit.
-  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+  if (needs_color_correction_) {
+    SetColorCorrection(gamma_, contrast_, brightness_);
+    needs_color_correction_ = false;
+  }
+
+  scheduler_.AddCompositionTime(CommitScheduler::Now() - start);
+  previous_frame_ = frame;
+  if (needs_modeset_) {
+    // Pipe configuration changes with modeset, validation of
+    // following frames depends on it being done.
+    commit_thread_->Flush();
+    if (!CommitFrame(frame, true))
+      return false;
+
+    // Results cached while modeset was pending don't reflect the
+    // new pipe configuration.
+    display_plane_manager_->InvalidateTestCommitCache();
+    needs_modeset_ = false;
+  } else if (!commit_thread_->QueueFrame(frame)) {
+    CommitFrame(frame, false);
+  }
+
+  ReleaseSurfaces();
+  *retire_fence = dup(frame->retire_fence_.get());
+  return true;
+}
+
+void DisplayQueue::ReleaseSurfaces() {
+  display_plane_manager_->ReleaseFreeOffScreenTargets(&released_surfaces_);
+  ReleaseSquashSurfaces();
+  if (!released_surfaces_.empty())
+    compositor_.DestroySurfaces(released_surfaces_);
+}
+
+bool DisplayQueue::SquashLayers(DisplayFrame* frame,
+                                std::vector<HwcRect<int>>& layers_rects,
+                                bool allow) {
+  std::vector<OverlayLayer>& layers = frame->layers_;
+  size_t size = layers.size();
+  // Find the longest run of layers which showed the same content for
+  // squash_frames_. Cursor is expected to move and keeps its plane.
+  size_t begin = 0;
+  size_t end = 0;
+  int32_t squash_frames = squash_frames_.get();
+  if (allow && squash_frames > 0) {
+    size_t run_begin = 0;
+    for (size_t i = 0; i <= size; i++) {
+      if (i < size) {
+        const OverlayLayer& layer = layers.at(i);
+        if (layer.GetStaticFrameCount() >=
+                static_cast<uint32_t>(squash_frames) &&
+            !(layer.GetBuffer()->GetUsage() & kLayerCursor))
+          continue;
+      }
+
+      if (i - run_begin > end - begin) {
+        begin = run_begin;
+        end = i;
+      }
+
+      run_begin = i + 1;
+    }
+  }
+
+  if (end - begin < kMinSquashLayers)
+    end = begin;
+
+  if (squash_surface_ && (begin != squash_begin_ || end != squash_end_)) {
+    // Last frame queued may still show the surface.
+    int64_t release_point =
+        previous_frame_ ? previous_frame_->release_point_ : 0;
+    stale_squash_surfaces_.emplace_back(
+        SquashSurface{std::move(squash_surface_), release_point});
+  }
+
+  if (!squash_surface_ && end > begin) {
+    HwcRect<int> display_rect = layers.at(begin).GetDisplayFrame();
+    std::vector<size_t> source_layers;
+    for (size_t i = begin; i < end; i++) {
+      display_rect = UnionRect(display_rect, layers.at(i).GetDisplayFrame());
+      source_layers.emplace_back(i);
+    }
+
+    display_rect = IntersectRect(
+        display_rect, HwcRect<int>(0, 0, mode_.hdisplay, mode_.vdisplay));
+    if (!IsEmptyRect(display_rect)) {
+      std::unique_ptr<NativeSurface> surface(
+          CreateBackBuffer(display_rect.right - display_rect.left,
+                           display_rect.bottom - display_rect.top));
+      if (surface->Init(buffer_manager_) &&
+          compositor_.BeginFrame(disable_overlay_usage_)) {
+        surface->SetLayerTarget(display_rect);
+        if (compositor_.Squash(layers, layers_rects, source_layers,
+                               surface.get())) {
+          squash_surface_ = std::move(surface);
+          squash_begin_ = begin;
+          squash_end_ = end;
+          squashes_++;
+          IDISPLAYMANAGERTRACE("Squashed layers %zu to %zu, total: %d", begin,
+                               end - 1, squashes_);
+        }
+      }
 
+      if (surface) {
+        ETRACE("Failed to squash layers.");
+        released_surfaces_.emplace_back(std::move(surface));
+      }
+    }
+  }
+
+  NativeSurface* previous_surface =
+      previous_frame_ ? previous_frame_->squash_surface_ : NULL;
+  frame->squash_surface_ = squash_surface_.get();
+  std::vector<const OverlayLayer*>& client_layers = frame->client_layers_;
+  if (!squash_surface_) {
+    for (const OverlayLayer& layer : layers)
+      client_layers.emplace_back(&layer);
+
+    return previous_surface != NULL;
+  }
+
+  // Squashed layers are replaced by one layer at their z order. Other
+  // layers and their rects are renumbered accordingly.
+  std::vector<OverlayLayer> queued_layers;
+  queued_layers.swap(layers);
+  layers.reserve(size - (squash_end_ - squash_begin_) + 1);
+  frame->squashed_layers_.reserve(squash_end_ - squash_begin_);
+  layers_rects.clear();
+  for (size_t i = 0; i < size; i++) {
+    if (i == squash_begin_) {
+      OverlayLayer* surface_layer = squash_surface_->GetLayer();
+      layers.emplace_back();
+      OverlayLayer& squash_layer = layers.back();
+      ImportedBuffer* buffer =
+          new ImportedBuffer(surface_layer->GetBuffer(), buffer_manager_);
+      buffer->owned_buffer_ = false;
+      squash_layer.SetBuffer(buffer);
+      squash_layer.SetTransform(0);
+      squash_layer.SetBlending(HWCBlending::kBlendingPremult);
+      squash_layer.SetSourceCrop(surface_layer->GetSourceCrop());
+      squash_layer.SetDisplayFrame(surface_layer->GetDisplayFrame());
+      squash_layer.SetIndex(layers.size() - 1);
+      int fence = surface_layer->GetAcquireFence();
+      if (fence > 0)
+        squash_layer.SetAcquireFence(dup(fence));
+
+      if (previous_surface == squash_surface_.get()) {
+        // Content is the same as in the previous frame.
+        HwcRect<int> no_damage(0, 0, 0, 0);
+        HwcRegion surface_damage;
+        surface_damage.kNumRects = 1;
+        surface_damage.kRects = &no_damage;
+        squash_layer.SetSurfaceDamage(
+            surface_damage, previous_frame_->layers_.at(squash_begin_));
+      }
+
+      layers_rects.emplace_back(squash_layer.GetDisplayFrame());
+    }
+
+    if (i >= squash_begin_ && i < squash_end_) {
+      frame->squashed_layers_.emplace_back(std::move(queued_layers.at(i)));
+      client_layers.emplace_back(&frame->squashed_layers_.back());
+      continue;
+    }
+
+    layers.emplace_back(std::move(queued_layers.at(i)));
+    OverlayLayer& overlay_layer = layers.back();
+    overlay_layer.SetIndex(layers.size() - 1);
+    layers_rects.emplace_back(overlay_layer.GetDisplayFrame());
+    client_layers.emplace_back(&overlay_layer);
+  }
+
+  return previous_surface != squash_surface_.get();
+}
+
+void DisplayQueue::ReleaseSquashSurfaces() {
+  spin_lock_.lock();
+  int64_t signalled_point = release_timeline_.GetSignalledPoint();
+  spin_lock_.unlock();
+  for (auto it = stale_squash_surfaces_.begin();
+       it != stale_squash_surfaces_.end();) {
+    if (it->release_point_ > signalled_point) {
+      ++it;
+      continue;
+    }
+
+    released_surfaces_.emplace_back(std::move(it->surface_));
+    it = stale_squash_surfaces_.erase(it);
+  }
+}
+
+bool DisplayQueue::CommitFrame(const std::shared_ptr<DisplayFrame>& frame,
+                               bool modeset) {
+  CTRACE();
+  int32_t fence = 0;
+  std::unique_ptr<KMSPropertySet> pset(kms_->CreatePropertySet());
   if (!pset) {
     ETRACE("Failed to allocate property set %d", -ENOMEM);
+    DropFrame(frame.get());
     return false;
   }
 
-  if (needs_modeset_) {
+  if (modeset) {
     if (!ApplyPendingModeset(pset.get())) {
       ETRACE("Failed to Modeset.");
+      DropFrame(frame.get());
       return false;
     }
-  } else if (!disable_overlay_usage_) {
+  } else if (frame->use_out_fence_) {
     GetFence(pset.get(), &fence);
   }
 
-  if (needs_color_correction_) {
-    SetColorCorrection(gamma_, contrast_, brightness_);
-    needs_color_correction_ = false;
-  }
-
   kms_fence_handler_->EnsureReadyForNextFrame();
 
-  if (!display_plane_manager_->CommitFrame(current_composition_planes,
-                                           pset.get(), flags_)) {
+  int64_t start = CommitScheduler::Now();
+  if (!display_plane_manager_->CommitFrame(frame->planes_, pset.get(),
+                                           flags_)) {
     ETRACE("Failed to Commit layers.");
+    DropFrame(frame.get());
     return false;
   }
 
-  if (fence > 0) {
-    if (render_layers)
-      compositor_.InsertFence(dup(fence));
+  scheduler_.AddCommitTime(CommitScheduler::Now() - start);
 
-    *retire_fence = dup(fence);
-    kms_fence_handler_->WaitFence(fence, previous_layers_);
+  std::vector<OverlayLayer> no_layers;
+  std::vector<OverlayLayer>& previous_layers =
+      committed_frame_ ? committed_frame_->layers_ : no_layers;
+  // Frames dropped since the last commit were never on screen, their
+  // points are released together with the last committed frame's
+  // rather than only once this frame is replaced. Points are handed
+  // out in queue order, so that's every point before this frame's.
+  int64_t previous_release_point = frame->release_point_ - 1;
+  if (fence > 0) {
+    kms_fence_handler_->WaitFence(dup(fence), previous_layers,
+                                  previous_release_point,
+                                  frame->retire_point_);
   } else {
-    // This is the best we can do in this case, flush any 3D
-    // operations and release buffers of previous layers.
-    if (render_layers)
-      compositor_.InsertFence(fence);
-
+    // This is the best we can do in this case, release buffers
+    // of previous layers.
     spin_lock_.lock();
-    buffer_manager_->UnRegisterLayerBuffers(previous_layers_);
+    buffer_manager_->UnRegisterLayerBuffers(previous_layers);
+    release_timeline_.IncreaseTimelineToPoint(previous_release_point);
+    retire_timeline_.IncreaseTimelineToPoint(frame->retire_point_);
     spin_lock_.unlock();
-    if (!disable_overlay_usage_) {
+    if (frame->use_out_fence_) {
       flags_ = 0;
       flags_ |= DRM_MODE_ATOMIC_NONBLOCK;
     }
-
-    needs_modeset_ = false;
   }
 
-  for (NativeSurface* surface : in_flight_surfaces_) {
-    surface->SetInUse(false);
+  spin_lock_.lock();
+  render_fence_.Reset(fence);
+  if (committed_frame_) {
+    // Squashed buffers are not on screen themselves.
+    buffer_manager_->UnRegisterLayerBuffers(committed_frame_->squashed_layers_);
+    for (DisplayPlaneState& plane_state : committed_frame_->planes_) {
+      if (plane_state.GetCompositionState() ==
+          DisplayPlaneState::State::kRender) {
+        freed_surfaces_.emplace_back(plane_state.GetOffScreenTarget());
+      }
+    }
   }
+  spin_lock_.unlock();
 
-  previous_layers_.swap(layers);
-  previous_plane_state_.swap(current_composition_planes);
-
-  std::vector<NativeSurface*>().swap(in_flight_surfaces_);
+  committed_frame_ = frame;
+  return true;
+}
 
-  for (DisplayPlaneState& plane_state : previous_plane_state_) {
+void DisplayQueue::DropFrame(DisplayFrame* frame) {
+  frame->dropped_ = true;
+  dropped_frames_++;
+  spin_lock_.lock();
+  buffer_manager_->UnRegisterLayerBuffers(frame->layers_);
+  buffer_manager_->UnRegisterLayerBuffers(frame->squashed_layers_);
+  for (DisplayPlaneState& plane_state : frame->planes_) {
     if (plane_state.GetCompositionState() ==
         DisplayPlaneState::State::kRender) {
-      in_flight_surfaces_.emplace_back(plane_state.GetOffScreenTarget());
+      freed_surfaces_.emplace_back(plane_state.GetOffScreenTarget());
     }
   }
+  spin_lock_.unlock();
+}
+
+bool DisplayQueue::WaitForLatchTime() {
+  kms_fence_handler_->EnsureReadyForNextFrame();
+  int64_t latch = scheduler_.GetLatchTime(CommitScheduler::Now());
+  if (!latch)
+    return false;
+
+  scheduler_.SleepUntil(latch);
+  return true;
+}
+
+bool DisplayQueue::IsFrameReady(const DisplayFrame& frame) const {
+  for (const DisplayPlaneState& plane_state : frame.planes_) {
+    const OverlayLayer* layer = plane_state.GetOverlayLayer();
+    if (layer && !IsFenceSignalled(layer->GetAcquireFence()))
+      return false;
+  }
 
   return true;
 }
 
+void DisplayQueue::HandlePageFlip(int64_t timestamp) {
+  scheduler_.AddFlipTime(timestamp);
+}
+
+int64_t DisplayQueue::GetIdleCollapseResidency() const {
+  if (!collapsed_)
+    return collapsed_time_;
+
+  return collapsed_time_ + CommitScheduler::Now() - collapsed_since_;
+}
+
+bool DisplayQueue::GetTargetPresentTime(int64_t* timestamp) {
+  *timestamp = scheduler_.GetTargetPresentTime(CommitScheduler::Now());
+  return *timestamp != 0;
+}
+
 void DisplayQueue::HandleCommitUpdate(
-    const std::vector<const OverlayBuffer*>& buffers) {
+    const std::vector<const OverlayBuffer*>& buffers, int64_t release_point,
+    int64_t retire_point) {
   spin_lock_.lock();
   buffer_manager_->UnRegisterBuffers(buffers);
+  release_timeline_.IncreaseTimelineToPoint(release_point);
+  retire_timeline_.IncreaseTimelineToPoint(retire_point);
   spin_lock_.unlock();
 }
 
 void DisplayQueue::HandleExit() {
+  commit_thread_->ExitThread();
   kms_fence_handler_->ExitThread();
 
-  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+  std::unique_ptr<KMSPropertySet> pset(kms_->CreatePropertySet());
   if (!pset) {
     ETRACE("Failed to allocate property set %d", -ENOMEM);
     return;
   }
 
   bool active = false;
-  int ret =
-      drmModeAtomicAddProperty(pset.get(), crtc_id_, active_prop_, active) < 0;
+  int ret = pset->AddProperty(crtc_id_, active_prop_, active) < 0;
   if (ret) {
     ETRACE("Failed to set display to inactive");
     return;
   }
 
-  std::vector<NativeSurface*>().swap(in_flight_surfaces_);
-  display_plane_manager_->DisablePipe(pset.get());
-  drmModeConnectorSetProperty(gpu_fd_, connector_, dpms_prop_,
-                              DRM_MODE_DPMS_OFF);
-  std::vector<OverlayLayer>().swap(previous_layers_);
-  previous_plane_state_.clear();
-  compositor_.Reset();
+  spin_lock_.lock();
+  std::vector<NativeSurface*>().swap(freed_surfaces_);
+  render_fence_.Reset(-1);
+  spin_lock_.unlock();
+  display_plane_manager_->DisablePipe(pset.get(), &released_surfaces_);
+  kms_->SetProperty(connector_, DRM_MODE_OBJECT_CONNECTOR, dpms_prop_,
+                    DRM_MODE_DPMS_OFF);
+  previous_frame_.reset();
+  committed_frame_.reset();
+  // Pipe is off, squash surfaces can be destroyed right away.
+  if (squash_surface_)
+    released_surfaces_.emplace_back(std::move(squash_surface_));
+
+  for (SquashSurface& stale : stale_squash_surfaces_)
+    released_surfaces_.emplace_back(std::move(stale.surface_));
+
+  std::vector<SquashSurface>().swap(stale_squash_surfaces_);
+  compositor_.DestroySurfaces(released_surfaces_);
+  if (collapsed_) {
+    collapsed_ = false;
+    collapsed_time_ += CommitScheduler::Now() - collapsed_since_;
+  }
+
+  static_frames_ = 0;
+  // Nothing is on screen anymore, signal all pending release and
+  // retire fences.
+  spin_lock_.lock();
+  release_timeline_.IncreaseTimelineToPoint(
+      release_timeline_.GetTimelinePoint());
+  retire_timeline_.IncreaseTimelineToPoint(
+      retire_timeline_.GetTimelinePoint());
+  spin_lock_.unlock();
 }
 
-void DisplayQueue::GetDrmObjectProperty(const char* name,
-                                        const ScopedDrmObjectPropertyPtr& props,
+void DisplayQueue::GetDrmObjectProperty(const char* name, uint32_t object_id,
+                                        uint32_t object_type,
                                         uint32_t* id) const {
-  uint32_t count_props = props->count_props;
-  for (uint32_t i = 0; i < count_props; i++) {
-    ScopedDrmPropertyPtr property(drmModeGetProperty(gpu_fd_, props->props[i]));
-    if (property && !strcmp(property->name, name)) {
-      *id = property->prop_id;
-      break;
-    }
-  }
-  if (!(*id))
+  if (!kms_->GetProperty(object_id, object_type, name, id, NULL))
     ETRACE("Could not find property %s", name);
 }
 
@@ -448,18 +848,13 @@ bool DisplayQueue::CheckPlaneFormat(uint32_t format) {
   return display_plane_manager_->CheckPlaneFormat(format);
 }
 
-void DisplayQueue::GetDrmObjectPropertyValue(
-    const char* name, const ScopedDrmObjectPropertyPtr& props,
-    uint64_t* value) const {
-  uint32_t count_props = props->count_props;
-  for (uint32_t i = 0; i < count_props; i++) {
-    ScopedDrmPropertyPtr property(drmModeGetProperty(gpu_fd_, props->props[i]));
-    if (property && !strcmp(property->name, name)) {
-      *value = props->prop_values[i];
-      break;
-    }
-  }
-  if (!(*value))
+void DisplayQueue::GetDrmObjectPropertyValue(const char* name,
+                                             uint32_t object_id,
+                                             uint32_t object_type,
+                                             uint64_t* value) const {
+  uint32_t id = 0;
+  if (!kms_->GetProperty(object_id, object_type, name, &id, value) ||
+      !(*value))
     ETRACE("Could not find property value %s", name);
 }
 
@@ -467,17 +862,14 @@ void DisplayQueue::ApplyPendingLUT(struct drm_color_lut* lut) const {
   if (lut_id_prop_ == 0)
     return;
 
-  uint32_t lut_blob_id = 0;
-
-  drmModeCreatePropertyBlob(
-      gpu_fd_, lut, sizeof(struct drm_color_lut) * lut_size_, &lut_blob_id);
+  uint32_t lut_blob_id =
+      kms_->CreatePropertyBlob(lut, sizeof(struct drm_color_lut) * lut_size_);
   if (lut_blob_id == 0) {
     return;
   }
 
-  drmModeObjectSetProperty(gpu_fd_, crtc_id_, DRM_MODE_OBJECT_CRTC,
-                           lut_id_prop_, lut_blob_id);
-  drmModeDestroyPropertyBlob(gpu_fd_, lut_blob_id);
+  kms_->SetProperty(crtc_id_, DRM_MODE_OBJECT_CRTC, lut_id_prop_, lut_blob_id);
+  kms_->DestroyPropertyBlob(lut_blob_id);
 }
 
 void DisplayQueue::SetGamma(float red, float green, float blue) {
@@ -614,8 +1006,8 @@ bool DisplayQueue::SetBroadcastRGB(const char* range_property) {
   if (p_value < 0)
     return false;
 
-  if (drmModeObjectSetProperty(gpu_fd_, connector_, DRM_MODE_OBJECT_CONNECTOR,
-                               broadcastrgb_id_, (uint64_t)p_value) != 0)
+  if (!kms_->SetProperty(connector_, DRM_MODE_OBJECT_CONNECTOR,
+                         broadcastrgb_id_, (uint64_t)p_value))
     return false;
 
   return true;
@@ -17,7 +17,6 @@
 #ifndef COMMON_DISPLAY_DISPLAYQUEUE_H_
 #define COMMON_DISPLAY_DISPLAYQUEUE_H_
 
-#include <drmscopedtypes.h>
 #include <scopedfd.h>
 #include <spinlock.h>
 
@@ -25,12 +24,16 @@
 #include <stdint.h>
 #include <xf86drmMode.h>
 
+#include <atomic>
 #include <queue>
 #include <memory>
 #include <vector>
 
+#include "commitscheduler.h"
 #include "compositor.h"
+#include "displaycommitthread.h"
 #include "hwcthread.h"
+#include "kmsbackend.h"
 #include "kmsfencehandler.h"
 #include "nativesync.h"
 #include "platformdefines.h"
@@ -45,11 +48,13 @@ struct gamma_colors {
 class DisplayPlaneManager;
 struct HwcLayer;
 class OverlayBufferManager;
+class RendererService;
 
 class DisplayQueue {
  public:
-  DisplayQueue(uint32_t gpu_fd, uint32_t crtc_id,
-               OverlayBufferManager* buffer_manager);
+  DisplayQueue(KMSBackend* kms, uint32_t crtc_id,
+               OverlayBufferManager* buffer_manager,
+               RendererService* renderer_service);
   ~DisplayQueue();
 
   bool Initialize(uint32_t width, uint32_t height, uint32_t pipe,
@@ -67,20 +72,83 @@ class DisplayQueue {
 
   void HandleExit();
 
-  void HandleCommitUpdate(const std::vector<const OverlayBuffer*>& buffers);
+  // Releases buffers and signals release fences of all frames up to
+  // release_point and retire fences up to retire_point.
+  void HandleCommitUpdate(const std::vector<const OverlayBuffer*>& buffers,
+                          int64_t release_point, int64_t retire_point);
+
+  // Commits a frame queued by QueueUpdate. Frames are committed by
+  // one thread at a time, in the order they were queued.
+  bool CommitFrame(const std::shared_ptr<DisplayFrame>& frame, bool modeset);
+
+  // Releases buffers and offscreen targets of a frame which won't be
+  // committed.
+  void DropFrame(DisplayFrame* frame);
+
+  // Waits for the previous flip and then sleeps till the latest time
+  // a commit still makes the next vblank. Returns false in case the
+  // deadline isn't known and commits shouldn't be delayed.
+  bool WaitForLatchTime();
+
+  // Returns true if content of all planes of frame is ready.
+  bool IsFrameReady(const DisplayFrame& frame) const;
+
+  // Records completion time of a flip.
+  void HandlePageFlip(int64_t timestamp);
+
+  bool GetTargetPresentTime(int64_t* timestamp);
+
+  // Number of frames which weren't committed as they were
+  // identical to the previous one.
+  uint32_t GetSkippedCommitCount() const {
+    return skipped_commits_;
+  }
+
+  // Number of times a static layer stack was collapsed into the
+  // primary plane, and total time spent collapsed in nanoseconds.
+  uint32_t GetIdleCollapseCount() const {
+    return idle_collapses_;
+  }
+  int64_t GetIdleCollapseResidency() const;
+
+  // Number of squash buffers composited.
+  uint32_t GetSquashCount() const {
+    return squashes_;
+  }
+
+  // Number of frames which were dropped instead of committed.
+  uint32_t GetDroppedFrameCount() const {
+    return dropped_frames_;
+  }
 
  private:
-  bool ApplyPendingModeset(drmModeAtomicReqPtr property_set);
+  struct SquashSurface {
+    std::unique_ptr<NativeSurface> surface_;
+    // Surface is off screen once this point of release
+    // timeline is signalled.
+    int64_t release_point_;
+  };
+
+  // Replaces the longest run of layers which have been static for
+  // long enough by one layer showing a squash buffer. Returns true
+  // if layers of frame are laid out differently than in the previous
+  // frame.
+  bool SquashLayers(DisplayFrame* frame,
+                    std::vector<HwcRect<int>>& layers_rects, bool allow);
+  void ReleaseSquashSurfaces();
+  // Trims the offscreen target pool and destroys squash surfaces no
+  // longer on screen. Called for every frame, including skipped ones,
+  // so that the pool shrinks while content is static.
+  void ReleaseSurfaces();
+  bool ApplyPendingModeset(KMSPropertySet* property_set);
   void GetCachedLayers(const std::vector<OverlayLayer>& layers,
                        DisplayPlaneStateList* composition, bool* render_layers);
-  bool GetFence(drmModeAtomicReqPtr property_set, int32_t* out_fence);
-  void GetDrmObjectProperty(const char* name,
-                            const ScopedDrmObjectPropertyPtr& props,
-                            uint32_t* id) const;
+  bool GetFence(KMSPropertySet* property_set, int32_t* out_fence);
+  void GetDrmObjectProperty(const char* name, uint32_t object_id,
+                            uint32_t object_type, uint32_t* id) const;
   void ApplyPendingLUT(struct drm_color_lut* lut) const;
-  void GetDrmObjectPropertyValue(const char* name,
-                                 const ScopedDrmObjectPropertyPtr& props,
-                                 uint64_t* value) const;
+  void GetDrmObjectPropertyValue(const char* name, uint32_t object_id,
+                                 uint32_t object_type, uint64_t* value) const;
 
   void SetColorCorrection(struct gamma_colors gamma, uint32_t contrast,
                           uint32_t brightness) const;
@@ -102,7 +170,7 @@ class DisplayQueue {
   uint32_t crtc_prop_;
   uint32_t blob_id_ = 0;
   uint32_t old_blob_id_ = 0;
-  uint32_t gpu_fd_;
+  KMSBackend* kms_;
   uint32_t brightness_;
   uint32_t contrast_;
   uint32_t flags_ = DRM_MODE_ATOMIC_ALLOW_MODESET;
@@ -112,17 +180,54 @@ class DisplayQueue {
   int64_t broadcastrgb_full_;
   int64_t broadcastrgb_automatic_;
   uint64_t fence_ = 0;
+  uint32_t skipped_commits_ = 0;
   bool needs_color_correction_ = false;
   bool use_layer_cache_ = false;
   bool needs_modeset_ = true;
   bool disable_overlay_usage_ = false;
   std::unique_ptr<KMSFenceEventHandler> kms_fence_handler_;
   std::unique_ptr<DisplayPlaneManager> display_plane_manager_;
-  std::vector<OverlayLayer> previous_layers_;
-  DisplayPlaneStateList previous_plane_state_;
+  // Last frame queued, layers of the next frame are compared
+  // against it.
+  std::shared_ptr<DisplayFrame> previous_frame_;
+  // Last frame committed, only used by the committing thread.
+  std::shared_ptr<DisplayFrame> committed_frame_;
   OverlayBufferManager* buffer_manager_;
-  std::vector<NativeSurface*> in_flight_surfaces_;
+  // Offscreen targets which are off screen once render_fence_
+  // signals. Both are guarded by spin_lock_.
+  std::vector<NativeSurface*> freed_surfaces_;
+  ScopedFd render_fence_;
+  // Offscreen targets trimmed from the plane manager's pool.
+  std::vector<std::unique_ptr<NativeSurface>> released_surfaces_;
+  // Release fences of all layers are points on this timeline,
+  // one point per frame.
+  NativeSync release_timeline_;
+  // Retire fences, signalled when the frame is on screen.
+  NativeSync retire_timeline_;
+  CommitScheduler scheduler_;
+  // Number of identical frames after which all layers are composed
+  // into the primary plane, 0 disables collapsing.
+  Option idle_frames_;
+  uint32_t static_frames_ = 0;
+  uint32_t idle_collapses_ = 0;
+  bool collapsed_ = false;
+  int64_t collapsed_since_ = 0;
+  int64_t collapsed_time_ = 0;
+  // Number of frames layers need to be static for before they are
+  // squashed, 0 disables squashing.
+  Option squash_frames_;
+  // Client layers [squash_begin_, squash_end_) are composited
+  // into squash_surface_.
+  std::unique_ptr<NativeSurface> squash_surface_;
+  size_t squash_begin_ = 0;
+  size_t squash_end_ = 0;
+  uint32_t squashes_ = 0;
+  // DropFrame is also called by the commit thread.
+  std::atomic<uint32_t> dropped_frames_{0};
+  // Squash surfaces no longer in use, destroyed once off screen.
+  std::vector<SquashSurface> stale_squash_surfaces_;
   SpinLock spin_lock_;
+  std::unique_ptr<DisplayCommitThread> commit_thread_;
 };
 
 }  // namespace hwcomposer
@@ -0,0 +1,176 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "drmkmsbackend.h"
+
+#include <string.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <drmscopedtypes.h>
+
+#include "hwctrace.h"
+
+namespace hwcomposer {
+
+namespace {
+
+class DrmPropertySet : public KMSPropertySet {
+ public:
+  DrmPropertySet() : pset_(drmModeAtomicAlloc()) {
+  }
+
+  int AddProperty(uint32_t object_id, uint32_t property_id,
+                  uint64_t value) override {
+    return drmModeAtomicAddProperty(pset_.get(), object_id, property_id,
+                                    value);
+  }
+
+  drmModeAtomicReqPtr get() const {
+    return pset_.get();
+  }
+
+ private:
+  ScopedDrmAtomicReqPtr pset_;
+};
+
+}  // namespace
+
+DrmKMSBackend::DrmKMSBackend(uint32_t gpu_fd) : gpu_fd_(gpu_fd) {
+}
+
+DrmKMSBackend::~DrmKMSBackend() {
+}
+
+bool DrmKMSBackend::GetPlanes(std::vector<KMSPlane>* planes) {
+  ScopedDrmPlaneResPtr plane_resources(drmModeGetPlaneResources(gpu_fd_));
+  if (!plane_resources) {
+    ETRACE("Failed to get plane resources");
+    return false;
+  }
+
+  uint32_t num_planes = plane_resources->count_planes;
+  for (uint32_t i = 0; i < num_planes; ++i) {
+    ScopedDrmPlanePtr drm_plane(
+        drmModeGetPlane(gpu_fd_, plane_resources->planes[i]));
+    if (!drm_plane) {
+      ETRACE("Failed to get plane ");
+      return false;
+    }
+
+    planes->emplace_back();
+    KMSPlane& plane = planes->back();
+    plane.id = drm_plane->plane_id;
+    plane.possible_crtcs = drm_plane->possible_crtcs;
+    plane.formats.assign(drm_plane->formats,
+                         drm_plane->formats + drm_plane->count_formats);
+  }
+
+  return true;
+}
+
+bool DrmKMSBackend::GetProperty(uint32_t object_id, uint32_t object_type,
+                                const char* name, uint32_t* property_id,
+                                uint64_t* value) {
+  ScopedDrmObjectPropertyPtr props(
+      drmModeObjectGetProperties(gpu_fd_, object_id, object_type));
+  if (!props)
+    return false;
+
+  uint32_t count_props = props->count_props;
+  for (uint32_t i = 0; i < count_props; i++) {
+    ScopedDrmPropertyPtr property(drmModeGetProperty(gpu_fd_, props->props[i]));
+    if (property && !strcmp(property->name, name)) {
+      *property_id = property->prop_id;
+      if (value)
+        *value = props->prop_values[i];
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int64_t DrmKMSBackend::GetPropertyEnumValue(uint32_t property_id,
+                                            const char* enum_name) {
+  ScopedDrmPropertyPtr property(drmModeGetProperty(gpu_fd_, property_id));
+  if (!property || !(property->flags & DRM_MODE_PROP_ENUM))
+    return -1;
+
+  for (int i = 0; i < property->count_enums; i++) {
+    if (!strcmp(property->enums[i].name, enum_name))
+      return property->enums[i].value;
+  }
+
+  return -1;
+}
+
+bool DrmKMSBackend::SetProperty(uint32_t object_id, uint32_t object_type,
+                                uint32_t property_id, uint64_t value) {
+  return drmModeObjectSetProperty(gpu_fd_, object_id, object_type, property_id,
+                                  value) == 0;
+}
+
+std::unique_ptr<KMSPropertySet> DrmKMSBackend::CreatePropertySet() {
+  std::unique_ptr<DrmPropertySet> pset(new DrmPropertySet());
+  if (!pset->get())
+    return std::unique_ptr<KMSPropertySet>();
+
+  return pset;
+}
+
+int DrmKMSBackend::Commit(KMSPropertySet* property_set, uint32_t flags) {
+  return drmModeAtomicCommit(
+      gpu_fd_, static_cast<DrmPropertySet*>(property_set)->get(), flags, NULL);
+}
+
+uint32_t DrmKMSBackend::CreatePropertyBlob(const void* data, size_t size) {
+  uint32_t blob_id = 0;
+  if (drmModeCreatePropertyBlob(gpu_fd_, data, size, &blob_id))
+    return 0;
+
+  return blob_id;
+}
+
+void DrmKMSBackend::DestroyPropertyBlob(uint32_t blob_id) {
+  drmModeDestroyPropertyBlob(gpu_fd_, blob_id);
+}
+
+uint32_t DrmKMSBackend::AddFrameBuffer(uint32_t width, uint32_t height,
+                                       uint32_t format,
+                                       const uint32_t handles[4],
+                                       const uint32_t pitches[4],
+                                       const uint32_t offsets[4]) {
+  uint32_t fb_id = 0;
+  int ret = drmModeAddFB2(gpu_fd_, width, height, format, handles, pitches,
+                          offsets, &fb_id, 0);
+  if (ret) {
+    ETRACE("drmModeAddFB2 error (%dx%d, %c%c%c%c, handle %d pitch %d) (%s)",
+           width, height, format, format >> 8, format >> 16, format >> 24,
+           handles[0], pitches[0], strerror(-ret));
+    return 0;
+  }
+
+  return fb_id;
+}
+
+void DrmKMSBackend::RemoveFrameBuffer(uint32_t fb_id) {
+  if (drmModeRmFB(gpu_fd_, fb_id))
+    ETRACE("Failed to remove fb %s", PRINTERROR());
+}
+
+}  // namespace hwcomposer
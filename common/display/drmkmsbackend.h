@@ -0,0 +1,60 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_DISPLAY_DRMKMSBACKEND_H_
+#define COMMON_DISPLAY_DRMKMSBACKEND_H_
+
+#include "kmsbackend.h"
+
+namespace hwcomposer {
+
+// KMSBackend talking to the kernel through libdrm.
+class DrmKMSBackend : public KMSBackend {
+ public:
+  explicit DrmKMSBackend(uint32_t gpu_fd);
+  ~DrmKMSBackend() override;
+
+  bool GetPlanes(std::vector<KMSPlane>* planes) override;
+
+  bool GetProperty(uint32_t object_id, uint32_t object_type, const char* name,
+                   uint32_t* property_id, uint64_t* value) override;
+
+  int64_t GetPropertyEnumValue(uint32_t property_id,
+                               const char* enum_name) override;
+
+  bool SetProperty(uint32_t object_id, uint32_t object_type,
+                   uint32_t property_id, uint64_t value) override;
+
+  std::unique_ptr<KMSPropertySet> CreatePropertySet() override;
+
+  int Commit(KMSPropertySet* property_set, uint32_t flags) override;
+
+  uint32_t CreatePropertyBlob(const void* data, size_t size) override;
+
+  void DestroyPropertyBlob(uint32_t blob_id) override;
+
+  uint32_t AddFrameBuffer(uint32_t width, uint32_t height, uint32_t format,
+                          const uint32_t handles[4], const uint32_t pitches[4],
+                          const uint32_t offsets[4]) override;
+
+  void RemoveFrameBuffer(uint32_t fb_id) override;
+
+ private:
+  uint32_t gpu_fd_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_DRMKMSBACKEND_H_
@@ -0,0 +1,487 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "fakekmsbackend.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <tuple>
+
+#include "hwctrace.h"
+
+namespace hwcomposer {
+
+namespace {
+
+class FakePropertySet : public KMSPropertySet {
+ public:
+  int AddProperty(uint32_t object_id, uint32_t property_id,
+                  uint64_t value) override {
+    properties_.emplace_back(object_id, property_id, value);
+    return properties_.size();
+  }
+
+  const std::vector<std::tuple<uint32_t, uint32_t, uint64_t>>& properties()
+      const {
+    return properties_;
+  }
+
+ private:
+  std::vector<std::tuple<uint32_t, uint32_t, uint64_t>> properties_;
+};
+
+}  // namespace
+
+FakeKMSConfig::FakeKMSConfig() {
+  FakeKMSPlaneConfig primary;
+  primary.type = DRM_PLANE_TYPE_PRIMARY;
+  primary.formats = {DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,
+                     DRM_FORMAT_XBGR8888, DRM_FORMAT_ABGR8888,
+                     DRM_FORMAT_RGB565};
+  planes.emplace_back(primary);
+
+  FakeKMSPlaneConfig overlay;
+  overlay.formats = {DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,
+                     DRM_FORMAT_XBGR8888, DRM_FORMAT_ABGR8888,
+                     DRM_FORMAT_RGB565,   DRM_FORMAT_NV12,
+                     DRM_FORMAT_YUYV};
+  overlay.supports_alpha = true;
+  overlay.min_scale = 0.5f;
+  overlay.max_scale = 8.0f;
+  planes.emplace_back(overlay);
+  planes.emplace_back(overlay);
+
+  FakeKMSPlaneConfig cursor;
+  cursor.type = DRM_PLANE_TYPE_CURSOR;
+  cursor.formats = {DRM_FORMAT_ARGB8888};
+  cursor.supports_rotation = false;
+  planes.emplace_back(cursor);
+}
+
+FakeKMSBackend::FakeKMSBackend(const FakeKMSConfig& config) : config_(config) {
+  for (uint32_t pipe = 0; pipe < config_.num_pipes; ++pipe) {
+    uint32_t crtc_id = CreateObject(DRM_MODE_OBJECT_CRTC);
+    AttachProperty(crtc_id, "ACTIVE", 0);
+    AttachProperty(crtc_id, "MODE_ID", 0);
+    AttachProperty(crtc_id, "GAMMA_LUT", 0);
+    AttachProperty(crtc_id, "GAMMA_LUT_SIZE", 256);
+    if (config_.supports_out_fence)
+      AttachProperty(crtc_id, "OUT_FENCE_PTR", 0);
+
+    crtcs_.emplace_back(crtc_id);
+
+    uint32_t connector_id = CreateObject(DRM_MODE_OBJECT_CONNECTOR);
+    AttachProperty(connector_id, "DPMS", DRM_MODE_DPMS_OFF);
+    AttachProperty(connector_id, "CRTC_ID", 0);
+    connectors_.emplace_back(connector_id);
+
+    for (const FakeKMSPlaneConfig& plane_config : config_.planes) {
+      uint32_t plane_id = CreateObject(DRM_MODE_OBJECT_PLANE);
+      AttachProperty(plane_id, "type", plane_config.type);
+      const char* names[] = {"CRTC_ID", "FB_ID",  "CRTC_X", "CRTC_Y",
+                             "CRTC_W",  "CRTC_H", "SRC_X",  "SRC_Y",
+                             "SRC_W",   "SRC_H",  "IN_FENCE_FD"};
+      for (const char* name : names)
+        AttachProperty(plane_id, name, 0);
+
+      if (plane_config.supports_rotation)
+        AttachProperty(plane_id, "rotation", 0);
+
+      if (plane_config.supports_alpha)
+        AttachProperty(plane_id, "alpha", 0xFF);
+
+      planes_.emplace_back();
+      Plane& plane = planes_.back();
+      plane.id = plane_id;
+      plane.possible_crtcs = 1 << pipe;
+      plane.config = plane_config;
+    }
+  }
+
+  if (config_.supports_out_fence)
+    has_out_fence_timeline_ = out_fence_timeline_.Init();
+
+  if (config_.commit_latency_us)
+    flip_thread_ = std::thread(&FakeKMSBackend::FlipRoutine, this);
+}
+
+FakeKMSBackend::~FakeKMSBackend() {
+  if (!flip_thread_.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(flip_lock_);
+    flip_exit_ = true;
+  }
+
+  flip_cond_.notify_all();
+  flip_thread_.join();
+}
+
+void FakeKMSBackend::FlipRoutine() {
+  std::unique_lock<std::mutex> lock(flip_lock_);
+  while (true) {
+    flip_cond_.wait(lock, [this] {
+      return flip_exit_ || !pending_flips_.empty();
+    });
+    // Outstanding flips complete on exit, so that nobody waits
+    // on their fences forever.
+    if (!flip_exit_)
+      flip_cond_.wait_until(lock, pending_flips_.front().deadline,
+                            [this] { return flip_exit_; });
+
+    while (!pending_flips_.empty() &&
+           (flip_exit_ ||
+            pending_flips_.front().deadline <=
+                std::chrono::steady_clock::now())) {
+      int64_t point = pending_flips_.front().point;
+      pending_flips_.pop_front();
+      if (point)
+        out_fence_timeline_.IncreaseTimelineToPoint(point);
+
+      flips_done_++;
+    }
+
+    flip_cond_.notify_all();
+    if (flip_exit_)
+      return;
+  }
+}
+
+uint32_t FakeKMSBackend::GetCrtcId(uint32_t pipe) const {
+  return pipe < crtcs_.size() ? crtcs_.at(pipe) : 0;
+}
+
+uint32_t FakeKMSBackend::GetConnectorId(uint32_t pipe) const {
+  return pipe < connectors_.size() ? connectors_.at(pipe) : 0;
+}
+
+void FakeKMSBackend::GetPreferredMode(drmModeModeInfo* mode) const {
+  memset(mode, 0, sizeof(*mode));
+  mode->hdisplay = config_.width;
+  mode->hsync_start = config_.width + 48;
+  mode->hsync_end = config_.width + 80;
+  mode->htotal = config_.width + 160;
+  mode->vdisplay = config_.height;
+  mode->vsync_start = config_.height + 3;
+  mode->vsync_end = config_.height + 8;
+  mode->vtotal = config_.height + 30;
+  mode->vrefresh = config_.refresh;
+  mode->clock = (mode->htotal * mode->vtotal * config_.refresh) / 1000;
+  mode->type = DRM_MODE_TYPE_PREFERRED;
+  snprintf(mode->name, DRM_DISPLAY_MODE_LEN, "%dx%d", config_.width,
+           config_.height);
+}
+
+uint64_t FakeKMSBackend::GetCurrentValue(uint32_t object_id,
+                                         const char* name) {
+  ScopedSpinLock lock(lock_);
+  auto object = objects_.find(object_id);
+  auto property = property_ids_.find(name);
+  if (object == objects_.end() || property == property_ids_.end())
+    return 0;
+
+  auto value = object->second.properties.find(property->second);
+  return value == object->second.properties.end() ? 0 : value->second;
+}
+
+bool FakeKMSBackend::GetPlanes(std::vector<KMSPlane>* planes) {
+  for (const Plane& plane : planes_) {
+    planes->emplace_back();
+    KMSPlane& kms_plane = planes->back();
+    kms_plane.id = plane.id;
+    kms_plane.possible_crtcs = plane.possible_crtcs;
+    kms_plane.formats = plane.config.formats;
+  }
+
+  return true;
+}
+
+bool FakeKMSBackend::GetProperty(uint32_t object_id, uint32_t object_type,
+                                 const char* name, uint32_t* property_id,
+                                 uint64_t* value) {
+  ScopedSpinLock lock(lock_);
+  auto object = objects_.find(object_id);
+  auto property = property_ids_.find(name);
+  if (object == objects_.end() || object->second.type != object_type ||
+      property == property_ids_.end())
+    return false;
+
+  auto current = object->second.properties.find(property->second);
+  if (current == object->second.properties.end())
+    return false;
+
+  *property_id = property->second;
+  if (value)
+    *value = current->second;
+
+  return true;
+}
+
+int64_t FakeKMSBackend::GetPropertyEnumValue(uint32_t /*property_id*/,
+                                             const char* /*enum_name*/) {
+  // None of the simulated properties are enums.
+  return -1;
+}
+
+bool FakeKMSBackend::SetProperty(uint32_t object_id, uint32_t object_type,
+                                 uint32_t property_id, uint64_t value) {
+  ScopedSpinLock lock(lock_);
+  auto object = objects_.find(object_id);
+  if (object == objects_.end() || object->second.type != object_type)
+    return false;
+
+  auto current = object->second.properties.find(property_id);
+  if (current == object->second.properties.end())
+    return false;
+
+  current->second = value;
+  return true;
+}
+
+std::unique_ptr<KMSPropertySet> FakeKMSBackend::CreatePropertySet() {
+  return std::unique_ptr<KMSPropertySet>(new FakePropertySet());
+}
+
+int FakeKMSBackend::Commit(KMSPropertySet* property_set, uint32_t flags) {
+  const FakePropertySet* pset = static_cast<FakePropertySet*>(property_set);
+  uint32_t out_fence_prop = GetPropertyId("OUT_FENCE_PTR");
+  uint32_t in_fence_prop = GetPropertyId("IN_FENCE_FD");
+  uint32_t mode_id_prop = GetPropertyId("MODE_ID");
+  uint32_t active_prop = GetPropertyId("ACTIVE");
+  uint32_t crtc_id_prop = GetPropertyId("CRTC_ID");
+  int32_t* out_fence = NULL;
+  bool test_only = flags & DRM_MODE_ATOMIC_TEST_ONLY;
+
+  lock_.lock();
+  std::map<uint32_t, PropertyValues> state;
+  for (const auto& object : objects_)
+    state[object.first] = object.second.properties;
+
+  bool modeset = false;
+  for (const auto& entry : pset->properties()) {
+    uint32_t object_id = std::get<0>(entry);
+    uint32_t property_id = std::get<1>(entry);
+    uint64_t value = std::get<2>(entry);
+    auto object = state.find(object_id);
+    if (object == state.end() ||
+        object->second.find(property_id) == object->second.end()) {
+      failed_commits_++;
+      lock_.unlock();
+      return -ENOENT;
+    }
+
+    if (property_id == out_fence_prop) {
+      out_fence = reinterpret_cast<int32_t*>(static_cast<uintptr_t>(value));
+      continue;
+    }
+
+    // Fences are consumed by the commit, not part of the state.
+    if (property_id == in_fence_prop)
+      continue;
+
+    uint64_t& current = object->second[property_id];
+    if (current != value &&
+        (property_id == mode_id_prop || property_id == active_prop ||
+         (property_id == crtc_id_prop &&
+          objects_[object_id].type == DRM_MODE_OBJECT_CONNECTOR)))
+      modeset = true;
+
+    current = value;
+  }
+
+  if (modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+    IDISPLAYMANAGERTRACE("Fake KMS: modeset needed but not allowed.");
+    failed_commits_++;
+    lock_.unlock();
+    return -EINVAL;
+  }
+
+  for (const Plane& plane : planes_) {
+    if (!ValidatePlane(plane, state)) {
+      failed_commits_++;
+      lock_.unlock();
+      return -EINVAL;
+    }
+  }
+
+  if (test_only) {
+    test_commits_++;
+    lock_.unlock();
+    return 0;
+  }
+
+  for (auto& object : objects_)
+    object.second.properties = state[object.first];
+
+  commits_++;
+  lock_.unlock();
+
+  std::unique_lock<std::mutex> flip_lock(flip_lock_);
+  int64_t point = 0;
+  if (out_fence) {
+    *out_fence = -1;
+    if (has_out_fence_timeline_) {
+      *out_fence = out_fence_timeline_.CreateNextTimelineFence();
+      point = out_fence_timeline_.GetTimelinePoint();
+    }
+  }
+
+  if (!flip_thread_.joinable()) {
+    if (point)
+      out_fence_timeline_.IncreaseTimelineToPoint(point);
+
+    return 0;
+  }
+
+  pending_flips_.push_back(
+      {std::chrono::steady_clock::now() +
+           std::chrono::microseconds(config_.commit_latency_us),
+       point});
+  uint64_t flip = ++flips_queued_;
+  flip_cond_.notify_all();
+  if (!(flags & DRM_MODE_ATOMIC_NONBLOCK))
+    flip_cond_.wait(flip_lock, [this, flip] { return flips_done_ >= flip; });
+
+  return 0;
+}
+
+uint32_t FakeKMSBackend::CreatePropertyBlob(const void* data, size_t size) {
+  ScopedSpinLock lock(lock_);
+  uint32_t blob_id = next_id_++;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  blobs_[blob_id].assign(bytes, bytes + size);
+  return blob_id;
+}
+
+void FakeKMSBackend::DestroyPropertyBlob(uint32_t blob_id) {
+  ScopedSpinLock lock(lock_);
+  blobs_.erase(blob_id);
+}
+
+uint32_t FakeKMSBackend::AddFrameBuffer(uint32_t width, uint32_t height,
+                                        uint32_t format,
+                                        const uint32_t /*handles*/[4],
+                                        const uint32_t pitches[4],
+                                        const uint32_t /*offsets*/[4]) {
+  if (!width || !height || !pitches[0]) {
+    ETRACE("Fake KMS: invalid framebuffer %dx%d pitch %d", width, height,
+           pitches[0]);
+    return 0;
+  }
+
+  ScopedSpinLock lock(lock_);
+  uint32_t fb_id = next_id_++;
+  framebuffers_[fb_id] = format;
+  return fb_id;
+}
+
+void FakeKMSBackend::RemoveFrameBuffer(uint32_t fb_id) {
+  ScopedSpinLock lock(lock_);
+  framebuffers_.erase(fb_id);
+}
+
+uint32_t FakeKMSBackend::CreateObject(uint32_t type) {
+  uint32_t object_id = next_id_++;
+  objects_[object_id].type = type;
+  return object_id;
+}
+
+void FakeKMSBackend::AttachProperty(uint32_t object_id, const char* name,
+                                    uint64_t value) {
+  uint32_t& property_id = property_ids_[name];
+  if (!property_id)
+    property_id = next_id_++;
+
+  objects_[object_id].properties[property_id] = value;
+}
+
+uint32_t FakeKMSBackend::GetPropertyId(const char* name) {
+  ScopedSpinLock lock(lock_);
+  auto property = property_ids_.find(name);
+  return property == property_ids_.end() ? 0 : property->second;
+}
+
+uint64_t FakeKMSBackend::GetValue(
+    const std::map<uint32_t, PropertyValues>& state, uint32_t object_id,
+    const char* name) const {
+  auto property = property_ids_.find(name);
+  auto object = state.find(object_id);
+  if (property == property_ids_.end() || object == state.end())
+    return 0;
+
+  auto value = object->second.find(property->second);
+  return value == object->second.end() ? 0 : value->second;
+}
+
+bool FakeKMSBackend::ValidatePlane(
+    const Plane& plane, const std::map<uint32_t, PropertyValues>& state) const {
+  uint32_t fb_id = GetValue(state, plane.id, "FB_ID");
+  uint32_t crtc_id = GetValue(state, plane.id, "CRTC_ID");
+  if (!fb_id && !crtc_id)
+    return true;
+
+  if (!fb_id || !crtc_id) {
+    IDISPLAYMANAGERTRACE("Fake KMS: plane %d needs both fb and crtc.",
+                         plane.id);
+    return false;
+  }
+
+  auto pipe = std::find(crtcs_.begin(), crtcs_.end(), crtc_id);
+  if (pipe == crtcs_.end() ||
+      !(plane.possible_crtcs & (1 << (pipe - crtcs_.begin())))) {
+    IDISPLAYMANAGERTRACE("Fake KMS: plane %d can't be used on crtc %d.",
+                         plane.id, crtc_id);
+    return false;
+  }
+
+  auto fb = framebuffers_.find(fb_id);
+  if (fb == framebuffers_.end()) {
+    IDISPLAYMANAGERTRACE("Fake KMS: unknown fb %d.", fb_id);
+    return false;
+  }
+
+  const std::vector<uint32_t>& formats = plane.config.formats;
+  if (std::find(formats.begin(), formats.end(), fb->second) == formats.end()) {
+    IDISPLAYMANAGERTRACE("Fake KMS: format %4.4s not supported by plane %d.",
+                         (char*)&fb->second, plane.id);
+    return false;
+  }
+
+  float src_w = GetValue(state, plane.id, "SRC_W") >> 16;
+  float src_h = GetValue(state, plane.id, "SRC_H") >> 16;
+  float crtc_w = GetValue(state, plane.id, "CRTC_W");
+  float crtc_h = GetValue(state, plane.id, "CRTC_H");
+  if (!src_w || !src_h || !crtc_w || !crtc_h)
+    return false;
+
+  float scale_x = crtc_w / src_w;
+  float scale_y = crtc_h / src_h;
+  if (scale_x < plane.config.min_scale || scale_x > plane.config.max_scale ||
+      scale_y < plane.config.min_scale || scale_y > plane.config.max_scale) {
+    IDISPLAYMANAGERTRACE("Fake KMS: scaling %fx%f out of range for plane %d.",
+                         scale_x, scale_y, plane.id);
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,179 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_DISPLAY_FAKEKMSBACKEND_H_
+#define COMMON_DISPLAY_FAKEKMSBACKEND_H_
+
+#include <xf86drmMode.h>
+
+#include <spinlock.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kmsbackend.h"
+#include "nativesync.h"
+
+namespace hwcomposer {
+
+struct FakeKMSPlaneConfig {
+  uint32_t type = DRM_PLANE_TYPE_OVERLAY;
+  std::vector<uint32_t> formats;
+  bool supports_rotation = true;
+  bool supports_alpha = false;
+  // Allowed range of display frame size / source crop size.
+  // 1.0 for both means plane can't scale.
+  float min_scale = 1.0f;
+  float max_scale = 1.0f;
+};
+
+struct FakeKMSConfig {
+  // Sets up a pipe with primary, two scaling overlays and a cursor plane.
+  FakeKMSConfig();
+
+  uint32_t num_pipes = 1;
+  uint32_t width = 1920;
+  uint32_t height = 1080;
+  uint32_t refresh = 60;
+  // Planes created for every pipe.
+  std::vector<FakeKMSPlaneConfig> planes;
+  // Time it takes for a commit, other than TEST_ONLY, to complete,
+  // i.e. till its out fence signals.
+  uint32_t commit_latency_us = 0;
+  bool supports_out_fence = true;
+};
+
+// In-memory KMS device. Validates commits against the configured
+// planes (formats, scaling limits, modeset rules) and keeps the
+// resulting state, so the display pipeline can run without hardware.
+// Commits complete commit_latency_us after they were made, when a
+// worker thread signals their out fence. Only blocking commits wait
+// for that, DRM_MODE_ATOMIC_NONBLOCK ones return right away.
+class FakeKMSBackend : public KMSBackend {
+ public:
+  explicit FakeKMSBackend(const FakeKMSConfig& config);
+  ~FakeKMSBackend() override;
+
+  uint32_t GetCrtcId(uint32_t pipe) const;
+
+  uint32_t GetConnectorId(uint32_t pipe) const;
+
+  void GetPreferredMode(drmModeModeInfo* mode) const;
+
+  // Current value of property |name|, 0 in case it's not set.
+  uint64_t GetCurrentValue(uint32_t object_id, const char* name);
+
+  uint32_t GetCommitCount() const {
+    return commits_;
+  }
+
+  uint32_t GetTestCommitCount() const {
+    return test_commits_;
+  }
+
+  uint32_t GetFailedCommitCount() const {
+    return failed_commits_;
+  }
+
+  bool GetPlanes(std::vector<KMSPlane>* planes) override;
+
+  bool GetProperty(uint32_t object_id, uint32_t object_type, const char* name,
+                   uint32_t* property_id, uint64_t* value) override;
+
+  int64_t GetPropertyEnumValue(uint32_t property_id,
+                               const char* enum_name) override;
+
+  bool SetProperty(uint32_t object_id, uint32_t object_type,
+                   uint32_t property_id, uint64_t value) override;
+
+  std::unique_ptr<KMSPropertySet> CreatePropertySet() override;
+
+  int Commit(KMSPropertySet* property_set, uint32_t flags) override;
+
+  uint32_t CreatePropertyBlob(const void* data, size_t size) override;
+
+  void DestroyPropertyBlob(uint32_t blob_id) override;
+
+  uint32_t AddFrameBuffer(uint32_t width, uint32_t height, uint32_t format,
+                          const uint32_t handles[4], const uint32_t pitches[4],
+                          const uint32_t offsets[4]) override;
+
+  void RemoveFrameBuffer(uint32_t fb_id) override;
+
+ private:
+  typedef std::map<uint32_t, uint64_t> PropertyValues;
+
+  struct Object {
+    uint32_t type;
+    PropertyValues properties;
+  };
+
+  struct Plane {
+    uint32_t id;
+    uint32_t possible_crtcs;
+    FakeKMSPlaneConfig config;
+  };
+
+  struct PendingFlip {
+    std::chrono::steady_clock::time_point deadline;
+    // Out fence timeline point, 0 if no fence was handed out.
+    int64_t point;
+  };
+
+  // Signals flips once their deadline has passed.
+  void FlipRoutine();
+  uint32_t CreateObject(uint32_t type);
+  void AttachProperty(uint32_t object_id, const char* name, uint64_t value);
+  uint32_t GetPropertyId(const char* name);
+  uint64_t GetValue(const std::map<uint32_t, PropertyValues>& state,
+                    uint32_t object_id, const char* name) const;
+  bool ValidatePlane(const Plane& plane,
+                     const std::map<uint32_t, PropertyValues>& state) const;
+
+  FakeKMSConfig config_;
+  std::map<uint32_t, Object> objects_;
+  std::map<std::string, uint32_t> property_ids_;
+  std::vector<Plane> planes_;
+  std::vector<uint32_t> crtcs_;
+  std::vector<uint32_t> connectors_;
+  // Framebuffer id to format.
+  std::map<uint32_t, uint32_t> framebuffers_;
+  std::map<uint32_t, std::vector<uint8_t>> blobs_;
+  uint32_t next_id_ = 1;
+  uint32_t commits_ = 0;
+  uint32_t test_commits_ = 0;
+  uint32_t failed_commits_ = 0;
+  SpinLock lock_;
+  // Guards the timeline and the flip queue.
+  std::mutex flip_lock_;
+  std::condition_variable flip_cond_;
+  NativeSync out_fence_timeline_;
+  bool has_out_fence_timeline_ = false;
+  std::deque<PendingFlip> pending_flips_;
+  uint64_t flips_queued_ = 0;
+  uint64_t flips_done_ = 0;
+  bool flip_exit_ = false;
+  std::thread flip_thread_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_FAKEKMSBACKEND_H_
@@ -0,0 +1,94 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_DISPLAY_KMSBACKEND_H_
+#define COMMON_DISPLAY_KMSBACKEND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+namespace hwcomposer {
+
+struct KMSPlane {
+  uint32_t id = 0;
+  uint32_t possible_crtcs = 0;
+  std::vector<uint32_t> formats;
+};
+
+// Properties collected for one atomic commit.
+class KMSPropertySet {
+ public:
+  virtual ~KMSPropertySet() {
+  }
+
+  // Returns a negative value in case property couldn't be added.
+  virtual int AddProperty(uint32_t object_id, uint32_t property_id,
+                          uint64_t value) = 0;
+};
+
+// Everything DisplayQueue, DisplayPlaneManager and DisplayPlane need
+// from the kernel mode setting API. Object types, commit flags and
+// property names follow KMS (DRM_MODE_OBJECT_*, DRM_MODE_ATOMIC_*,
+// "OUT_FENCE_PTR" etc).
+class KMSBackend {
+ public:
+  virtual ~KMSBackend() {
+  }
+
+  // Planes usable for scanout.
+  virtual bool GetPlanes(std::vector<KMSPlane>* planes) = 0;
+
+  // Looks up property |name| of the given object. Returns false in case
+  // object doesn't expose the property. |value| can be NULL.
+  virtual bool GetProperty(uint32_t object_id, uint32_t object_type,
+                           const char* name, uint32_t* property_id,
+                           uint64_t* value) = 0;
+
+  // Returns value of |enum_name| for an enum property or -1 in case
+  // property or enum entry doesn't exist.
+  virtual int64_t GetPropertyEnumValue(uint32_t property_id,
+                                       const char* enum_name) = 0;
+
+  // Sets a property outside of an atomic commit.
+  virtual bool SetProperty(uint32_t object_id, uint32_t object_type,
+                           uint32_t property_id, uint64_t value) = 0;
+
+  virtual std::unique_ptr<KMSPropertySet> CreatePropertySet() = 0;
+
+  // Commits property_set. Returns 0 on success or a negative errno.
+  // In case property_set has OUT_FENCE_PTR set, the out fence is
+  // written to the given address.
+  virtual int Commit(KMSPropertySet* property_set, uint32_t flags) = 0;
+
+  // Returns 0 in case blob couldn't be created.
+  virtual uint32_t CreatePropertyBlob(const void* data, size_t size) = 0;
+
+  virtual void DestroyPropertyBlob(uint32_t blob_id) = 0;
+
+  // Returns 0 in case framebuffer couldn't be created.
+  virtual uint32_t AddFrameBuffer(uint32_t width, uint32_t height,
+                                  uint32_t format, const uint32_t handles[4],
+                                  const uint32_t pitches[4],
+                                  const uint32_t offsets[4]) = 0;
+
+  virtual void RemoveFrameBuffer(uint32_t fb_id) = 0;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_KMSBACKEND_H_
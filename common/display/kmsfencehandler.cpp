@@ -16,6 +16,7 @@
 
 #include "kmsfencehandler.h"
 
+#include "commitscheduler.h"
 #include "displayqueue.h"
 #include "hwcutils.h"
 #include "hwctrace.h"
@@ -61,10 +62,16 @@ bool KMSFenceEventHandler::EnsureReadyForNextFrame() {
 }
 
 void KMSFenceEventHandler::WaitFence(uint32_t kms_fence,
-                                     std::vector<OverlayLayer>& layers) {
+                                     std::vector<OverlayLayer>& layers,
+                                     int64_t release_point,
+                                     int64_t retire_point) {
   CTRACE();
   spin_lock_.lock();
   kms_fence_ = kms_fence;
+  // In case we haven't handled the previous request yet, points
+  // are released together.
+  release_point_ = release_point;
+  retire_point_ = retire_point;
   for (OverlayLayer& layer : layers) {
     OverlayBuffer* const buffer = layer.GetBuffer();
     buffers_.emplace_back(buffer);
@@ -91,6 +98,8 @@ void KMSFenceEventHandler::HandleRoutine() {
   std::vector<const OverlayBuffer*> buffers;
   buffers.swap(buffers_);
   uint32_t kms_fence = kms_fence_;
+  int64_t release_point = release_point_;
+  int64_t retire_point = retire_point_;
   kms_fence_ = 0;
   spin_lock_.unlock();
 
@@ -100,8 +109,15 @@ void KMSFenceEventHandler::HandleRoutine() {
 
   if (kms_fence > 0) {
     HWCPoll(kms_fence, -1);
+    // This thread wakes up late by scheduling latency, use the time
+    // the kernel signalled the fence at for vblank prediction.
+    int64_t flip_time = GetFenceSignalTime(kms_fence);
+    if (!flip_time)
+      flip_time = CommitScheduler::Now();
+
     close(kms_fence);
     kms_fence = 0;
+    display_queue_->HandlePageFlip(flip_time);
   }
 
   ready_fence_lock_.lock();
@@ -111,7 +127,7 @@ void KMSFenceEventHandler::HandleRoutine() {
   }
   ready_fence_lock_.unlock();
 
-  display_queue_->HandleCommitUpdate(buffers);
+  display_queue_->HandleCommitUpdate(buffers, release_point, retire_point);
 }
 
 }  // namespace hwcomposer
@@ -23,7 +23,6 @@
 
 #include <vector>
 
-#include "nativesync.h"
 #include "overlaylayer.h"
 
 #include "hwcthread.h"
@@ -39,7 +38,11 @@ class KMSFenceEventHandler : public HWCThread {
 
   bool Initialize();
 
-  void WaitFence(uint32_t kms_fence, std::vector<OverlayLayer>& layers);
+  // Waits for kms_fence to signal and releases buffers of layers.
+  // release_point and retire_point are the points on DisplayQueue
+  // release and retire timelines which are signalled along with it.
+  void WaitFence(uint32_t kms_fence, std::vector<OverlayLayer>& layers,
+                 int64_t release_point, int64_t retire_point);
 
   bool EnsureReadyForNextFrame();
 
@@ -52,6 +55,8 @@ class KMSFenceEventHandler : public HWCThread {
   std::vector<const OverlayBuffer*> buffers_;
   uint32_t kms_fence_;
   uint32_t kms_ready_fence_;
+  int64_t release_point_ = 0;
+  int64_t retire_point_ = 0;
   DisplayQueue* display_queue_;
 };
 
@@ -30,11 +30,13 @@ namespace hwcomposer {
 
 VirtualDisplay::VirtualDisplay(uint32_t gpu_fd,
                                OverlayBufferManager *buffer_manager,
+                               RendererService *renderer_service,
                                uint32_t pipe_id, uint32_t crtc_id)
     : Headless(gpu_fd, pipe_id, crtc_id),
       output_handle_(0),
       acquire_fence_(-1),
       buffer_manager_(buffer_manager),
+      renderer_service_(renderer_service),
       width_(0),
       height_(0) {
 }
@@ -43,7 +45,7 @@ VirtualDisplay::~VirtualDisplay() {
 }
 
 void VirtualDisplay::InitVirtualDisplay(uint32_t width, uint32_t height) {
-  compositor_.Init();
+  compositor_.Init(renderer_service_);
   width_ = width;
   height_ = height;
 }
@@ -68,6 +70,7 @@ bool VirtualDisplay::Present(std::vector<HwcLayer *> &source_layers,
   std::vector<size_t> index;
   int ret = 0;
   size_t size = source_layers.size();
+  buffer_manager_->ReclaimStaleBuffers();
   for (size_t layer_index = 0; layer_index < size; layer_index++) {
     HwcLayer *layer = source_layers.at(layer_index);
     layers.emplace_back();
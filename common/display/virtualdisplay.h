@@ -26,11 +26,13 @@
 namespace hwcomposer {
 struct HwcLayer;
 class OverlayBufferManager;
+class RendererService;
 
 class VirtualDisplay : public Headless {
  public:
   VirtualDisplay(uint32_t gpu_fd, OverlayBufferManager *buffer_manager,
-                 uint32_t pipe_id, uint32_t crtc_id);
+                 RendererService *renderer_service, uint32_t pipe_id,
+                 uint32_t crtc_id);
   ~VirtualDisplay() override;
 
   void InitVirtualDisplay(uint32_t width, uint32_t height) override;
@@ -48,6 +50,7 @@ class VirtualDisplay : public Headless {
   HWCNativeHandle output_handle_;
   int32_t acquire_fence_;
   OverlayBufferManager *buffer_manager_;
+  RendererService *renderer_service_;
   Compositor compositor_;
   uint32_t width_;
   uint32_t height_;
@@ -15,319 +15,177 @@
 */
 
 #include "disjoint_layers.h"
-#include <assert.h>
-#include <stdint.h>
+
 #include <algorithm>
-#include <iostream>
-#include <list>
-#include <map>
-#include <set>
-#include <utility>
-#include <vector>
-#include "hwctrace.h"
 
 namespace hwcomposer {
 
-enum EventType { START, END };
-
-struct YPOI {
-  EventType type;
-  uint64_t y;
-  uint64_t rect_id;
-
-  bool operator<(const YPOI &rhs) const {
-    if (y == rhs.y)
-      return rect_id < rhs.rect_id;
-    else
-      return (y < rhs.y);
-  }
-};
-
-// Any region will have start X and set of Y coordinates.
-struct Region {
-  uint64_t sx;
-  std::set<YPOI> y_points;
-  RectIDs rect_ids;
-};
-
-// POI is the point of interest while traversing through x coordinates
-struct POI {
-  EventType type;
-  uint64_t rect_id;
-  uint64_t x;
-  uint64_t top_y;
-  uint64_t bot_y;
-
-  bool operator<(const POI &rhs) const {
-    return (x <= rhs.x);
-  }
-};
-
-// This function will take active region and right x
-// For an active region there will be set of YPOI
-// It will traverse through each y_poi and given out
-// rectangle with rect_ids active at that time.
-void GenerateOutLayers(Region *reg, uint64_t x,
-                       std::vector<RectSet<int>> *out) {
-  Rect<int> out_rect;
-  out_rect.left = reg->sx;
-  out_rect.right = x;
-  RectIDs rect_ids;
-
-  for (std::set<YPOI>::iterator y_poi_it = reg->y_points.begin();
-       y_poi_it != reg->y_points.end(); y_poi_it++) {
-    const YPOI &y_poi = *y_poi_it;
-    // No need to check for start or end event
-    // as rect_ids is empty
-    if (rect_ids.isEmpty()) {
-      out_rect.top = y_poi.y;
-      rect_ids.add(y_poi.rect_id);
-    } else {
-      if (out_rect.top == static_cast<int>(y_poi.y)) {
-        if (y_poi.type == START) {
-          rect_ids.add(y_poi.rect_id);
-        } else {
-          rect_ids.subtract(y_poi.rect_id);
-        }
-        continue;
-      }
-      out_rect.bottom = y_poi.y;
-      out->emplace_back(RectSet<int>(rect_ids, out_rect));
-      out_rect.top = y_poi.y;
-      if (y_poi.type == START) {
-        rect_ids.add(y_poi.rect_id);
-      } else {
-        rect_ids.subtract(y_poi.rect_id);
-      }
-    }
-  }
-}
-
-// This function will remove y coordinates corresponding to given rect_id
-void RemoveYpois(Region *reg, uint64_t rect_id) {
-  std::set<YPOI>::iterator top_it = reg->y_points.begin();
-  while (top_it != reg->y_points.end()) {
-    if ((*top_it).rect_id == rect_id) {
-      reg->y_points.erase(top_it++);
-    } else {
-      top_it++;
-    }
-  }
-}
-
-bool compare_region(const Region *first, const Region *second) {
-  uint64_t first_min_y = (*(first->y_points.begin())).y;
-  uint64_t second_min_y = (*(second->y_points.begin())).y;
-  return (first_min_y < second_min_y);
+static bool IsValidRect(const Rect<int> &rect) {
+  return rect.left < rect.right && rect.top < rect.bottom;
 }
 
+// Sweeps a vertical line over all x coordinates where a rect starts or
+// ends. Between two such coordinates (a slab) the set of rects crossing
+// the line doesn't change, so the slab is split at the top and bottom
+// edges of those rects. A region is extended into the next slab as long
+// as it keeps the same vertical span and rect ids.
+template <size_t N>
 void get_draw_regions(const std::vector<Rect<int>> &in,
-                      std::vector<RectSet<int>> *out) {
-  if (in.size() > RectIDs::max_elements) {
+                      std::vector<RectSet<int, N>> *out,
+                      DrawRegionsScratch *scratch) {
+  out->clear();
+  if (in.size() > N)
     return;
-  }
-
-  // Set of all point of interests from input rectangles.
-  std::set<POI> pois;
-  std::list<Region *> imp_reg;
-  std::list<Region> active_regions;
-
-  // This loop will add all point of interests into pois.
-  for (uint64_t i = 0; i < in.size(); i++) {
-    const Rect<int> &rect = in[i];
 
+  std::vector<int> &x_points = scratch->x_points;
+  std::vector<DrawRegionsScratch::YEvent> &y_events = scratch->y_events;
+  std::vector<size_t> &previous_slab = scratch->previous_slab;
+  std::vector<size_t> &current_slab = scratch->current_slab;
+  x_points.clear();
+  previous_slab.clear();
+  for (const Rect<int> &rect : in) {
     // Filter out empty or invalid rects.
-    if (rect.left >= rect.right || rect.top >= rect.bottom)
+    if (!IsValidRect(rect))
       continue;
 
-    POI poi;
-    poi.rect_id = i;
-    poi.x = rect.left;
-    poi.top_y = rect.top;
-    poi.bot_y = rect.bottom;
-    poi.type = START;
-    pois.insert(poi);
-
-    poi.type = END;
-    poi.x = rect.right;
-    pois.insert(poi);
+    x_points.emplace_back(rect.left);
+    x_points.emplace_back(rect.right);
   }
 
-  for (std::set<POI>::iterator it = pois.begin(); it != pois.end(); ++it) {
-    const POI &poi = *it;
-    // First rectangle has to be inserted into active region
-    // This condition will be true if existing all active
-    // regions are already copied to out.
-    // If current poi is of type END there are no active regions,
-    // then this poi might already covered in previous pass
-    if (active_regions.size() == 0 && poi.type == START) {
-      Region reg;
-      reg.sx = poi.x;
-      YPOI y_poi;
-
-      y_poi.rect_id = poi.rect_id;
-      y_poi.type = START;
-      y_poi.y = poi.top_y;
-      reg.y_points.insert(y_poi);
-
-      y_poi.type = END;
-      y_poi.y = poi.bot_y;
-      reg.y_points.insert(y_poi);
+  std::sort(x_points.begin(), x_points.end());
+  x_points.erase(std::unique(x_points.begin(), x_points.end()),
+                 x_points.end());
+
+  for (size_t i = 1; i < x_points.size(); i++) {
+    int left = x_points[i - 1];
+    int right = x_points[i];
+    y_events.clear();
+    current_slab.clear();
+    for (size_t rect_id = 0; rect_id < in.size(); rect_id++) {
+      const Rect<int> &rect = in[rect_id];
+      if (!IsValidRect(rect) || rect.left > left || rect.right < right)
+        continue;
 
-      RectIDs rectIds;
-      rectIds.add(poi.rect_id);
-      reg.rect_ids = rectIds;
-      active_regions.push_back(reg);
-      continue;
+      y_events.push_back({rect.top, static_cast<uint32_t>(rect_id), true});
+      y_events.push_back({rect.bottom, static_cast<uint32_t>(rect_id), false});
     }
 
-    // If active_regions in not empty, Check if current
-    // poi y points fall in range of any existing
-    // active_regions.
-    // If yes, get that active region and do further processing
-    // If No, create a new region and insert into active regions
-    // If it is start event then there is possibility that multiple
-    // active_regions get impacted.
-    // If it is end event then one or none active_regions will get
-    // impacted.
-    bool found = false;
-    imp_reg.clear();
-    std::list<Region>::iterator it_reg = active_regions.begin();
-    while (it_reg != active_regions.end()) {
-      Region &cur_reg = *it_reg;
-      uint64_t min_y = (*(cur_reg.y_points.begin())).y;
-      uint64_t max_y = (*(cur_reg.y_points.rbegin())).y;
-      // If bottom y is less than minimum y in region or top y is greater than
-      // max y in region, then this region is not impacted by this rect
-      if (poi.bot_y <= min_y || poi.top_y >= max_y) {
-        it_reg++;
+    std::sort(y_events.begin(), y_events.end(),
+              [](const DrawRegionsScratch::YEvent &lhs,
+                 const DrawRegionsScratch::YEvent &rhs) {
+                return lhs.y < rhs.y;
+              });
+
+    RectIDs<N> rect_ids;
+    size_t previous_index = 0;
+    size_t num_events = y_events.size();
+    for (size_t event = 0; event < num_events;) {
+      int top = y_events[event].y;
+      for (; event < num_events && y_events[event].y == top; event++) {
+        if (y_events[event].start)
+          rect_ids.add(y_events[event].rect_id);
+        else
+          rect_ids.subtract(y_events[event].rect_id);
+      }
+
+      if (rect_ids.isEmpty() || event == num_events)
         continue;
-      } else {
-        found = true;
-        // Found atleast one affected active region. If it is start event,
-        // add rect_id to cur_reg.rect_ids, also top_y and bot_y to
-        // cur_reg.y_points. if it is end event, remove rect_id from
-        // cur_reg.rect_ids and also top_y and bot_y from cur_reg.y_points.
-        // Also, if it is end event, check cur_reg.rect_ids is non empty,
-        // if it is empty remove region from active_regions.
-        // If it is end event, check next poi.x and see if it is same and
-        // those y coordinates fall in this region, if yes 1) remove
-        // that rect_id and y coordinates as well
-        // 2)contine to check next poi.x until you find mismatch x.
-        if (poi.x == cur_reg.sx) {
-          if (poi.type == START) {
-            cur_reg.rect_ids.add(poi.rect_id);
-            imp_reg.push_back(&cur_reg);
-          }
 
-          it_reg++;
+      int bottom = y_events[event].y;
+      // Regions of previous slab are ordered by their top edge.
+      while (previous_index < previous_slab.size() &&
+             (*out)[previous_slab[previous_index]].rect.top < top)
+        previous_index++;
+
+      if (previous_index < previous_slab.size()) {
+        RectSet<int, N> &previous = (*out)[previous_slab[previous_index]];
+        if (previous.rect.top == top && previous.rect.bottom == bottom &&
+            previous.id_set == rect_ids) {
+          previous.rect.right = right;
+          current_slab.emplace_back(previous_slab[previous_index]);
           continue;
         }
-        if (poi.type == START) {
-          GenerateOutLayers(&cur_reg, poi.x, out);
-          cur_reg.sx = poi.x;
-          cur_reg.rect_ids.add(poi.rect_id);
-          imp_reg.push_back(&cur_reg);
-          it_reg++;
-        } else {
-          GenerateOutLayers(&cur_reg, poi.x, out);
-          RemoveYpois(&cur_reg, poi.rect_id);
-          cur_reg.sx = poi.x;
-          cur_reg.rect_ids.subtract(poi.rect_id);
-
-          std::set<POI>::iterator next_poi_it = it;
-          next_poi_it++;
-          for (; next_poi_it != pois.end(); next_poi_it++) {
-            const POI &next_poi = *next_poi_it;
-            if (next_poi.x != poi.x) {
-              break;
-            } else {
-              if (next_poi.bot_y <= min_y || next_poi.top_y >= max_y ||
-                  next_poi.type == START) {
-                continue;
-              }
-              cur_reg.rect_ids.subtract(next_poi.rect_id);
-              RemoveYpois(&cur_reg, next_poi.rect_id);
-            }
-          }
-          if (cur_reg.rect_ids.isEmpty()) {
-            active_regions.erase(it_reg++);
-          } else {
-            it_reg++;
-          }
-        }
       }
+
+      current_slab.emplace_back(out->size());
+      out->emplace_back(rect_ids, Rect<int>(left, top, right, bottom));
     }
-    // If no affected active region found, add new active region
-    if (!found && poi.type == START) {
-      Region reg;
-      reg.sx = poi.x;
-      YPOI y_poi;
 
-      y_poi.rect_id = poi.rect_id;
-      y_poi.type = START;
-      y_poi.y = poi.top_y;
-      reg.y_points.insert(y_poi);
+    previous_slab.swap(current_slab);
+  }
+}
 
-      y_poi.type = END;
-      y_poi.y = poi.bot_y;
-      reg.y_points.insert(y_poi);
+// Joins rectangles of regions which have the same rect_ids and share a
+// full edge along one axis. Returns true if anything was merged.
+template <size_t N>
+static bool MergeRegions(std::vector<RectSet<int, N>> *regions,
+                         bool horizontal) {
+  std::vector<RectSet<int, N>> &sets = *regions;
+  // Edges along which regions are joined are the first two bounds,
+  // the shared extent the other two.
+  int start = horizontal ? 0 : 1;
+  int end = horizontal ? 2 : 3;
+  int side = horizontal ? 1 : 0;
+  int other_side = horizontal ? 3 : 2;
+  std::sort(sets.begin(), sets.end(),
+            [=](const RectSet<int, N> &lhs, const RectSet<int, N> &rhs) {
+              if (!(lhs.id_set == rhs.id_set))
+                return lhs.id_set < rhs.id_set;
+              if (lhs.rect.bounds[side] != rhs.rect.bounds[side])
+                return lhs.rect.bounds[side] < rhs.rect.bounds[side];
+              if (lhs.rect.bounds[other_side] != rhs.rect.bounds[other_side])
+                return lhs.rect.bounds[other_side] <
+                       rhs.rect.bounds[other_side];
+              return lhs.rect.bounds[start] < rhs.rect.bounds[start];
+            });
+
+  size_t merged = 0;
+  for (size_t i = 1; i < sets.size(); i++) {
+    RectSet<int, N> &last = sets[merged];
+    const RectSet<int, N> &cur = sets[i];
+    if (last.id_set == cur.id_set &&
+        last.rect.bounds[side] == cur.rect.bounds[side] &&
+        last.rect.bounds[other_side] == cur.rect.bounds[other_side] &&
+        last.rect.bounds[end] == cur.rect.bounds[start]) {
+      last.rect.bounds[end] = cur.rect.bounds[end];
+      continue;
+    }
 
-      RectIDs rectIds;
-      rectIds.add(poi.rect_id);
-      reg.rect_ids = rectIds;
-      active_regions.push_back(reg);
-    } else {
-      if (imp_reg.size() > 1 && poi.type == START) {
-        imp_reg.sort(compare_region);
-        uint64_t cur_y = 0;
-        for (std::list<Region *>::iterator cur_imp_reg_it = imp_reg.begin();
-             cur_imp_reg_it != imp_reg.end(); cur_imp_reg_it++) {
-          Region &cur_imp_reg = *(*cur_imp_reg_it);
-          YPOI y_poi;
-          y_poi.rect_id = poi.rect_id;
-          y_poi.type = START;
+    sets[++merged] = cur;
+  }
 
-          if (cur_y == 0) {
-            y_poi.y = poi.top_y;
-          } else {
-            y_poi.y = cur_y;
-          }
-          // This is to split vertical
-          // line into all impacted
-          // regions.
-          cur_imp_reg.y_points.insert(y_poi);
-          // Take bottom of current region as start of next impacted region
-          cur_y = (*(cur_imp_reg.y_points.rbegin())).y;
-          std::list<Region *>::iterator next_imp_reg_it = cur_imp_reg_it;
-          next_imp_reg_it++;
-          if (next_imp_reg_it == imp_reg.end()) {
-            // If there is an another
-            // region which is impacted, no
-            // need to add anything.
-            // if there is no other active region left,
-            // take bottom y and push into this active region
-            y_poi.y = poi.bot_y;
-          } else {
-            y_poi.y = cur_y;
-          }
-          y_poi.type = END;
-          cur_imp_reg.y_points.insert(y_poi);
-        }
-      } else if (imp_reg.size() == 1 && poi.type == START) {
-        // Only one region got impacted add y coordinated to that region
-        std::list<Region *>::iterator cur_imp_reg_it = imp_reg.begin();
-        YPOI y_poi;
-        y_poi.rect_id = poi.rect_id;
-        y_poi.type = START;
-        y_poi.y = poi.top_y;
-        (*cur_imp_reg_it)->y_points.insert(y_poi);
-        y_poi.type = END;
-        y_poi.y = poi.bot_y;
-        (*cur_imp_reg_it)->y_points.insert(y_poi);
-      }
-    }
+  if (sets.empty() || merged + 1 == sets.size())
+    return false;
+
+  sets.erase(sets.begin() + merged + 1, sets.end());
+  return true;
+}
+
+template <size_t N>
+void merge_draw_regions(std::vector<RectSet<int, N>> *regions) {
+  // get_draw_regions emits vertical slivers, so join them horizontally
+  // first. Each pass can enable further merges along the other axis.
+  bool horizontal = true;
+  bool merged = true;
+  bool last_merged = true;
+  while (merged || last_merged) {
+    last_merged = merged;
+    merged = MergeRegions(regions, horizontal);
+    horizontal = !horizontal;
   }
 }
 
+template void get_draw_regions<64>(const std::vector<Rect<int>> &in,
+                                   std::vector<RectSet<int, 64>> *out,
+                                   DrawRegionsScratch *scratch);
+template void get_draw_regions<128>(const std::vector<Rect<int>> &in,
+                                    std::vector<RectSet<int, 128>> *out,
+                                    DrawRegionsScratch *scratch);
+template void get_draw_regions<256>(const std::vector<Rect<int>> &in,
+                                    std::vector<RectSet<int, 256>> *out,
+                                    DrawRegionsScratch *scratch);
+template void merge_draw_regions<64>(std::vector<RectSet<int, 64>> *regions);
+template void merge_draw_regions<128>(std::vector<RectSet<int, 128>> *regions);
+template void merge_draw_regions<256>(std::vector<RectSet<int, 256>> *regions);
+
 }  // namespace hwcomposer
@@ -17,6 +17,7 @@
 #ifndef COMMON_UTILS_DISJOINT_LAYERS_H_
 #define COMMON_UTILS_DISJOINT_LAYERS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <hwcrect.h>
@@ -26,75 +27,130 @@
 namespace hwcomposer {
 
 // Some of the structs are adopted from drm_hwcomposer
+// Set of rect ids, N is the maximum number of rects and has to be
+// a multiple of 64.
+template <size_t N>
 struct RectIDs {
  public:
   typedef uint64_t TId;
 
-  RectIDs() : bitset(0) {
+  RectIDs() {
+    clear();
   }
 
-  explicit RectIDs(TId id) : bitset(0) {
+  explicit RectIDs(TId id) {
+    clear();
     add(id);
   }
 
+  void clear() {
+    for (size_t i = 0; i < kWords; i++)
+      bitset[i] = 0;
+  }
+
   void add(TId id) {
-    bitset |= ((uint64_t)1) << id;
+    bitset[id / 64] |= ((uint64_t)1) << (id % 64);
   }
 
   void subtract(TId id) {
-    bitset &= ~(((uint64_t)1) << id);
+    bitset[id / 64] &= ~(((uint64_t)1) << (id % 64));
   }
 
-  bool isEmpty() const {
-    return bitset == 0;
+  bool test(TId id) const {
+    return bitset[id / 64] & (((uint64_t)1) << (id % 64));
   }
 
-  uint64_t getBits() const {
-    return bitset;
+  bool isEmpty() const {
+    for (size_t i = 0; i < kWords; i++) {
+      if (bitset[i])
+        return false;
+    }
+
+    return true;
   }
 
   bool operator==(const RectIDs &rhs) const {
-    return bitset == rhs.bitset;
+    for (size_t i = 0; i < kWords; i++) {
+      if (bitset[i] != rhs.bitset[i])
+        return false;
+    }
+
+    return true;
   }
 
   bool operator<(const RectIDs &rhs) const {
-    return bitset < rhs.bitset;
+    for (size_t i = kWords; i-- > 0;) {
+      if (bitset[i] != rhs.bitset[i])
+        return bitset[i] < rhs.bitset[i];
+    }
+
+    return false;
   }
 
   RectIDs operator|(const RectIDs &rhs) const {
     RectIDs ret;
-    ret.bitset = bitset | rhs.bitset;
+    for (size_t i = 0; i < kWords; i++)
+      ret.bitset[i] = bitset[i] | rhs.bitset[i];
     return ret;
   }
 
   RectIDs operator|(TId id) const {
-    RectIDs ret;
-    ret.bitset = bitset;
+    RectIDs ret = *this;
     ret.add(id);
     return ret;
   }
 
-  static const int max_elements = sizeof(TId) * 8;
+  static const size_t max_elements = N;
 
  private:
-  uint64_t bitset;
+  static_assert(N > 0 && N % 64 == 0, "N has to be a multiple of 64");
+  static const size_t kWords = N / 64;
+  uint64_t bitset[kWords];
 };
 
-template <typename TNum>
+template <typename TNum, size_t N = 64>
 struct RectSet {
-  RectIDs id_set;
+  RectIDs<N> id_set;
   Rect<TNum> rect;
 
-  RectSet(const RectIDs &i, const Rect<TNum> &r) : id_set(i), rect(r) {
+  RectSet(const RectIDs<N> &i, const Rect<TNum> &r) : id_set(i), rect(r) {
   }
 
-  bool operator==(const RectSet<TNum> &rhs) const {
+  bool operator==(const RectSet<TNum, N> &rhs) const {
     return (id_set == rhs.id_set) && (rect == rhs.rect);
   }
 };
 
+// Working memory of get_draw_regions. Keep it around between calls
+// so that no allocations are needed once it has grown to fit.
+struct DrawRegionsScratch {
+  struct YEvent {
+    int y;
+    uint32_t rect_id;
+    bool start;
+  };
+
+  std::vector<int> x_points;
+  std::vector<YEvent> y_events;
+  // Indices in out of the regions emitted for the previous and
+  // current vertical slab.
+  std::vector<size_t> previous_slab;
+  std::vector<size_t> current_slab;
+};
+
+// Splits the area covered by in into disjoint rectangles, each tagged
+// with the ids (indices in in) of all rects covering it. out is
+// cleared first. Nothing is generated if in has more than N rects.
+template <size_t N>
 void get_draw_regions(const std::vector<Rect<int>> &in,
-                      std::vector<RectSet<int>> *out);
+                      std::vector<RectSet<int, N>> *out,
+                      DrawRegionsScratch *scratch);
+
+// Coalesces neighbouring regions with equal id_set into larger
+// rectangles. Region order is not preserved.
+template <size_t N>
+void merge_draw_regions(std::vector<RectSet<int, N>> *regions);
+
 }  // namespace hwcomposer
 
 #endif  // COMMON_UTILS_DISJOINT_LAYERS_H_
@@ -16,12 +16,58 @@
 
 #include "hwcutils.h"
 
+#include <drm_fourcc.h>
+#include <i915_drm.h>
+#include <linux/sync_file.h>
 #include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+#include <algorithm>
 
 #include "hwctrace.h"
 
+// Older drm_fourcc.h don't define the Intel modifiers.
+#ifndef I915_FORMAT_MOD_X_TILED
+#define I915_FORMAT_MOD_X_TILED ((1ULL << 56) | 1)
+#define I915_FORMAT_MOD_Y_TILED ((1ULL << 56) | 2)
+#endif
+
 namespace hwcomposer {
 
+void SubtractRect(const HwcRect<int>& hole, std::vector<HwcRect<int>>& rects) {
+  size_t count = rects.size();
+  for (size_t i = 0; i < count; i++) {
+    HwcRect<int> rect = rects[i];
+    if (IsEmptyRect(IntersectRect(rect, hole)))
+      continue;
+
+    // Replace rect with the parts of it above, below, left
+    // and right of hole.
+    rects[i] = HwcRect<int>(0, 0, 0, 0);
+    if (rect.top < hole.top)
+      rects.emplace_back(rect.left, rect.top, rect.right, hole.top);
+
+    if (hole.bottom < rect.bottom)
+      rects.emplace_back(rect.left, hole.bottom, rect.right, rect.bottom);
+
+    int top = rect.top > hole.top ? rect.top : hole.top;
+    int bottom = rect.bottom < hole.bottom ? rect.bottom : hole.bottom;
+    if (rect.left < hole.left)
+      rects.emplace_back(rect.left, top, hole.left, bottom);
+
+    if (hole.right < rect.right)
+      rects.emplace_back(hole.right, top, rect.right, bottom);
+  }
+
+  rects.erase(std::remove_if(rects.begin(), rects.end(),
+                             [](const HwcRect<int>& rect) {
+                               return IsEmptyRect(rect);
+                             }),
+              rects.end());
+}
+
 void HWCPoll(int fd, int timeout) {
   CTRACE();
   struct pollfd fds[1];
@@ -33,4 +79,60 @@ void HWCPoll(int fd, int timeout) {
   }
 }
 
+bool IsFenceSignalled(int fd) {
+  if (fd <= 0)
+    return true;
+
+  struct pollfd fds[1];
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  return poll(fds, 1, 0) > 0;
+}
+
+int64_t GetMonotonicTimeNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t GetFenceSignalTime(int fd) {
+  struct sync_file_info info;
+  memset(&info, 0, sizeof(info));
+  // First call only reports the number of fences.
+  if (ioctl(fd, SYNC_IOC_FILE_INFO, &info) < 0 || info.status != 1 ||
+      !info.num_fences)
+    return 0;
+
+  std::vector<struct sync_fence_info> fences(info.num_fences);
+  info.sync_fence_info = reinterpret_cast<uintptr_t>(fences.data());
+  if (ioctl(fd, SYNC_IOC_FILE_INFO, &info) < 0)
+    return 0;
+
+  // Fence is signalled once all of its fences are.
+  int64_t timestamp = 0;
+  for (const struct sync_fence_info& fence : fences) {
+    if (static_cast<int64_t>(fence.timestamp_ns) > timestamp)
+      timestamp = fence.timestamp_ns;
+  }
+
+  return timestamp;
+}
+
+uint64_t GetBufferModifier(uint32_t gpu_fd, uint32_t gem_handle) {
+  struct drm_i915_gem_get_tiling tiling;
+  memset(&tiling, 0, sizeof(tiling));
+  tiling.handle = gem_handle;
+  if (ioctl(gpu_fd, DRM_IOCTL_I915_GEM_GET_TILING, &tiling) < 0)
+    return 0;
+
+  switch (tiling.tiling_mode) {
+    case I915_TILING_X:
+      return I915_FORMAT_MOD_X_TILED;
+    case I915_TILING_Y:
+      return I915_FORMAT_MOD_Y_TILED;
+    default:
+      return 0;
+  }
+}
+
 }  // namespace hwcomposer
@@ -20,6 +20,8 @@
 #include <hwcdefs.h>
 #include "hwcdefs_internal.h"
 
+#include <vector>
+
 namespace hwcomposer {
 
 inline HWCString dumpDisplayType(EDisplayType eDT) {
@@ -61,16 +63,73 @@ inline T alignTo(T value, T align) {
   return (value + (align - 1)) & ~(align - 1);
 }
 #endif
+// Returns true if rect doesn't cover any pixels.
+template <typename T>
+inline bool IsEmptyRect(const HwcRect<T>& rect) {
+  return rect.right <= rect.left || rect.bottom <= rect.top;
+}
+
+// Smallest rect containing both lhs and rhs. Empty rects are ignored.
+template <typename T>
+inline HwcRect<T> UnionRect(const HwcRect<T>& lhs, const HwcRect<T>& rhs) {
+  if (IsEmptyRect(lhs))
+    return rhs;
+
+  if (IsEmptyRect(rhs))
+    return lhs;
+
+  return HwcRect<T>(lhs.left < rhs.left ? lhs.left : rhs.left,
+                    lhs.top < rhs.top ? lhs.top : rhs.top,
+                    lhs.right > rhs.right ? lhs.right : rhs.right,
+                    lhs.bottom > rhs.bottom ? lhs.bottom : rhs.bottom);
+}
+
+// Area covered by both lhs and rhs, (0, 0, 0, 0) if they don't overlap.
+template <typename T>
+inline HwcRect<T> IntersectRect(const HwcRect<T>& lhs,
+                                const HwcRect<T>& rhs) {
+  HwcRect<T> rect(lhs.left > rhs.left ? lhs.left : rhs.left,
+                  lhs.top > rhs.top ? lhs.top : rhs.top,
+                  lhs.right < rhs.right ? lhs.right : rhs.right,
+                  lhs.bottom < rhs.bottom ? lhs.bottom : rhs.bottom);
+  if (IsEmptyRect(rect))
+    return HwcRect<T>(0, 0, 0, 0);
+
+  return rect;
+}
+
 inline float fixed16ToFloat(int v)
 {
     return float(v) / 65536.0f;
 }
 
+// Removes area covered by hole from rects, parts of a rect
+// which are left are appended as new rects.
+void SubtractRect(const HwcRect<int>& hole, std::vector<HwcRect<int>>& rects);
+
 // Call poll() on fd.
 //  - timeout: time in miliseconds to stay blocked before returning if fd
 //  is not ready.
 void HWCPoll(int fd, int timeout);
 
+// Returns true if fence fd has signalled, or fd isn't a fence.
+bool IsFenceSignalled(int fd);
+
+// Current CLOCK_MONOTONIC time in nanoseconds.
+int64_t GetMonotonicTimeNs();
+
+// CLOCK_MONOTONIC time in nanoseconds at which sync_file fd was
+// signalled, as recorded by the kernel. For a KMS out fence this is
+// the time of the flip. Returns 0 if fd hasn't signalled or the
+// kernel doesn't report it.
+int64_t GetFenceSignalTime(int fd);
+
+// Format modifier matching the tiling i915 reports for gem_handle.
+// Framebuffers are created without modifiers, the kernel picks
+// tiling of the buffer object. Returns DRM_FORMAT_MOD_LINEAR (0) in
+// case the tiling can't be queried.
+uint64_t GetBufferModifier(uint32_t gpu_fd, uint32_t gem_handle);
+
 }  // namespace hwcomposer
 
 #endif  // COMMON_UTILS_HWCUTILS_H_
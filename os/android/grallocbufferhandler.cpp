@@ -34,6 +34,7 @@
 #include <hwcdefs.h>
 #include <hwctrace.h>
 #include "drmhwcgralloc.h"
+#include "hwcutils.h"
 
 namespace hwcomposer {
 
@@ -123,6 +124,8 @@ bool GrallocBufferHandler::ImportBuffer(HWCNativeHandle handle, HwcBuffer *bo) {
     bo->gem_handles[p] = id;
   }
 
+  bo->modifier = GetBufferModifier(fd_, id);
+
   if (gr_handle->usage & GRALLOC_USAGE_PROTECTED) {
     bo->usage |= hwcomposer::kLayerProtected;
   } else if (gr_handle->usage & GRALLOC_USAGE_CURSOR) {
@@ -175,6 +178,7 @@ bool GrallocBufferHandler::ImportBuffer(HWCNativeHandle handle, HwcBuffer *bo) {
   }
 
   bo->prime_fd = gr_handle->prime_fd;
+  bo->modifier = GetBufferModifier(fd_, bo->gem_handles[0]);
 
   return true;
 }
@@ -51,6 +51,45 @@ typedef struct gralloc_handle* HWCNativeHandle;
 typedef android::String8 HWCString;
 typedef android::status_t err_status_t;
 
+// Returns a key identifying the graphics buffer wrapped by handle. The
+// gralloc_handle is owned by the layer and re-used for every buffer
+// set on it, hence we use the buffer_handle_t instead.
+inline const void* GetNativeBufferKey(HWCNativeHandle handle) {
+  return handle->handle_;
+}
+
+// Returns an id which differs for buffers that had the same key at
+// different times, i.e. a buffer freed by the client and a new one
+// imported at its address. Handles from SurfaceFlinger carry no
+// GraphicBuffer, their fds and ints are hashed instead.
+inline uint64_t GetNativeBufferId(HWCNativeHandle handle) {
+  if (handle->buffer_ != NULL)
+    return handle->buffer_->getId();
+
+  const native_handle_t* native = handle->handle_;
+  if (!native)
+    return 0;
+
+  // FNV-1a over the header and fds and ints of the handle.
+  uint64_t id = 14695981039346656037ULL;
+  const int* words = &native->numFds;
+  int count = 2 + native->numFds + native->numInts;
+  for (int i = 0; i < count; i++) {
+    id ^= static_cast<uint32_t>(words[i]);
+    id *= 1099511628211ULL;
+  }
+
+  return id;
+}
+
+// Returns the dma-buf fd of the first plane of handle.
+inline int GetNativeBufferFd(HWCNativeHandle handle) {
+  if (!handle->handle_ || handle->handle_->numFds < 1)
+    return -1;
+
+  return handle->handle_->data[0];
+}
+
 #define VTRACE(fmt, ...) ALOGV("%s: " fmt, __func__, ##__VA_ARGS__)
 #define DTRACE(fmt, ...) ALOGD("%s: " fmt, __func__, ##__VA_ARGS__)
 #define ITRACE(fmt, ...) ALOGI(fmt, ##__VA_ARGS__)
@@ -27,6 +27,7 @@
 #include <platformdefines.h>
 
 #include "drmutils.h"
+#include "hwcutils.h"
 
 namespace hwcomposer {
 
@@ -171,6 +172,7 @@ bool GbmBufferHandler::ImportBuffer(HWCNativeHandle handle, HwcBuffer *bo) {
   bo->pitches[0] = gbm_bo_get_stride(handle->bo);
 #endif
 
+  bo->modifier = GetBufferModifier(fd_, gem_handle);
   return true;
 }
 
@@ -0,0 +1,339 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "memfdbufferhandler.h"
+
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <hwcbuffer.h>
+#include <hwctrace.h>
+#include <platformdefines.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+// From linux/udmabuf.h, which older kernel headers don't have.
+#ifndef UDMABUF_CREATE
+struct udmabuf_create {
+  uint32_t memfd;
+  uint32_t flags;
+  uint64_t offset;
+  uint64_t size;
+};
+
+#define UDMABUF_FLAGS_CLOEXEC 0x01
+#define UDMABUF_CREATE _IOW('u', 0x42, struct udmabuf_create)
+#endif
+
+namespace hwcomposer {
+
+namespace {
+
+// Pitch alignment used for linear buffers by i915.
+const uint32_t kPitchAlignment = 64;
+
+struct BufferLayout {
+  uint32_t num_planes = 0;
+  uint32_t pitches[4] = {0, 0, 0, 0};
+  uint32_t offsets[4] = {0, 0, 0, 0};
+  // Bytes per sample and chroma subsampling of each plane.
+  uint32_t cpp[4] = {0, 0, 0, 0};
+  uint32_t subsample[4] = {1, 1, 1, 1};
+  size_t size = 0;
+};
+
+struct MapData {
+  void *addr;
+  size_t size;
+};
+
+uint32_t Align(uint32_t value, uint32_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t GetBytesPerPixel(uint32_t format) {
+  switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_ABGR8888:
+    case DRM_FORMAT_RGBX8888:
+    case DRM_FORMAT_RGBA8888:
+    case DRM_FORMAT_BGRX8888:
+    case DRM_FORMAT_BGRA8888:
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_ARGB2101010:
+    case DRM_FORMAT_XBGR2101010:
+    case DRM_FORMAT_ABGR2101010:
+    case DRM_FORMAT_AYUV:
+      return 4;
+    case DRM_FORMAT_RGB888:
+    case DRM_FORMAT_BGR888:
+      return 3;
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_BGR565:
+    case DRM_FORMAT_XRGB1555:
+    case DRM_FORMAT_ARGB1555:
+    case DRM_FORMAT_XRGB4444:
+    case DRM_FORMAT_ARGB4444:
+    case DRM_FORMAT_GR88:
+    case DRM_FORMAT_RG88:
+    case DRM_FORMAT_YUYV:
+    case DRM_FORMAT_YVYU:
+    case DRM_FORMAT_UYVY:
+    case DRM_FORMAT_VYUY:
+      return 2;
+    case DRM_FORMAT_C8:
+    case DRM_FORMAT_R8:
+      return 1;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+bool GetBufferLayout(uint32_t format, uint32_t width, uint32_t height,
+                     BufferLayout *layout) {
+  switch (format) {
+    case DRM_FORMAT_NV12:
+      // Full size Y plane followed by interleaved, half size UV plane.
+      layout->num_planes = 2;
+      layout->cpp[0] = 1;
+      layout->cpp[1] = 2;
+      layout->subsample[1] = 2;
+      break;
+    case DRM_FORMAT_YVU420:
+      layout->num_planes = 3;
+      layout->cpp[0] = 1;
+      layout->cpp[1] = 1;
+      layout->cpp[2] = 1;
+      layout->subsample[1] = 2;
+      layout->subsample[2] = 2;
+      break;
+    default:
+      layout->num_planes = 1;
+      layout->cpp[0] = GetBytesPerPixel(format);
+      if (!layout->cpp[0]) {
+        ETRACE("MemfdBufferHandler: Unsupported format %4.4s",
+               (char *)&format);
+        return false;
+      }
+  }
+
+  size_t offset = 0;
+  for (uint32_t i = 0; i < layout->num_planes; i++) {
+    uint32_t subsample = layout->subsample[i];
+    uint32_t plane_width = (width + subsample - 1) / subsample;
+    uint32_t plane_height = (height + subsample - 1) / subsample;
+    layout->pitches[i] = Align(plane_width * layout->cpp[i], kPitchAlignment);
+    layout->offsets[i] = offset;
+    offset += layout->pitches[i] * plane_height;
+  }
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  layout->size = (offset + page_size - 1) / page_size * page_size;
+  return true;
+}
+
+int GetBufferFd(HWCNativeHandle handle) {
+#ifdef USE_MINIGBM
+  return handle->import_data.fds[0];
+#else
+  return handle->import_data.fd;
+#endif
+}
+
+}  // namespace
+
+MemfdBufferHandler::MemfdBufferHandler() {
+  udmabuf_fd_ = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+  if (udmabuf_fd_ < 0)
+    ITRACE("MemfdBufferHandler: udmabuf not available, using memfd.");
+}
+
+MemfdBufferHandler::~MemfdBufferHandler() {
+  if (udmabuf_fd_ >= 0)
+    close(udmabuf_fd_);
+}
+
+int MemfdBufferHandler::ExportDmaBuf(int memfd, size_t size) {
+  if (udmabuf_fd_ < 0)
+    return -1;
+
+  // udmabuf requires the memfd can't shrink below the exported size.
+  if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK)) {
+    ETRACE("MemfdBufferHandler: failed to seal memfd %s", PRINTERROR());
+    return -1;
+  }
+
+  struct udmabuf_create create;
+  memset(&create, 0, sizeof(create));
+  create.memfd = memfd;
+  create.flags = UDMABUF_FLAGS_CLOEXEC;
+  create.offset = 0;
+  create.size = size;
+  int fd = ioctl(udmabuf_fd_, UDMABUF_CREATE, &create);
+  if (fd < 0)
+    ETRACE("MemfdBufferHandler: UDMABUF_CREATE failed %s", PRINTERROR());
+
+  return fd;
+}
+
+bool MemfdBufferHandler::CreateBuffer(uint32_t w, uint32_t h, int format,
+                                      HWCNativeHandle *handle) {
+  uint32_t drm_format = format;
+  if (drm_format == 0)
+    drm_format = DRM_FORMAT_XRGB8888;
+
+  BufferLayout layout;
+  if (!GetBufferLayout(drm_format, w, h, &layout))
+    return false;
+
+  int fd = syscall(SYS_memfd_create, "hwc-buffer",
+                   MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    ETRACE("MemfdBufferHandler: memfd_create failed %s", PRINTERROR());
+    return false;
+  }
+
+  if (ftruncate(fd, layout.size)) {
+    ETRACE("MemfdBufferHandler: failed to allocate %zu bytes %s", layout.size,
+           PRINTERROR());
+    close(fd);
+    return false;
+  }
+
+  // The dma-buf keeps the pages of the memfd alive, we don't need to
+  // hold on to it.
+  int dma_buf = ExportDmaBuf(fd, layout.size);
+  if (dma_buf >= 0) {
+    close(fd);
+    fd = dma_buf;
+  }
+
+  struct gbm_handle *temp = new struct gbm_handle();
+  temp->import_data.width = w;
+  temp->import_data.height = h;
+  temp->import_data.format = drm_format;
+#ifdef USE_MINIGBM
+  for (uint32_t i = 0; i < 4; i++) {
+    temp->import_data.fds[i] = i < layout.num_planes ? fd : -1;
+    temp->import_data.strides[i] = layout.pitches[i];
+    temp->import_data.offsets[i] = layout.offsets[i];
+  }
+#else
+  temp->import_data.fd = fd;
+  temp->import_data.stride = layout.pitches[0];
+#endif
+  temp->total_planes = layout.num_planes;
+  *handle = temp;
+
+  return true;
+}
+
+bool MemfdBufferHandler::DestroyBuffer(HWCNativeHandle handle) {
+  if (!handle)
+    return true;
+
+  close(GetBufferFd(handle));
+  delete handle;
+  return true;
+}
+
+bool MemfdBufferHandler::ImportBuffer(HWCNativeHandle handle, HwcBuffer *bo) {
+  memset(bo, 0, sizeof(struct HwcBuffer));
+  int fd = GetBufferFd(handle);
+  BufferLayout layout;
+  if (fd < 0 ||
+      !GetBufferLayout(handle->import_data.format, handle->import_data.width,
+                       handle->import_data.height, &layout))
+    return false;
+
+  bo->width = handle->import_data.width;
+  bo->height = handle->import_data.height;
+  bo->format = handle->import_data.format;
+  bo->prime_fd = fd;
+  // There is no GEM object behind the buffer. The fd is unique among
+  // live buffers, so it serves as handle.
+  for (uint32_t i = 0; i < layout.num_planes; i++) {
+    bo->gem_handles[i] = fd;
+    bo->pitches[i] = layout.pitches[i];
+    bo->offsets[i] = layout.offsets[i];
+  }
+
+  return true;
+}
+
+uint32_t MemfdBufferHandler::GetTotalPlanes(HWCNativeHandle handle) {
+  return handle->total_planes;
+}
+
+void *MemfdBufferHandler::Map(HWCNativeHandle handle, uint32_t x, uint32_t y,
+                              uint32_t /*width*/, uint32_t /*height*/,
+                              uint32_t *stride, void **map_data,
+                              size_t plane) {
+  BufferLayout layout;
+  if (!GetBufferLayout(handle->import_data.format, handle->import_data.width,
+                       handle->import_data.height, &layout) ||
+      plane >= layout.num_planes)
+    return NULL;
+
+  void *addr = mmap(NULL, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    GetBufferFd(handle), 0);
+  if (addr == MAP_FAILED) {
+    ETRACE("MemfdBufferHandler: mmap failed %s", PRINTERROR());
+    return NULL;
+  }
+
+  MapData *data = new MapData();
+  data->addr = addr;
+  data->size = layout.size;
+  *map_data = data;
+  *stride = layout.pitches[plane];
+
+  uint32_t subsample = layout.subsample[plane];
+  size_t offset = layout.offsets[plane] +
+                  (y / subsample) * layout.pitches[plane] +
+                  (x / subsample) * layout.cpp[plane];
+  return static_cast<uint8_t *>(addr) + offset;
+}
+
+void MemfdBufferHandler::UnMap(HWCNativeHandle /*handle*/, void *map_data) {
+  MapData *data = static_cast<MapData *>(map_data);
+  if (!data)
+    return;
+
+  munmap(data->addr, data->size);
+  delete data;
+}
+
+}  // namespace hwcomposer
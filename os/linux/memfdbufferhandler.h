@@ -0,0 +1,55 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef OS_LINUX_MEMFDBUFFERHANDLER_H_
+#define OS_LINUX_MEMFDBUFFERHANDLER_H_
+
+#include <nativebufferhandler.h>
+
+namespace hwcomposer {
+
+// Allocates linear buffers in anonymous shared memory (memfd). Buffers
+// have the same pitches, offsets and plane layout as linear GPU buffers.
+// Where /dev/udmabuf is available the memfd is exported as a dma-buf,
+// which GPU drivers can import, otherwise the plain memfd is used. There
+// are no GEM handles, the fd stands in for them, so buffers must only be
+// committed through FakeKMSBackend, never a real KMS device. Never
+// created implicitly, users pass it to OverlayBufferManager::Initialize
+// themselves.
+class MemfdBufferHandler : public NativeBufferHandler {
+ public:
+  MemfdBufferHandler();
+  ~MemfdBufferHandler() override;
+
+  bool CreateBuffer(uint32_t w, uint32_t h, int format,
+                    HWCNativeHandle *handle) override;
+  bool DestroyBuffer(HWCNativeHandle handle) override;
+  bool ImportBuffer(HWCNativeHandle handle, HwcBuffer *bo) override;
+  uint32_t GetTotalPlanes(HWCNativeHandle handle) override;
+  void *Map(HWCNativeHandle handle, uint32_t x, uint32_t y, uint32_t width,
+            uint32_t height, uint32_t *stride, void **map_data,
+            size_t plane) override;
+  void UnMap(HWCNativeHandle handle, void *map_data) override;
+
+ private:
+  // Returns a dma-buf of the first size bytes of memfd, or -1.
+  int ExportDmaBuf(int memfd, size_t size);
+
+  int udmabuf_fd_ = -1;
+};
+
+}  // namespace hwcomposer
+#endif  // OS_LINUX_MEMFDBUFFERHANDLER_H_
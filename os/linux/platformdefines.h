@@ -24,12 +24,19 @@
 
 #include <cstring>
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 
 #include <libsync.h>
 
 #include "string8.h"
 
+// Returns a new process wide unique id, never 0.
+inline uint64_t GenerateNativeBufferId() {
+  static std::atomic<uint64_t> next_id(1);
+  return next_id++;
+}
+
 struct gbm_handle {
 #ifdef USE_MINIGBM
   struct gbm_import_fd_planar_data import_data;
@@ -38,6 +45,8 @@ struct gbm_handle {
 #endif
   struct gbm_bo* bo = NULL;
   uint32_t total_planes = 0;
+  // Tells apart handles allocated at the same address.
+  uint64_t id = GenerateNativeBufferId();
 };
 
 typedef struct gbm_handle *HWCNativeHandle;
@@ -46,6 +55,28 @@ typedef int64_t nsecs_t;       // nano-seconds
 
 typedef int32_t err_status_t;
 
+// Returns a key identifying the graphics buffer wrapped by handle. This
+// stays the same for all frames in which the buffer is presented.
+inline const void *GetNativeBufferKey(HWCNativeHandle handle) {
+  return handle;
+}
+
+// Returns the dma-buf fd of the first plane of handle.
+inline int GetNativeBufferFd(HWCNativeHandle handle) {
+#ifdef USE_MINIGBM
+  return handle->import_data.fds[0];
+#else
+  return handle->import_data.fd;
+#endif
+}
+
+// Returns an id which differs for buffers that had the same key at
+// different times, i.e. a buffer freed by the client and a new one
+// allocated at its address.
+inline uint64_t GetNativeBufferId(HWCNativeHandle handle) {
+  return handle->id;
+}
+
 namespace hwcomposer {
 int property_get(const char *key, char *value, const char *default_value);
 
@@ -28,6 +28,8 @@ struct HwcBuffer {
   uint32_t gem_handles[4];
   uint32_t prime_fd;
   uint32_t usage;
+  // Tiling of the buffer, 0 for linear buffers.
+  uint64_t modifier;
 };
 
 #endif  // PUBLIC_HWCBUFFER_H_
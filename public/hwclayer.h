@@ -22,9 +22,19 @@
 
 #include <nativefence.h>
 
+#include <vector>
+
 namespace hwcomposer {
 
 struct HwcLayer {
+  HwcLayer() = default;
+  HwcLayer(const HwcLayer& rhs) = delete;
+  HwcLayer& operator=(const HwcLayer& rhs) = delete;
+  // Surface damage points into the layer's own rects, moves re-point
+  // it to the rects of the destination.
+  HwcLayer(HwcLayer&& rhs);
+  HwcLayer& operator=(HwcLayer&& rhs);
+
   ScopedFd acquire_fence;
   NativeFence release_fence;
 
@@ -62,6 +72,8 @@ struct HwcLayer {
     return display_frame_;
   }
 
+  // Rects of surface_damage are copied, caller doesn't need to keep
+  // them alive.
   void SetSurfaceDamage(const HwcRegion& surface_damage);
   const HwcRegion& GetSurfaceDamage() const {
     return surface_damage_;
@@ -75,6 +87,7 @@ struct HwcLayer {
   HWCBlending blending_ = HWCBlending::kBlendingNone;
   HWCNativeHandle sf_handle_ = 0;
   HwcRegion surface_damage_;
+  std::vector<HwcRect<int>> surface_damage_rects_;
 };
 
 }  // namespace hwcomposer
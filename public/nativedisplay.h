@@ -86,6 +86,17 @@ class NativeDisplay {
   virtual bool Present(std::vector<HwcLayer *> &source_layers,
                        int32_t *retire_fence) = 0;
 
+  /**
+   * API for querying when a frame presented now is expected to be shown.
+   * @param timestamp will be populated with the predicted vblank time in
+   *        CLOCK_MONOTONIC nanoseconds.
+   * @return false in case there is no prediction yet, i.e. no flip has
+   *         completed since the display was turned on.
+   */
+  virtual bool GetTargetPresentTime(int64_t * /*timestamp*/) {
+    return false;
+  }
+
   virtual int RegisterVsyncCallback(std::shared_ptr<VsyncCallback> callback,
                                     uint32_t display_id) = 0;
   virtual void VSyncControl(bool enabled) = 0;
@@ -0,0 +1,288 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Runs the display pipeline on FakeKMSBackend with memfd buffers, so
+// it can be exercised without a display or GPU. Flips complete
+// asynchronously after the configured commit latency. Checks that
+// buffers are released once, and only once, the frame showing them
+// has been replaced, and that no frame is skipped or lost.
+
+#include <drm_fourcc.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hwcdefs.h>
+#include <hwclayer.h>
+#include <scopedfd.h>
+
+#include <memory>
+#include <vector>
+
+#include "displayqueue.h"
+#include "fakekmsbackend.h"
+#include "memfdbufferhandler.h"
+#include "overlaybuffermanager.h"
+#include "rendererservice.h"
+
+namespace {
+
+// Exit code automake treats as a skipped test.
+const int kSkipped = 77;
+// Time fences get to signal when they are expected to.
+const int kFenceTimeoutMs = 1000;
+
+struct TestLayer {
+  hwcomposer::HwcLayer layer;
+  HWCNativeHandle handle = 0;
+};
+
+struct FrameFences {
+  hwcomposer::ScopedFd retire;
+  hwcomposer::ScopedFd release;
+};
+
+int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+bool IsSignalled(int fd, int timeout_ms) {
+  if (fd <= 0)
+    return true;
+
+  struct pollfd fds[1];
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  return poll(fds, 1, timeout_ms) > 0;
+}
+
+bool InitLayer(hwcomposer::NativeBufferHandler *handler, uint32_t width,
+               uint32_t height, int format, uint8_t value, TestLayer *test) {
+  if (!handler->CreateBuffer(width, height, format, &test->handle)) {
+    printf("Failed to create %ux%u buffer.\n", width, height);
+    return false;
+  }
+
+  uint32_t stride = 0;
+  void *map_data = NULL;
+  void *data =
+      handler->Map(test->handle, 0, 0, width, height, &stride, &map_data, 0);
+  if (!data) {
+    printf("Failed to map %ux%u buffer.\n", width, height);
+    return false;
+  }
+
+  memset(data, value, stride * height);
+  handler->UnMap(test->handle, map_data);
+
+  hwcomposer::HwcLayer &layer = test->layer;
+  layer.SetNativeHandle(test->handle);
+  layer.SetTransform(hwcomposer::kIdentity);
+  layer.SetSourceCrop(hwcomposer::HwcRect<float>(0, 0, width, height));
+  layer.SetDisplayFrame(hwcomposer::HwcRect<int>(0, 0, width, height));
+  layer.SetBlending(format == DRM_FORMAT_ARGB8888
+                        ? hwcomposer::HWCBlending::kBlendingPremult
+                        : hwcomposer::HWCBlending::kBlendingNone);
+  return true;
+}
+
+// Checks release fences of frames from *first on against the retire
+// fences. Buffers of a frame must be released once the next frame is
+// on screen, but not before the frame itself was. Advances *first
+// past frames whose buffers have been released.
+bool CheckFences(const std::vector<FrameFences> &fences, size_t *first) {
+  for (size_t i = *first; i < fences.size(); i++) {
+    // Release timeline is signalled before the retire timeline.
+    bool replaced =
+        i + 1 < fences.size() && IsSignalled(fences[i + 1].retire.get(), 0);
+    bool released =
+        IsSignalled(fences[i].release.get(), replaced ? kFenceTimeoutMs : 0);
+    if (replaced && !released) {
+      printf("Frame %zu was replaced, its buffers weren't released.\n", i);
+      return false;
+    }
+
+    if (released && !IsSignalled(fences[i].retire.get(), kFenceTimeoutMs)) {
+      printf("Buffers of frame %zu released before it was shown.\n", i);
+      return false;
+    }
+
+    if (released && i == *first)
+      (*first)++;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  uint32_t frames = 120;
+  hwcomposer::FakeKMSConfig config;
+  config.commit_latency_us = 8000;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:l:")) != -1) {
+    switch (opt) {
+      case 'f':
+        frames = strtoul(optarg, NULL, 10);
+        break;
+      case 'l':
+        config.commit_latency_us = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        printf("Usage: %s [-f frames] [-l commit_latency_us]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  // Out fences of the fake device and the release and retire fences
+  // of the display queue are all sw_sync fences.
+  if (access("/sys/kernel/debug/sync/sw_sync", R_OK | W_OK)) {
+    printf("SKIPPED: sw_sync is not available.\n");
+    return kSkipped;
+  }
+
+  hwcomposer::FakeKMSBackend kms(config);
+  hwcomposer::MemfdBufferHandler *handler =
+      new hwcomposer::MemfdBufferHandler();
+  hwcomposer::OverlayBufferManager buffer_manager;
+  if (!buffer_manager.Initialize(handler)) {
+    printf("Failed to initialize buffer manager.\n");
+    return 1;
+  }
+
+  hwcomposer::RendererService renderer_service;
+  std::unique_ptr<hwcomposer::DisplayQueue> queue(new hwcomposer::DisplayQueue(
+      &kms, kms.GetCrtcId(0), &buffer_manager, &renderer_service));
+
+  drmModeModeInfo mode;
+  kms.GetPreferredMode(&mode);
+  if (!queue->Initialize(config.width, config.height, 0,
+                         kms.GetConnectorId(0), mode) ||
+      !queue->SetPowerMode(hwcomposer::kOn)) {
+    printf("Failed to initialize display queue.\n");
+    return 1;
+  }
+
+  // A full screen primary and a cursor sized overlay which moves every
+  // frame. Both fit on planes, so no GPU composition is needed, and no
+  // frame is identical to the one before.
+  TestLayer primary;
+  TestLayer overlay;
+  const uint32_t overlay_size = 256;
+  if (!InitLayer(handler, config.width, config.height, DRM_FORMAT_XRGB8888,
+                 0x40, &primary) ||
+      !InitLayer(handler, overlay_size, overlay_size, DRM_FORMAT_ARGB8888,
+                 0x80, &overlay)) {
+    return 1;
+  }
+
+  int ret = 0;
+  int64_t total_ns = 0;
+  int64_t max_ns = 0;
+  std::vector<FrameFences> fences;
+  size_t first_unreleased = 0;
+  for (uint32_t i = 0; i < frames && !ret; i++) {
+    int left = (i * 8) % (config.width - overlay_size);
+    overlay.layer.SetDisplayFrame(hwcomposer::HwcRect<int>(
+        left, 0, left + overlay_size, overlay_size));
+
+    std::vector<hwcomposer::HwcLayer *> layers;
+    layers.emplace_back(&primary.layer);
+    layers.emplace_back(&overlay.layer);
+
+    int32_t retire_fence = -1;
+    int64_t start = NowNs();
+    bool success = queue->QueueUpdate(layers, &retire_fence);
+    int64_t elapsed = NowNs() - start;
+    if (!success) {
+      printf("QueueUpdate failed for frame %u.\n", i);
+      ret = 1;
+      break;
+    }
+
+    total_ns += elapsed;
+    if (elapsed > max_ns)
+      max_ns = elapsed;
+
+    // All layers of a frame share one release fence.
+    fences.emplace_back();
+    fences.back().retire.Reset(retire_fence);
+    fences.back().release.Reset(primary.layer.release_fence.Release());
+    overlay.layer.release_fence.Reset(-1);
+
+    if (!CheckFences(fences, &first_unreleased))
+      ret = 1;
+  }
+
+  if (!ret && !fences.empty()) {
+    // Last frame stays on screen, its buffers are still in use.
+    const FrameFences &last = fences.back();
+    if (!IsSignalled(last.retire.get(), kFenceTimeoutMs)) {
+      printf("Last frame wasn't shown.\n");
+      ret = 1;
+    } else if (!CheckFences(fences, &first_unreleased)) {
+      ret = 1;
+    } else if (IsSignalled(last.release.get(), 0)) {
+      printf("Buffers of the frame on screen were released.\n");
+      ret = 1;
+    }
+  }
+
+  uint32_t queued = fences.size();
+  uint32_t skipped = queue->GetSkippedCommitCount();
+  uint32_t dropped = queue->GetDroppedFrameCount();
+  queue->SetPowerMode(hwcomposer::kOff);
+  queue.reset();
+  fences.clear();
+
+  handler->DestroyBuffer(primary.handle);
+  handler->DestroyBuffer(overlay.handle);
+
+  printf("frames queued:     %u\n", queued);
+  printf("commits:           %u\n", kms.GetCommitCount());
+  printf("test commits:      %u\n", kms.GetTestCommitCount());
+  printf("failed commits:    %u\n", kms.GetFailedCommitCount());
+  printf("skipped commits:   %u\n", skipped);
+  printf("dropped frames:    %u\n", dropped);
+  if (queued) {
+    printf("QueueUpdate avg:   %lld us\n",
+           static_cast<long long>(total_ns / queued / 1000));
+    printf("QueueUpdate max:   %lld us\n",
+           static_cast<long long>(max_ns / 1000));
+  }
+
+  // Every frame differs from the one before, none can be skipped.
+  // Frames are either committed or dropped in favour of a newer one.
+  if (skipped) {
+    printf("Frames which changed were skipped.\n");
+    ret = 1;
+  }
+
+  if (dropped >= queued || kms.GetCommitCount() + dropped < queued) {
+    printf("Frames were lost.\n");
+    ret = 1;
+  }
+
+  printf("\n%s\n", ret ? "FAILED" : "PASSED");
+  return ret;
+}